@@ -0,0 +1,155 @@
+/* required for MSG_NOSIGNAL with stdc99 */
+#define _POSIX_C_SOURCE 200809L
+#include "ce-console.h"
+#include "ce-opt.h"
+#include <stdio.h> /* snprintf */
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <assert.h>
+
+static int is_blank(char c)
+{
+	return c == ' ' || c == '\t' || c == '\r';
+}
+
+int console_split(char *line, char *argv[], int max)
+{
+	assert(line != NULL && argv != NULL);
+	int argc = 0;
+	char *s = line;
+	while (1) {
+		for (; is_blank(*s); s++);
+		if (!*s)
+			return argc;
+		if (argc == max)
+			return -1;
+		/* unquoted in place, d never passes s */
+		char *d = argv[argc++] = s, q = '\0';
+		for (; *s && (q || !is_blank(*s)); s++) {
+			if (q ? *s == q : *s == '"' || *s == '\'') {
+				q = q ? '\0' : *s;
+				continue;
+			}
+			if (*s == '\\' && q != '\'' && s[1])
+				s++;
+			*d++ = *s;
+		}
+		if (q)
+			return -2;
+		if (*s)
+			s++;
+		*d = '\0';
+	}
+}
+
+/* options queued by the line console_exec() runs on this thread */
+static __thread int console_queued_n = 0;
+
+void console_queued()
+{
+	console_queued_n++;
+}
+
+int console_exec(char *line, char *reply, size_t size)
+{
+	assert(reply != NULL && size > 0);
+	char *argv[CONSOLE_ARGS_MAX];
+	int argc = console_split(line, argv, CONSOLE_ARGS_MAX), n;
+	if (argc < 0) {
+		n = snprintf(reply, size, "error: %s\n", argc == -1
+				? "too many arguments" : "unterminated quote");
+		return n < size ? n : size - 1;
+	}
+	reply[0] = '\0';
+	if (!argc || argv[0][0] == '#')
+		return 0;
+
+	struct optset *set = ce_options;
+	int first = 0;
+	if (argv[0][0] != '-') {
+		if (!(set = opt_set_find(argv[0]))) {
+			n = snprintf(reply, size, "error: no option set %s\n",
+					argv[0]);
+			return n < size ? n : size - 1;
+		}
+		first = 1;
+	}
+	int skipped;
+	console_queued_n = 0;
+	opt_live_begin(set);
+	int i = opt_parse(set, argc, argv, first);
+	int rejected = opt_live_end(set, &skipped), queued = console_queued_n;
+	console_queued_n = 0;
+
+	if (i < argc)
+		n = snprintf(reply, size, "error: argument %d is not an "
+				"option\n", i + 1);
+	else if (rejected || skipped)
+		n = snprintf(reply, size, "rejected %d, not live %d\n",
+				rejected, skipped);
+	else
+		n = snprintf(reply, size, queued ? "queued\n" : "ok\n");
+	return n < size ? n : size - 1;
+}
+
+void console_init(struct console *c, int fd_in, int fd_out)
+{
+	assert(c != NULL);
+	c->fd_in = fd_in;
+	c->fd_out = fd_out;
+	c->length = 0;
+	c->skip = 0;
+}
+
+static void console_reply(struct console *c, const char *reply, int n)
+{
+	if (!n)
+		return;
+	/* a socket closed by the peer mustn't raise SIGPIPE */
+	if (send(c->fd_out, reply, n, MSG_NOSIGNAL) < 0 && errno == ENOTSOCK
+			&& write(c->fd_out, reply, n) < 0) {
+		/* the reader is gone, the line was run */
+	}
+}
+
+static void console_line(struct console *c, char *line)
+{
+	char reply[128];
+	console_reply(c, reply, console_exec(line, reply, sizeof(reply)));
+}
+
+int console_read(struct console *c)
+{
+	assert(c != NULL);
+	ssize_t r = read(c->fd_in, c->buf + c->length,
+			sizeof(c->buf) - 1 - c->length);
+	if (r < 0 && (errno == EINTR || errno == EAGAIN))
+		return 0;
+	if (r <= 0) {
+		if (!r && c->length && !c->skip) {
+			c->buf[c->length] = '\0';
+			console_line(c, c->buf);
+		}
+		c->length = 0;
+		return -1;
+	}
+	c->length += r;
+	char *s = c->buf, *nl;
+	while ((nl = memchr(s, '\n', c->buf + c->length - s))) {
+		*nl = '\0';
+		if (!c->skip)
+			console_line(c, s);
+		c->skip = 0;
+		s = nl + 1;
+	}
+	c->length -= s - c->buf;
+	memmove(c->buf, s, c->length);
+	if (c->length == sizeof(c->buf) - 1) {
+		console_reply(c, "error: line too long\n", 21);
+		c->length = 0;
+		c->skip = 1;
+	}
+	return 0;
+}
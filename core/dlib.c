@@ -1,3 +1,5 @@
+/* required for posix_fadvise and mmap with stdc99 */
+#define _POSIX_C_SOURCE 200809L
 #include "ce-aux.h"
 #include "xf-escg.h"
 #include "ce-opt.h"
@@ -6,12 +8,33 @@
 #include <assert.h>
 #include <string.h>
 #include <stdlib.h>
+#include <pthread.h>
+#include <fcntl.h> /* posix_fadvise */
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 int dlib_load(const char *path);
+/* the --dynamic-lib-jobs argument of the command line dlib_prefetch() took */
+static const char *prefetch_jobs_arg = NULL;
 
 static int optcb(int index, const char *optarg)
 {
-	assert(index == 0 && optarg);
+	assert((index == 0 || index == 1) && optarg);
+	if (index == 1) { /* taken by dlib_prefetch() */
+		if (optarg != prefetch_jobs_arg) {
+			lputs(ERR "Option --dynamic-lib-jobs only applies on "
+					"the command line.");
+			return 1;
+		}
+		int jobs = atoi(optarg);
+		if (jobs < 0) {
+			lprintf(WRN "Invalid dynamic library job count '"
+					lBLD_"%s"_lBLD"'.\n", optarg);
+			return 1;
+		}
+		return 0;
+	}
 
 	return dlib_load(optarg);
 }
@@ -22,6 +45,10 @@ static struct optsection dlib_opts = {
 	.opt_a = {
 		{ ARG_REQUIRED, 'y', "dynamic-lib",
 			"PATH\tLoad a dynamic library." },
+		{ ARG_REQUIRED, '\0', "dynamic-lib-jobs", "N\t"
+			"Read the libraries of -y on the command line ahead "
+			"with N threads, while they are opened in order; "
+			"only given on the command line." },
 		{ ARG_NONE, '\0', NULL, NULL }
 	},
 };
@@ -102,6 +129,117 @@ static void __attribute__((destructor(50001))) dlibs_unload()
 		lprintf(INF "Unloaded "lF_BLUE"%i"_lF" dynamic libraries.\n", j);
 }
 
+/*
+ * The -y libraries of the command line read ahead, --dynamic-lib-jobs: the
+ * threads fault the files into the page cache in parallel while
+ * dlib_load() opens them one at a time in the order given, as the loader
+ * serializes dlopen() and the constructors register modules and options
+ * the options after them use.
+ */
+#define PREFETCH_MAX 256
+#define PREFETCH_JOBS_MAX 16
+static const char *prefetch_a[PREFETCH_MAX];
+static int prefetch_length = 0;
+static int prefetch_next = 0; /* atomic, next of prefetch_a to read */
+static pthread_t prefetch_thread[PREFETCH_JOBS_MAX];
+static int prefetch_jobs = 0;
+
+static void *prefetch_run(void *nothing)
+{
+	long page = sysconf(_SC_PAGESIZE);
+	int i;
+	while ((i = __atomic_fetch_add(&prefetch_next, 1, __ATOMIC_RELAXED))
+			< prefetch_length) {
+		int fd = open(prefetch_a[i], O_RDONLY);
+		struct stat st;
+		if (fd < 0)
+			continue;
+		if (fstat(fd, &st) || !st.st_size) {
+			close(fd);
+			continue;
+		}
+		posix_fadvise(fd, 0, 0, POSIX_FADV_WILLNEED);
+		const volatile char *m = mmap(NULL, st.st_size, PROT_READ,
+				MAP_PRIVATE, fd, 0);
+		close(fd);
+		if (m == MAP_FAILED)
+			continue;
+		for (off_t o = 0; o < st.st_size; o += page)
+			(void) m[o];
+		munmap((void *) m, st.st_size);
+	}
+	return NULL;
+}
+
+/**
+ * dlib_prefetch() - start reading the -y libraries of the command line
+ * @argc:	argument count of main()
+ * @argv:	argument vector of main()
+ *
+ * Does nothing unless --dynamic-lib-jobs is given with over one library.
+ * The arguments are scanned ahead of opt_parse() for "-y PATH", "-yPATH",
+ * "--dynamic-lib PATH" and "--dynamic-lib=PATH", a mistaken match only
+ * costing a read; the names without a '/' are searched for by dlopen() and
+ * not read. Call dlib_prefetch_end() once
+ * they are loaded.
+ */
+void dlib_prefetch(int argc, char * const argv[])
+{
+	static const char lib[] = "--dynamic-lib", jobs[] = "-jobs";
+	const int len = sizeof(lib) - 1;
+	int j = 0;
+	for (int i = 1; i < argc; i++) {
+		const char *a = argv[i], *v = NULL;
+		if (!strcmp(a, "--"))
+			break;
+		if (a[0] != '-') { /* an argument, or past the options */
+			continue;
+		} else if (a[1] == 'y') {
+			v = a[2] ? a + 2 : argv[++i];
+		} else if (!strncmp(a, lib, len) && !strncmp(a + len, jobs, 5)) {
+			const char *n = a[len + 5] == '=' ? a + len + 6
+				: !a[len + 5] ? argv[++i] : NULL;
+			if (n)
+				j = atoi(prefetch_jobs_arg = n);
+			continue;
+		} else if (!strncmp(a, lib, len) && (!a[len] || a[len] == '=')) {
+			v = a[len] ? a + len + 1 : argv[++i];
+		}
+		if (i == argc)
+			break;
+		if (v && strchr(v, '/') && prefetch_length < PREFETCH_MAX)
+			prefetch_a[prefetch_length++] = v;
+	}
+	if (j > PREFETCH_JOBS_MAX)
+		j = PREFETCH_JOBS_MAX;
+	if (j > prefetch_length)
+		j = prefetch_length;
+	if (prefetch_length < 2 || j < 1) {
+		prefetch_length = 0;
+		return;
+	}
+	for (prefetch_jobs = 0; prefetch_jobs < j; prefetch_jobs++) {
+		if (pthread_create(prefetch_thread + prefetch_jobs, NULL,
+					prefetch_run, NULL))
+			break;
+	}
+	lprintf(DBG "Reading ahead "lF_BLUE"%i"_lF" dynamic libraries with "
+			lF_BLUE"%i"_lF" threads.\n", prefetch_length,
+			prefetch_jobs);
+}
+
+/**
+ * dlib_prefetch_end() - wait for the reading of dlib_prefetch() to end
+ */
+void dlib_prefetch_end()
+{
+	for (int i = 0; i < prefetch_jobs; i++)
+		pthread_join(prefetch_thread[i], NULL);
+	prefetch_jobs = 0;
+	prefetch_length = 0;
+	prefetch_next = 0;
+}
+
 int dlib_load(const char *path)
 {
 	assert(libs_a != NULL);
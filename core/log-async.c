@@ -0,0 +1,478 @@
+/**
+ * DOC: ce-log asynchronous mode
+ * In asynchronous mode the logging threads only copy their complete lines
+ * into a per-thread single-producer single-consumer &struct log_ring. A
+ * dedicated writer thread drains the rings, stamps the lines
+ * (log_raw_stamp()) and pushes them to the listeners, so disk I/O,
+ * header insertion and SGR filtering never happen on the logging thread.
+ *
+ * Producing takes no locks: the producer owns @tail, the writer owns @head
+ * and both are published with release stores. The writer sleeps on
+ * @async_wake when all the rings are empty and producers post it only
+ * when it has announced that in @async_idle.
+ *
+ * When a ring is full, &enum log_async_policy decides whether the producer
+ * waits for the writer or drops the message. A waiting producer sleeps on
+ * @async_drained, broadcast by the writer as it frees space while anyone
+ * waits in @async_waiters.
+ *
+ * The writer merges the rings by the timestamp of their oldest record, so
+ * lines from different threads keep their order to the timestamp
+ * resolution.
+ */
+#include <semaphore.h>
+#include <sched.h> /* sched_yield */
+#include <stdint.h> /* uint32_t */
+
+/**
+ * struct log_ring - a per-thread queue of log lines
+ * @next:	next ring in @async_rings
+ * @size:	size of @buf in bytes, a power of two
+ * @head:	offset of the oldest record, advanced by the writer
+ * @tail:	offset after the newest record, advanced by the producer
+ * @dead:	the producing thread has exited; the writer releases the ring
+ *		once it is empty
+ * @dropped:	messages dropped by the producer since the writer last
+ *		reported it
+ * @buf:	the records, each a &struct log_ring_rec followed by the
+ *		lines and padded to 8 bytes
+ *
+ * @head and @tail are free-running, the position in @buf is given by
+ * masking them with @size - 1.
+ */
+struct log_ring {
+	struct log_ring *next;
+	unsigned int size;
+	unsigned int head;
+	unsigned int tail;
+	int dead;
+	unsigned int dropped;
+	char buf[] __attribute__((aligned(8)));
+};
+
+/**
+ * struct log_ring_rec - header of a record in &struct log_ring
+ * @length:	length of the lines that follow or %LOG_RING_WRAP
+ * @fields:	length of the copy of the last line's &struct log_fields
+ *		following the lines, 8 byte aligned, or %0
+ * @time:	nanoseconds since logstart when the lines were logged
+ *
+ * A %LOG_RING_WRAP record fills the end of the buffer when the next record
+ * would not fit there contiguously.
+ */
+struct log_ring_rec {
+	uint32_t length;
+	uint32_t fields;
+	uint64_t time;
+};
+#define LOG_RING_WRAP UINT32_MAX
+#define LOG_RING_ALIGN(n) (((n) + 7) & ~7u)
+
+static int async_on = 0; /* atomic, producers check it */
+static int async_users = 0; /* atomic, producers in log_async_queue() */
+static unsigned int async_gen = 0; /* rings freed by log_async_stop() */
+static int async_policy = LOG_ASYNC_COUNT;
+static unsigned int async_ring_size = 1 << 16;
+static struct log_ring *async_rings = NULL; /* added to under async_mutex */
+static pthread_mutex_t async_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t async_thread;
+static int async_stop = 0;
+static int async_idle = 0;
+static sem_t async_wake;
+static int async_waiters = 0; /* atomic, producers in log_ring_wait() */
+static pthread_mutex_t async_wait_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t async_drained = PTHREAD_COND_INITIALIZER;
+/* The writer and dumping threads always log synchronously. */
+static __thread bool async_bypass = false;
+static __thread struct log_ring *thring = NULL;
+static __thread unsigned int thring_gen; /* async_gen of thring */
+
+/**
+ * log_ring_get() - get the calling thread's ring, creating it if needed
+ *
+ * Return:	the ring or %NULL if it couldn't be allocated
+ */
+static struct log_ring *log_ring_get()
+{
+	if (thring && thring_gen == __atomic_load_n(&async_gen,
+				__ATOMIC_ACQUIRE))
+		return thring;
+	struct log_ring *r = malloc(sizeof(struct log_ring) + async_ring_size);
+	if (!r)
+		return NULL;
+	r->size = async_ring_size;
+	r->head = 0;
+	r->tail = 0;
+	r->dead = 0;
+	r->dropped = 0;
+	pthread_mutex_lock(&async_mutex);
+	r->next = async_rings;
+	__atomic_store_n(&async_rings, r, __ATOMIC_RELEASE);
+	thring_gen = async_gen;
+	pthread_mutex_unlock(&async_mutex);
+	thring = r;
+	return r;
+}
+
+/**
+ * log_ring_release() - let the writer release the calling thread's ring
+ */
+static void log_ring_release()
+{
+	if (!thring)
+		return;
+	pthread_mutex_lock(&async_mutex);
+	if (thring_gen == async_gen) /* else freed by log_async_stop() */
+		__atomic_store_n(&thring->dead, 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&async_mutex);
+	thring = NULL;
+}
+
+static void log_async_wake()
+{
+	if (__atomic_exchange_n(&async_idle, 0, __ATOMIC_SEQ_CST))
+		sem_post(&async_wake);
+}
+
+/**
+ * log_ring_wait() - wait for the writer to free space in a ring
+ * @r:		the calling thread's ring
+ * @tail:	@r->tail
+ * @space:	bytes to wait to be free, @r->size for @r to be empty
+ */
+static void log_ring_wait(struct log_ring *r, unsigned int tail,
+		unsigned int space)
+{
+	__atomic_add_fetch(&async_waiters, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_lock(&async_wait_mutex);
+	while (r->size - (tail - __atomic_load_n(&r->head, __ATOMIC_SEQ_CST))
+			< space) {
+		log_async_wake();
+		pthread_cond_wait(&async_drained, &async_wait_mutex);
+	}
+	pthread_mutex_unlock(&async_wait_mutex);
+	__atomic_sub_fetch(&async_waiters, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * log_ring_advance() - free the oldest record of a ring, by the writer
+ * @r:		the ring
+ * @length:	length of the record
+ */
+static void log_ring_advance(struct log_ring *r, unsigned int length)
+{
+	__atomic_store_n(&r->head, r->head + length, __ATOMIC_SEQ_CST);
+	if (!__atomic_load_n(&async_waiters, __ATOMIC_SEQ_CST))
+		return;
+	pthread_mutex_lock(&async_wait_mutex);
+	pthread_cond_broadcast(&async_drained);
+	pthread_mutex_unlock(&async_wait_mutex);
+}
+
+/**
+ * log_async_push() - queue complete lines for the writer thread
+ * @s:		the lines, ending with a '\n'
+ * @length:	length of @s
+ * @t:		nanoseconds since logstart
+ * @fields:	fields of the last line or %NULL
+ *
+ * Lines too long for the ring are left to be logged synchronously once the
+ * ring is empty, after the lines of the thread queued before them.
+ *
+ * Return:	%0 if queued or dropped, negative if the lines have to be
+ *		logged synchronously instead
+ */
+static int log_async_push(const char *s, int length, unsigned long long t,
+		const struct log_fields *fields)
+{
+	struct log_ring *r = log_ring_get();
+	if (!r)
+		return -1;
+	unsigned int fsize = fields ? log_fields_size(fields) : 0;
+	unsigned int need = sizeof(struct log_ring_rec) + LOG_RING_ALIGN(length)
+		+ fsize;
+	if (need > r->size / 2) {
+		/* would starve the ring, log it directly but in order */
+		log_ring_wait(r, r->tail, r->size);
+		return -1;
+	}
+
+	unsigned int tail = r->tail;
+	for (;;) {
+		unsigned int head = __atomic_load_n(&r->head, __ATOMIC_ACQUIRE);
+		unsigned int off = tail & (r->size - 1);
+		unsigned int pad = r->size - off < need ? r->size - off : 0;
+		if (r->size - (tail - head) >= need + pad) {
+			if (pad) {
+				struct log_ring_rec *w =
+					(struct log_ring_rec *) (r->buf + off);
+				w->length = LOG_RING_WRAP;
+				tail += pad;
+				off = 0;
+			}
+			break;
+		}
+		if (async_policy != LOG_ASYNC_BLOCK) {
+			__atomic_add_fetch(&r->dropped, 1, __ATOMIC_RELAXED);
+			return 0;
+		}
+		log_ring_wait(r, tail, need + pad);
+	}
+
+	struct log_ring_rec *rec = (struct log_ring_rec *) (r->buf
+			+ (tail & (r->size - 1)));
+	rec->length = length;
+	rec->fields = fsize;
+	rec->time = t;
+	memcpy(rec + 1, s, length);
+	if (fields)
+		log_fields_copy((char *) (rec + 1) + LOG_RING_ALIGN(length),
+				fields);
+	__atomic_store_n(&r->tail, tail + need, __ATOMIC_RELEASE);
+	log_async_wake();
+	return 0;
+}
+
+/**
+ * log_async_queue() - queue complete lines if in asynchronous mode
+ * @s:		the lines, ending with a '\n'
+ * @length:	length of @s
+ * @t:		nanoseconds since logstart
+ * @fields:	fields of the last line or %NULL
+ *
+ * Counts the producer in @async_users while it's pushing, so that
+ * log_async_stop() drains only once the pushes it raced with are done.
+ *
+ * Return:	%0 if queued or dropped, negative if the lines have to be
+ *		logged synchronously instead
+ */
+static int log_async_queue(const char *s, int length, unsigned long long t,
+		const struct log_fields *fields)
+{
+	if (async_bypass || !__atomic_load_n(&async_on, __ATOMIC_ACQUIRE))
+		return -1;
+	int rv = -1;
+	__atomic_add_fetch(&async_users, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&async_on, __ATOMIC_SEQ_CST))
+		rv = log_async_push(s, length, t, fields);
+	__atomic_sub_fetch(&async_users, 1, __ATOMIC_RELEASE);
+	return rv;
+}
+
+/**
+ * log_ring_peek() - get the oldest record of a ring
+ * @r:		ring to look into
+ *
+ * Skips over the wrap records.
+ *
+ * Return:	the record or %NULL if @r is empty
+ */
+static struct log_ring_rec *log_ring_peek(struct log_ring *r)
+{
+	unsigned int tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+	while (r->head != tail) {
+		struct log_ring_rec *rec = (struct log_ring_rec *) (r->buf
+				+ (r->head & (r->size - 1)));
+		if (rec->length != LOG_RING_WRAP)
+			return rec;
+		__atomic_store_n(&r->head, r->head + (r->size
+				- (r->head & (r->size - 1))), __ATOMIC_RELEASE);
+	}
+	return NULL;
+}
+
+/**
+ * log_async_drain() - log everything queued in the rings
+ *
+ * The lines are stamped right from the ring, which is only advanced after.
+ * Called by the writer thread, and at exit after the writer has stopped.
+ * Only the draining thread removes rings from @async_rings, so the list is
+ * walked without holding @async_mutex, which only guards the removal
+ * against producers adding their rings.
+ *
+ * Return:	the count of records logged
+ */
+static int log_async_drain()
+{
+	int cnt = 0;
+	unsigned int dropped = 0;
+	for (;;) {
+		struct log_ring *r, *min = NULL;
+		struct log_ring_rec *rec, *minrec = NULL;
+		r = __atomic_load_n(&async_rings, __ATOMIC_ACQUIRE);
+		for (; r != NULL; r = r->next) {
+			rec = log_ring_peek(r);
+			if (rec && (!minrec || rec->time < minrec->time)) {
+				min = r;
+				minrec = rec;
+			}
+		}
+		if (!min)
+			break;
+		char *text = (char *) (minrec + 1);
+		log_raw_stamp(text, minrec->length, minrec->time,
+				minrec->fields ? (struct log_fields *) (text
+					+ LOG_RING_ALIGN(minrec->length)) : NULL);
+		unsigned int len = sizeof(struct log_ring_rec)
+			+ LOG_RING_ALIGN(minrec->length) + minrec->fields;
+		log_ring_advance(min, len);
+		cnt++;
+	}
+
+	/* report drops and release the rings of exited threads */
+	pthread_mutex_lock(&async_mutex);
+	struct log_ring **p = &async_rings;
+	while (*p != NULL) {
+		struct log_ring *r = *p;
+		dropped += __atomic_exchange_n(&r->dropped, 0,
+				__ATOMIC_RELAXED);
+		if (__atomic_load_n(&r->dead, __ATOMIC_ACQUIRE)
+				&& !log_ring_peek(r)) {
+			*p = r->next;
+			free(r);
+			continue;
+		}
+		p = &r->next;
+	}
+	pthread_mutex_unlock(&async_mutex);
+	if (dropped && async_policy == LOG_ASYNC_COUNT)
+		lprintf(WRN "Asynchronous logging dropped "
+				lF_YELW"%u"_lF" messages.\n", dropped);
+	return cnt;
+}
+
+/**
+ * log_async_sync() - wait for the writer to log what is queued
+ *
+ * Waits only for the records queued before the call.
+ */
+static void log_async_sync()
+{
+	struct { struct log_ring *r; unsigned int tail; } *snap = NULL;
+	int n = 0, size = 0;
+	pthread_mutex_lock(&async_mutex);
+	for (struct log_ring *r = async_rings; r != NULL; r = r->next) {
+		if (n == size) {
+			size = size ? size * 2 : 8;
+			snap = realloc(snap, size * sizeof(snap[0]));
+			assert(snap);
+		}
+		snap[n].r = r;
+		snap[n++].tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+	}
+	pthread_mutex_unlock(&async_mutex);
+	for (int i = 0; i < n; ) {
+		bool done = true; /* or released, then it had been drained */
+		pthread_mutex_lock(&async_mutex);
+		for (struct log_ring *r = async_rings; r != NULL; r = r->next) {
+			if (r == snap[i].r) {
+				done = (int) (__atomic_load_n(&r->head,
+						__ATOMIC_ACQUIRE)
+						- snap[i].tail) >= 0;
+				break;
+			}
+		}
+		pthread_mutex_unlock(&async_mutex);
+		if (done) {
+			i++;
+			continue;
+		}
+		log_async_wake();
+		sched_yield();
+	}
+	free(snap);
+}
+
+static void *log_async_writer(void *nothing)
+{
+	assert(nothing == NULL); /* As passed from pthread_create */
+	async_bypass = true;
+	if (!thbuf)
+		log_thread_init(); /* logfile_callback() needs lfbuf */
+	while (!__atomic_load_n(&async_stop, __ATOMIC_ACQUIRE)) {
+		if (log_async_drain())
+			continue;
+		__atomic_store_n(&async_idle, 1, __ATOMIC_SEQ_CST);
+		if (log_async_drain()) { /* raced with a producer */
+			__atomic_store_n(&async_idle, 0, __ATOMIC_SEQ_CST);
+			continue;
+		}
+		logfile_flushall(); /* nothing more to batch for now */
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += 100 * 1000 * 1000; /* 100ms */
+		if (ts.tv_nsec >= 1000 * 1000 * 1000) {
+			ts.tv_sec += 1;
+			ts.tv_nsec -= 1000 * 1000 * 1000;
+		}
+		sem_timedwait(&async_wake, &ts);
+		__atomic_store_n(&async_idle, 0, __ATOMIC_SEQ_CST);
+	}
+	log_async_drain();
+	return NULL;
+}
+
+int log_async_start(int policy, int ring_size)
+{
+	assert(policy == LOG_ASYNC_BLOCK || policy == LOG_ASYNC_DROP
+			|| policy == LOG_ASYNC_COUNT);
+	if (__atomic_load_n(&async_on, __ATOMIC_ACQUIRE)) {
+		async_policy = policy;
+		return 0;
+	}
+	if (ring_size > 0) {
+		unsigned int s;
+		for (s = 1 << 12; s < ring_size; s <<= 1);
+		async_ring_size = s;
+	}
+	async_policy = policy;
+	async_stop = 0;
+	sem_init(&async_wake, 0, 0);
+	if (pthread_create(&async_thread, NULL, log_async_writer, NULL)) {
+		sem_destroy(&async_wake);
+		lputs(ERR "Failed to start the log writer thread.");
+		return -1;
+	}
+	__atomic_store_n(&async_on, 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+void log_async_stop()
+{
+	if (!__atomic_exchange_n(&async_on, 0, __ATOMIC_SEQ_CST))
+		return;
+	/* the writer still runs for the blocked pushes to finish */
+	while (__atomic_load_n(&async_users, __ATOMIC_SEQ_CST)) {
+		log_async_wake();
+		sched_yield();
+	}
+	__atomic_store_n(&async_stop, 1, __ATOMIC_RELEASE);
+	sem_post(&async_wake);
+	pthread_join(async_thread, NULL);
+	sem_destroy(&async_wake);
+
+	/* lines queued while the writer was stopping */
+	async_bypass = true;
+	log_async_drain();
+	async_bypass = false;
+
+	/* the rings are empty, the threads get new ones on a restart */
+	pthread_mutex_lock(&async_mutex);
+	while (async_rings) {
+		struct log_ring *r = async_rings;
+		async_rings = r->next;
+		free(r);
+	}
+	__atomic_add_fetch(&async_gen, 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&async_mutex);
+}
+
+static size_t log_async_memcnt()
+{
+	size_t cnt = 0;
+	pthread_mutex_lock(&async_mutex);
+	for (struct log_ring *r = async_rings; r != NULL; r = r->next)
+		cnt += sizeof(struct log_ring) + r->size;
+	pthread_mutex_unlock(&async_mutex);
+	return cnt;
+}
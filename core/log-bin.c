@@ -0,0 +1,361 @@
+/**
+ * DOC: ce-log binary sink
+ * The binary log records lprintf() and lputs() calls without formatting
+ * them - only the call site, the time and the raw arguments are written, see
+ * ce-log-bin.h for the format. The call sites are identified by the address
+ * of their format string, so the format itself is written only the first
+ * time a site logs.
+ *
+ * Messages less important than @bin_text_thres are only recorded in binary;
+ * the header-less continuation pieces of a line follow the line's first
+ * piece. Rendering them is left to the logdec tool.
+ */
+#include "ce-log-bin.h"
+
+static FILE *bin_f = NULL;
+static int bin_on = 0; /* atomic, lprintf() checks it */
+static int bin_text_thres = '5';
+static pthread_mutex_t bin_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * struct bin_site - an entry in the open addressing site table
+ * @fmt:	the format string of the site or %NULL for free entries
+ * @id:		the id the site was written with
+ */
+struct bin_site {
+	const char *fmt;
+	uint32_t id;
+};
+
+static struct bin_site *bin_sites = NULL;
+static unsigned int bin_sites_size = 0; /* power of two */
+static uint32_t bin_sites_length = 0;
+
+static __thread struct {
+	char *a;
+	unsigned int length;
+	unsigned int size;
+	uint32_t thread;
+	bool only;
+} binbuf;
+static uint32_t bin_threads = 0;
+
+static void binbuf_add(const void *data, unsigned int length)
+{
+	if (binbuf.length + length > binbuf.size) {
+		do {
+			binbuf.size = binbuf.size ? binbuf.size * 2 : 256;
+		} while (binbuf.length + length > binbuf.size);
+		binbuf.a = realloc(binbuf.a, binbuf.size);
+		assert(binbuf.a);
+	}
+	memcpy(binbuf.a + binbuf.length, data, length);
+	binbuf.length += length;
+}
+
+static void binbuf_add_u32(uint32_t v)
+{
+	binbuf_add(&v, sizeof(v));
+}
+
+static void log_bin_thread_release()
+{
+	free(binbuf.a);
+	binbuf.a = NULL;
+	binbuf.size = 0;
+	binbuf.length = 0;
+}
+
+/**
+ * bin_lvl() - find the level of a message
+ * @fmt:	the format string or lputs() string
+ *
+ * Return:	the level character ('1'-'5') or %0 for continuation pieces
+ */
+static int bin_lvl(const char *fmt)
+{
+	const char *c = strchr(fmt, ':');
+	if (!c || c[1] < '1' || c[1] > '5' || c[2] != ':')
+		return 0;
+	return c[1];
+}
+
+static uint32_t bin_hash(const char *fmt)
+{
+	uintptr_t p = (uintptr_t) fmt;
+	return (uint32_t) ((p >> 3) * 2654435761u);
+}
+
+/**
+ * bin_site_id() - get the id of a call site, writing its format if new
+ * @fmt:	format string of the site
+ *
+ * Called with @bin_mutex held.
+ *
+ * Return:	the id
+ */
+static uint32_t bin_site_id(const char *fmt)
+{
+	unsigned int i;
+	if ((bin_sites_length + 1) * 2 > bin_sites_size) {
+		unsigned int osize = bin_sites_size;
+		struct bin_site *o = bin_sites;
+		bin_sites_size = osize ? osize * 2 : 256;
+		bin_sites = calloc(bin_sites_size, sizeof(bin_sites[0]));
+		assert(bin_sites);
+		for (unsigned int y = 0; y < osize; y++) {
+			if (!o[y].fmt)
+				continue;
+			i = bin_hash(o[y].fmt) & (bin_sites_size - 1);
+			for (; bin_sites[i].fmt; i = (i + 1) & (bin_sites_size - 1));
+			bin_sites[i] = o[y];
+		}
+		free(o);
+	}
+	i = bin_hash(fmt) & (bin_sites_size - 1);
+	for (; bin_sites[i].fmt; i = (i + 1) & (bin_sites_size - 1)) {
+		if (bin_sites[i].fmt == fmt)
+			return bin_sites[i].id;
+	}
+	bin_sites[i].fmt = fmt;
+	bin_sites[i].id = LOG_BIN_SITE_PUTS + 1 + bin_sites_length++;
+
+	uint32_t def[3] = { LOG_BIN_SITE_DEF, sizeof(uint32_t) + strlen(fmt),
+		bin_sites[i].id };
+	fwrite(def, sizeof(def), 1, bin_f);
+	fwrite(fmt, 1, def[1] - sizeof(uint32_t), bin_f);
+	return bin_sites[i].id;
+}
+
+/**
+ * bin_args() - store the arguments of a format
+ * @fmt:	printf format
+ * @l:		the arguments
+ */
+static void bin_args(const char *fmt, va_list l)
+{
+	struct log_bin_spec spec;
+	int32_t i;
+	int64_t ll;
+	double d;
+	uint32_t len;
+	const char *s;
+	for (fmt = strchr(fmt, '%'); fmt; fmt = strchr(fmt, '%')) {
+		fmt = log_bin_conv(fmt, &spec);
+		int prec = spec.prec;
+		if (spec.width_arg) {
+			i = va_arg(l, int);
+			binbuf_add(&i, sizeof(i));
+		}
+		if (spec.prec_arg) {
+			i = va_arg(l, int);
+			binbuf_add(&i, sizeof(i));
+			prec = i;
+		}
+		switch (spec.type) {
+		case LOG_BIN_INT:
+			i = va_arg(l, int);
+			binbuf_add(&i, sizeof(i));
+			break;
+		case LOG_BIN_LONG:
+			ll = va_arg(l, long long);
+			binbuf_add(&ll, sizeof(ll));
+			break;
+		case LOG_BIN_DOUBLE:
+			d = spec.ldouble ? va_arg(l, long double)
+				: va_arg(l, double);
+			binbuf_add(&d, sizeof(d));
+			break;
+		case LOG_BIN_STR:
+			s = va_arg(l, const char *);
+			if (!s)
+				s = "(null)";
+			if (prec >= 0)
+				for (len = 0; len < prec && s[len]; len++);
+			else
+				len = strlen(s);
+			binbuf_add_u32(len);
+			binbuf_add(s, len);
+			break;
+		case LOG_BIN_PTR:
+			ll = (intptr_t) va_arg(l, void *);
+			binbuf_add(&ll, sizeof(ll));
+			break;
+		case LOG_BIN_COUNT:
+			va_arg(l, void *);
+			break;
+		}
+	}
+}
+
+/**
+ * log_bin_write() - record a message
+ * @fmt:	the format string, its address identifies the call site
+ * @site:	%LOG_BIN_SITE_PUTS, or %0 or %LOG_BIN_KV to look up the id of
+ *		@fmt (and mark the record as structured)
+ * @t:		nanoseconds since logstart
+ *
+ * The arguments are taken from binbuf.
+ */
+static void log_bin_write(const char *fmt, uint32_t site, uint64_t t)
+{
+	if (!binbuf.thread)
+		binbuf.thread = __atomic_add_fetch(&bin_threads, 1,
+				__ATOMIC_RELAXED);
+
+	pthread_mutex_lock(&bin_mutex);
+	if (!bin_f) {
+		pthread_mutex_unlock(&bin_mutex);
+		return;
+	}
+	if (!site || site == LOG_BIN_KV)
+		site |= bin_site_id(fmt);
+	uint32_t rec[3] = { site, sizeof(uint32_t) + sizeof(t) + binbuf.length,
+		binbuf.thread };
+	fwrite(rec, sizeof(rec), 1, bin_f);
+	fwrite(&t, sizeof(t), 1, bin_f);
+	fwrite(binbuf.a, 1, binbuf.length, bin_f);
+	pthread_mutex_unlock(&bin_mutex);
+}
+
+/**
+ * log_bin_vprintf() - record an lprintf() message
+ * @fmt:	printf format
+ * @l:		the arguments
+ * @t:		nanoseconds since logstart
+ *
+ * Return:	true when the message is recorded only in binary
+ */
+static bool log_bin_vprintf(const char *fmt, va_list l, uint64_t t)
+{
+	int lvl = bin_lvl(fmt);
+	if (lvl)
+		binbuf.only = lvl > bin_text_thres;
+	binbuf.length = 0;
+	bin_args(fmt, l);
+	log_bin_write(fmt, 0, t);
+	return binbuf.only;
+}
+
+/**
+ * log_bin_puts() - record an lputs() message
+ * @s:		the string
+ * @t:		nanoseconds since logstart
+ *
+ * Return:	true when the message is recorded only in binary
+ */
+static bool log_bin_puts(const char *s, uint64_t t)
+{
+	int lvl = bin_lvl(s);
+	if (lvl)
+		binbuf.only = lvl > bin_text_thres;
+	uint32_t len = strlen(s);
+	binbuf.length = 0;
+	binbuf_add_u32(len);
+	binbuf_add(s, len);
+	log_bin_write(s, LOG_BIN_SITE_PUTS, t);
+	return binbuf.only;
+}
+
+/**
+ * log_bin_kv() - record an lkv() message
+ * @msg:	the message
+ * @a:		the fields
+ * @count:	count of @a
+ * @t:		nanoseconds since logstart
+ *
+ * Return:	true when the message is recorded only in binary
+ */
+static bool log_bin_kv(const char *msg, const struct log_field *a, int count,
+		uint64_t t)
+{
+	int lvl = bin_lvl(msg);
+	if (lvl)
+		binbuf.only = lvl > bin_text_thres;
+	binbuf.length = 0;
+	binbuf_add_u32(count);
+	for (int i = 0; i < count; i++) {
+		size_t l = strlen(a[i].key);
+		uint8_t h[2] = { a[i].type, l > 255 ? 255 : l };
+		binbuf_add(h, sizeof(h));
+		binbuf_add(a[i].key, h[1]);
+		switch (a[i].type) {
+		case LOG_FIELD_INT:
+		case LOG_FIELD_DUR:
+			binbuf_add(&a[i].v.i, sizeof(int64_t));
+			break;
+		case LOG_FIELD_FLOAT:
+			binbuf_add(&a[i].v.f, sizeof(double));
+			break;
+		case LOG_FIELD_STR: {
+			const char *s = a[i].v.s ? a[i].v.s : "(null)";
+			uint32_t len = strlen(s);
+			binbuf_add_u32(len);
+			binbuf_add(s, len);
+			break;
+		}
+		}
+	}
+	log_bin_write(msg, LOG_BIN_KV, t);
+	return binbuf.only;
+}
+
+int log_bin_open(const char *path)
+{
+	FILE *f = fopen(path, "wb");
+	if (!f) {
+		lprintf(ERR "Failed to open binary log "lBLD_"%s"_lBLD".\n",
+				path);
+		return -1;
+	}
+	setvbuf(f, NULL, _IOFBF, 1 << 16);
+	struct log_bin_hdr hdr = {
+		.magic = LOG_BIN_MAGIC,
+		.version = LOG_BIN_VERSION,
+		.flags = 0,
+		.logstart = logstart,
+	};
+	fwrite(&hdr, sizeof(hdr), 1, f);
+
+	pthread_mutex_lock(&bin_mutex);
+	if (bin_f)
+		fclose(bin_f);
+	bin_f = f;
+	free(bin_sites); /* new file, new definitions */
+	bin_sites = NULL;
+	bin_sites_size = 0;
+	bin_sites_length = 0;
+	uint32_t def[3] = { LOG_BIN_SITE_DEF, sizeof(uint32_t) + 3,
+		LOG_BIN_SITE_PUTS };
+	fwrite(def, sizeof(def), 1, bin_f);
+	fwrite("%s\n", 1, 3, bin_f);
+	pthread_mutex_unlock(&bin_mutex);
+	__atomic_store_n(&bin_on, 1, __ATOMIC_RELEASE);
+	log_level_changed();
+	return 0;
+}
+
+void log_bin_close()
+{
+	__atomic_store_n(&bin_on, 0, __ATOMIC_RELEASE);
+	pthread_mutex_lock(&bin_mutex);
+	if (bin_f)
+		fclose(bin_f);
+	bin_f = NULL;
+	free(bin_sites);
+	bin_sites = NULL;
+	bin_sites_size = 0;
+	bin_sites_length = 0;
+	pthread_mutex_unlock(&bin_mutex);
+	log_level_changed();
+}
+
+void log_bin_text_threshold(const char *lvlmcro)
+{
+	bin_text_thres = log_lvlmcro(lvlmcro);
+}
+
+static size_t log_bin_memcnt()
+{
+	return bin_sites_size * sizeof(bin_sites[0]);
+}
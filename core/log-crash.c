@@ -0,0 +1,470 @@
+/**
+ * DOC: ce-log crash draining
+ * With log_crash_enable() the fatal signals are caught to write out what
+ * would be lost with the process: the batches of the text log files, the
+ * lines queued in the asynchronous rings, the pending partial line of the
+ * crashing thread, the blocks of the compressed files (stored uncompressed)
+ * and what's left in the stdio buffer of the binary log.
+ * The handler only uses write() and memory copies - it takes no locks,
+ * allocates nothing and doesn't go through stdio - and then passes the
+ * signal on to the handler it replaced, by default ending the process.
+ *
+ * The flight recorder keeps the last lines logged in a fixed array of
+ * records, dumped to the stderr (or stdout) log on a crash. Its threshold
+ * takes part in the call site filter like that of a log file, so it can
+ * hold the lines too verbose for the files. The lines are copied in by
+ * log_raw_stamp() without locks: a writer claims a record with an atomic
+ * add and publishes it by storing its sequence number last.
+ *
+ * Nothing is added to the logging path while the recorder is off. The
+ * partial lines of the other threads are out of reach of the handler.
+ */
+#include <signal.h>
+
+#define LOG_FLIGHT_TEXT 232
+
+/**
+ * struct log_flight_rec - a line in the flight recorder
+ * @seq:	the line's number + 1 once copied, %0 while being written
+ * @time:	nanoseconds since logstart
+ * @origin_len:	length of the origin at the beginning of @text
+ * @body_len:	length of the body following it, truncated to fit
+ * @lvl:	the level character
+ * @text:	the origin and the body
+ */
+struct log_flight_rec {
+	uint64_t seq;
+	uint64_t time;
+	uint16_t origin_len;
+	uint16_t body_len;
+	char lvl;
+	char text[LOG_FLIGHT_TEXT];
+};
+
+static struct log_flight_rec *lflight_a = NULL;
+static unsigned int lflight_size = 0;
+static unsigned long long lflight_next = 0;
+static int lflight_users = 0; /* log_flight_record() calls in progress */
+
+static const int lcrash_signals[] = {
+	SIGSEGV, SIGBUS, SIGILL, SIGFPE, SIGABRT, SIGTERM, SIGINT
+};
+#define LOG_CRASH_SIGNALS (sizeof(lcrash_signals) / sizeof(lcrash_signals[0]))
+static struct sigaction lcrash_old[LOG_CRASH_SIGNALS];
+static struct sigaction lcrash_sa;
+static bool lcrash_on = false;
+static int lcrash_busy = 0;
+static stack_t lcrash_stack = { .ss_sp = NULL };
+
+/**
+ * log_flight_record() - copy lines into the flight recorder
+ * @ln:		the lines
+ * @count:	count of @ln
+ *
+ * Counted in @lflight_users while using @lflight_a, log_crash_disable()
+ * frees it once there are none.
+ */
+static void log_flight_record(const struct log_line *ln, int count)
+{
+	__atomic_add_fetch(&lflight_users, 1, __ATOMIC_SEQ_CST);
+	struct log_flight_rec *a = __atomic_load_n(&lflight_a,
+			__ATOMIC_SEQ_CST);
+	int thres = __atomic_load_n(&lflight_thres, __ATOMIC_RELAXED);
+	for (int i = 0; a && i < count; i++) {
+		if (ln[i].lvl > thres)
+			continue;
+		unsigned long long seq = __atomic_fetch_add(&lflight_next, 1,
+				__ATOMIC_RELAXED);
+		struct log_flight_rec *rec = a + seq % lflight_size;
+		__atomic_store_n(&rec->seq, 0, __ATOMIC_RELAXED);
+		__atomic_thread_fence(__ATOMIC_RELEASE);
+		int olen = ln[i].origin_len > 80 ? 80 : ln[i].origin_len;
+		int blen = ln[i].body_len;
+		if (blen > LOG_FLIGHT_TEXT - olen)
+			blen = LOG_FLIGHT_TEXT - olen;
+		rec->time = ln[i].time;
+		rec->lvl = ln[i].lvl;
+		rec->origin_len = olen;
+		rec->body_len = blen;
+		memcpy(rec->text, ln[i].origin, olen);
+		memcpy(rec->text + olen, ln[i].body, blen);
+		__atomic_store_n(&rec->seq, seq + 1, __ATOMIC_RELEASE);
+	}
+	__atomic_sub_fetch(&lflight_users, 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * log_crash_write() - write all of a buffer, from a signal handler
+ * @fd:		file to write to
+ * @s:		the text
+ * @length:	length of @s
+ */
+static void log_crash_write(int fd, const char *s, size_t length)
+{
+	while (length) {
+		ssize_t w = write(fd, s, length);
+		if (w < 0 && errno == EINTR)
+			continue;
+		if (w <= 0)
+			return;
+		s += w;
+		length -= w;
+	}
+}
+
+/**
+ * log_crash_uint() - format a number with leading zeroes or spaces
+ * @dst:	output buffer
+ * @v:		the number
+ * @width:	minimum count of digits
+ * @pad:	'0' or ' '
+ *
+ * Return:	characters written
+ */
+static int log_crash_uint(char *dst, unsigned long long v, int width, char pad)
+{
+	char d[24];
+	int n = 0;
+	do {
+		d[n++] = '0' + v % 10;
+		v /= 10;
+	} while (v);
+	int c = 0;
+	for (; width > n; width--)
+		dst[c++] = pad;
+	while (n)
+		dst[c++] = d[--n];
+	return c;
+}
+
+/**
+ * log_crash_fmt() - format a line like logfile_callback(), without SGR
+ * @dst:	output buffer of at least 128 + @blen bytes
+ * @t:		time of the line
+ * @origin:	origin of the line
+ * @olen:	length of @origin
+ * @lvl:	the level character
+ * @body:	the body, a '\n' is added if it doesn't end with one
+ * @blen:	length of @body
+ *
+ * Return:	length written to @dst
+ */
+static int log_crash_fmt(char *dst, unsigned long long t, const char *origin,
+		int olen, int lvl, const char *body, int blen)
+{
+	static const char lvls[5][4] = { "ERR", "WRN", "INF", "TXT", "DBG" };
+	int c = 0;
+	dst[c++] = '[';
+	c += log_crash_uint(dst + c, t / 1000000000, 3, ' ');
+	dst[c++] = '.';
+	c += log_crash_uint(dst + c, t / 1000 % 1000000, 6, '0');
+	dst[c++] = ']';
+	dst[c++] = ' ';
+	if (olen > 80)
+		olen = 80;
+	for (int i = olen; i < 16; i++)
+		dst[c++] = ' ';
+	memcpy(dst + c, origin, olen);
+	c += olen;
+	dst[c++] = ' ';
+	memcpy(dst + c, lvls[lvl - '1'], 3);
+	c += 3;
+	dst[c++] = ':';
+	dst[c++] = ' ';
+	c += log_sgr_strip(dst + c, body, blen);
+	if (dst[c - 1] != '\n')
+		dst[c++] = '\n';
+	return c;
+}
+
+/**
+ * log_crash_json() - format a line like log_json_line(), without fields
+ * @dst:	output buffer of at least 128 + 6 * (@olen + @blen) bytes
+ * @t:		time of the line
+ * @origin:	origin of the line
+ * @olen:	length of @origin
+ * @lvl:	the level character
+ * @body:	the body
+ * @blen:	length of @body
+ *
+ * Return:	length written to @dst
+ */
+static int log_crash_json(char *dst, unsigned long long t, const char *origin,
+		int olen, int lvl, const char *body, int blen)
+{
+	static const char lvls[5][4] = { "ERR", "WRN", "INF", "TXT", "DBG" };
+	static const char hex[] = "0123456789abcdef";
+	const char *s[2] = { origin, body };
+	int length[2] = { olen, blen && body[blen - 1] == '\n' ? blen - 1
+		: blen };
+	int c = 0;
+	memcpy(dst + c, "{\"t_ns\":", 8);
+	c += 8;
+	c += log_crash_uint(dst + c, t, 1, '0');
+	for (int k = 0; k < 2; k++) {
+		const char *key = k ? "\",\"msg\":\"" : ",\"origin\":\"";
+		if (k) {
+			memcpy(dst + c, "\",\"lvl\":\"", 9);
+			c += 9;
+			memcpy(dst + c, lvls[lvl - '1'], 3);
+			c += 3;
+		}
+		memcpy(dst + c, key, strlen(key));
+		c += strlen(key);
+		for (int i = 0; i < length[k]; i++) {
+			unsigned char ch = s[k][i];
+			if (ch == '\x1b' && i + 1 < length[k]
+					&& s[k][i + 1] == '[') {
+				for (i += 2; i < length[k] && s[k][i] != 'm';
+						i++);
+			} else if (ch == '"' || ch == '\\') {
+				dst[c++] = '\\';
+				dst[c++] = ch;
+			} else if (ch < 0x20) {
+				memcpy(dst + c, "\\u00", 4);
+				c += 4;
+				dst[c++] = hex[ch >> 4];
+				dst[c++] = hex[ch & 15];
+			} else {
+				dst[c++] = ch;
+			}
+		}
+	}
+	memcpy(dst + c, "\"}\n", 3);
+	return c + 3;
+}
+
+/**
+ * log_crash_line() - write a line to all the log files and the recorder
+ * @t:		time of the line
+ * @s:		the line, "file+line:lvl:body", possibly without the '\n'
+ * @length:	length of @s
+ */
+static void log_crash_line(unsigned long long t, const char *s, int length)
+{
+	struct log_line ln;
+	if (length > 2048)
+		length = 2048;
+	if (!log_line_parse(&ln, s, length)) {
+		ln.origin = "unknown+33";
+		ln.origin_len = sizeof("unknown+33") - 1;
+		ln.lvl = '2';
+		ln.body = s;
+		ln.body_len = length;
+	}
+	ln.time = t;
+	if (lflight_a) /* the recorder hadn't seen the queued lines either */
+		log_flight_record(&ln, 1);
+	char txt[128 + 2048], json[128 + 6 * (80 + 2048)];
+	int tlen = 0, jlen = 0;
+	for (int y = 0; y < lfile_length; y++) {
+		struct logfile *lf = lfile_a + y;
+		if (!lf->f || ln.lvl > lf->lvl)
+			continue;
+		if (!(lf->flags & LOGFILE_JSON)) {
+			if (!tlen)
+				tlen = log_crash_fmt(txt, t, ln.origin,
+						ln.origin_len, ln.lvl, ln.body,
+						ln.body_len);
+			log_crash_write(lf->fd, txt, tlen);
+			continue;
+		}
+		if (!jlen)
+			jlen = log_crash_json(json, t, ln.origin,
+					ln.origin_len > 80 ? 80 : ln.origin_len,
+					ln.lvl, ln.body, ln.body_len);
+		log_crash_write(lf->fd, json, jlen);
+	}
+	if (!tlen)
+		tlen = log_crash_fmt(txt, t, ln.origin, ln.origin_len, ln.lvl,
+				ln.body, ln.body_len);
+	log_mmap_crash_write(txt, tlen, ln.lvl);
+	log_lz_crash_append(txt, tlen, ln.lvl, t);
+}
+
+/**
+ * log_crash_drain() - write out everything held back, from a signal handler
+ * @sig:	the signal caught
+ */
+static void log_crash_drain(int sig)
+{
+	/* the batches are older than anything queued */
+	for (int y = 0; y < lfile_length; y++) {
+		struct logfile *lf = lfile_a + y;
+		if (lf->f && lf->batch && lf->batch_length > 0)
+			log_crash_write(lf->fd, lf->batch, lf->batch_length);
+		lf->batch_length = 0;
+	}
+#ifdef __GLIBC__
+	if (bin_f && bin_f->_IO_write_ptr > bin_f->_IO_write_base) {
+		log_crash_write(fileno(bin_f), bin_f->_IO_write_base,
+				bin_f->_IO_write_ptr - bin_f->_IO_write_base);
+		bin_f->_IO_write_ptr = bin_f->_IO_write_base;
+	}
+#endif
+
+	/* the rings, merged by time as log_async_drain() does */
+	for (;;) {
+		struct log_ring *r, *min = NULL;
+		struct log_ring_rec *rec, *minrec = NULL;
+		r = __atomic_load_n(&async_rings, __ATOMIC_ACQUIRE);
+		for (; r != NULL; r = r->next) {
+			rec = log_ring_peek(r);
+			if (rec && (!minrec || rec->time < minrec->time)) {
+				min = r;
+				minrec = rec;
+			}
+		}
+		if (!min)
+			break;
+		const char *s = (const char *) (minrec + 1), *nl;
+		const char *end = s + minrec->length;
+		for (; s < end && (nl = memchr(s, '\n', end - s)); s = nl + 1)
+			log_crash_line(minrec->time, s, nl + 1 - s);
+		__atomic_store_n(&min->head, min->head
+				+ sizeof(struct log_ring_rec)
+				+ LOG_RING_ALIGN(minrec->length)
+				+ minrec->fields, __ATOMIC_RELEASE);
+	}
+
+	if (thbuf && thbuf->length > 1)
+		log_crash_line(thtime, thbuf->a, thbuf->length - 1);
+
+	static const char *names[] = {
+		"SIGSEGV", "SIGBUS", "SIGILL", "SIGFPE", "SIGABRT", "SIGTERM",
+		"SIGINT"
+	};
+	char msg[64] = "core/log-crash.c+0:1:Caught ";
+	int c = strlen(msg);
+	for (int i = 0; i < LOG_CRASH_SIGNALS; i++) {
+		if (lcrash_signals[i] != sig)
+			continue;
+		memcpy(msg + c, names[i], strlen(names[i]));
+		c += strlen(names[i]);
+	}
+	memcpy(msg + c, ", the log was drained.", 22);
+	log_crash_line(log_now(), msg, c + 22);
+	log_lz_crash_flush();
+}
+
+/**
+ * log_flight_dump() - write the flight recorder out, from a signal handler
+ * @fd:		file to write to
+ */
+static void log_flight_dump(int fd)
+{
+	static const char head[] = "--- flight recorder, the last lines ---\n";
+	static const char tail[] = "--- flight recorder end ---\n";
+	char txt[128 + LOG_FLIGHT_TEXT];
+	unsigned long long next = __atomic_load_n(&lflight_next,
+			__ATOMIC_ACQUIRE);
+	unsigned long long i = next > lflight_size ? next - lflight_size : 0;
+	log_crash_write(fd, head, sizeof(head) - 1);
+	for (; i < next; i++) {
+		struct log_flight_rec *rec = lflight_a + i % lflight_size;
+		if (__atomic_load_n(&rec->seq, __ATOMIC_ACQUIRE) != i + 1)
+			continue; /* being written over */
+		int l = log_crash_fmt(txt, rec->time, rec->text,
+				rec->origin_len, rec->lvl,
+				rec->text + rec->origin_len, rec->body_len);
+		log_crash_write(fd, txt, l);
+	}
+	log_crash_write(fd, tail, sizeof(tail) - 1);
+}
+
+static void log_crash_handler(int sig)
+{
+	if (__atomic_exchange_n(&lcrash_busy, 1, __ATOMIC_ACQ_REL)) {
+		for (;;) /* another thread is draining, it ends the process */
+			pause();
+	}
+	int errno_saved = errno;
+	log_crash_drain(sig);
+	if (lflight_a && sig != SIGTERM && sig != SIGINT
+			&& logstd_id >= 0 && logstd_id < lfile_length)
+		log_flight_dump(lfile_a[logstd_id].fd);
+	errno = errno_saved;
+
+	/* the handler replaced gets the signal, by default ending it all */
+	int i;
+	for (i = 0; lcrash_signals[i] != sig; i++);
+	sigaction(sig, lcrash_old + i, NULL);
+	sigset_t set;
+	sigemptyset(&set);
+	sigaddset(&set, sig);
+	sigprocmask(SIG_UNBLOCK, &set, NULL);
+	raise(sig);
+
+	/* it handled the signal and returned, the process goes on */
+	sigaction(sig, &lcrash_sa, NULL);
+	errno = errno_saved;
+	__atomic_store_n(&lcrash_busy, 0, __ATOMIC_RELEASE);
+}
+
+int log_crash_enable(int records, const char *lvlmcro)
+{
+	assert(records >= 0);
+	int lvl = records && lvlmcro ? log_lvlmcro(lvlmcro) : '0';
+	if (records && !lflight_a) {
+		lflight_a = calloc(records, sizeof(lflight_a[0]));
+		if (!lflight_a)
+			return -1;
+		lflight_size = records;
+	}
+	if (lflight_a) {
+		__atomic_store_n(&lflight_thres, lvl, __ATOMIC_RELAXED);
+		log_level_changed();
+	}
+	if (lcrash_on)
+		return 0;
+
+	/* for the stack overflows of the thread enabling it, likely main */
+	lcrash_stack.ss_size = 1 << 16;
+	lcrash_stack.ss_sp = malloc(lcrash_stack.ss_size);
+	lcrash_stack.ss_flags = 0;
+	bool onstack = lcrash_stack.ss_sp && !sigaltstack(&lcrash_stack, NULL);
+
+	lcrash_sa = (struct sigaction) {
+		.sa_handler = log_crash_handler,
+		.sa_flags = SA_RESETHAND | SA_NODEFER
+			| (onstack ? SA_ONSTACK : 0),
+	};
+	sigemptyset(&lcrash_sa.sa_mask);
+	for (int i = 0; i < LOG_CRASH_SIGNALS; i++)
+		sigaction(lcrash_signals[i], &lcrash_sa, lcrash_old + i);
+	lcrash_on = true;
+	return 0;
+}
+
+/**
+ * log_crash_disable() - restore the signal handlers and free the recorder
+ */
+static void log_crash_disable()
+{
+	if (lcrash_on) {
+		for (int i = 0; i < LOG_CRASH_SIGNALS; i++)
+			sigaction(lcrash_signals[i], lcrash_old + i, NULL);
+		lcrash_on = false;
+	}
+	if (lcrash_stack.ss_sp) {
+		stack_t off = { .ss_flags = SS_DISABLE };
+		sigaltstack(&off, NULL);
+		free(lcrash_stack.ss_sp);
+		lcrash_stack.ss_sp = NULL;
+	}
+	if (lflight_a) {
+		struct log_flight_rec *a = lflight_a;
+		__atomic_store_n(&lflight_thres, '0', __ATOMIC_RELAXED);
+		__atomic_store_n(&lflight_a, NULL, __ATOMIC_SEQ_CST);
+		log_level_changed();
+		while (__atomic_load_n(&lflight_users, __ATOMIC_SEQ_CST))
+			sched_yield();
+		free(a);
+	}
+}
+
+static size_t log_crash_memcnt()
+{
+	return (lflight_a ? lflight_size * sizeof(struct log_flight_rec) : 0)
+		+ (lcrash_stack.ss_sp ? lcrash_stack.ss_size : 0);
+}
@@ -0,0 +1,161 @@
+/**
+ * DOC: ce-log structured lines
+ * log_kv() renders the fields after the message for the text logs and hands
+ * the fields themselves along with the line in &struct log_line, so the
+ * %LOGFILE_JSON files get them as typed JSON members. In asynchronous mode
+ * the fields are copied into the ring record after the text, with their
+ * pointers already pointing into the ring.
+ */
+#include "ce-log-bin.h" /* log_field_print() */
+#include <math.h> /* isfinite */
+
+/**
+ * log_fields_size() - get the space log_fields_copy() needs
+ * @fl:		the fields
+ *
+ * Return:	size in bytes, a multiple of 8
+ */
+static size_t log_fields_size(const struct log_fields *fl)
+{
+	size_t size = sizeof(*fl) + fl->count * sizeof(fl->a[0]);
+	for (int i = 0; i < fl->count; i++) {
+		size += strlen(fl->a[i].key) + 1;
+		if (fl->a[i].type == LOG_FIELD_STR && fl->a[i].v.s)
+			size += strlen(fl->a[i].v.s) + 1;
+	}
+	return (size + 7) & ~(size_t) 7;
+}
+
+/**
+ * log_fields_copy() - copy fields into a single block
+ * @dst:	the block, 8 byte aligned and log_fields_size() long
+ * @fl:		the fields
+ *
+ * Return:	the copy, at @dst
+ */
+static struct log_fields *log_fields_copy(char *dst, const struct log_fields *fl)
+{
+	struct log_fields *c = (struct log_fields *) dst;
+	struct log_field *a = (struct log_field *) (c + 1);
+	char *s = (char *) (a + fl->count);
+	c->msg_len = fl->msg_len;
+	c->count = fl->count;
+	c->a = a;
+	for (int i = 0; i < fl->count; i++) {
+		size_t l = strlen(fl->a[i].key) + 1;
+		a[i] = fl->a[i];
+		a[i].key = memcpy(s, fl->a[i].key, l);
+		s += l;
+		if (a[i].type != LOG_FIELD_STR || !a[i].v.s)
+			continue;
+		l = strlen(fl->a[i].v.s) + 1;
+		a[i].v.s = memcpy(s, fl->a[i].v.s, l);
+		s += l;
+	}
+	return c;
+}
+
+/**
+ * log_fields_text() - render fields as in the text logs
+ * @b:		buffer to append to
+ * @a:		the fields
+ * @count:	count of @a
+ *
+ * Return:	characters appended
+ */
+static int log_fields_text(struct xf_strb *b, const struct log_field *a,
+		int count)
+{
+	char v[48];
+	int c = 0;
+	for (int i = 0; i < count; i++) {
+		if (a[i].type == LOG_FIELD_STR) {
+			c += xf_strb_appendf(b, " %s="lF_BLUE"%s"_lF, a[i].key,
+					a[i].v.s ? a[i].v.s : "(null)");
+			continue;
+		}
+		log_field_print(v, sizeof(v), a[i].type, a[i].v.i, a[i].v.f);
+		c += xf_strb_appendf(b, " %s="lF_BLUE"%s"_lF, a[i].key, v);
+	}
+	return c;
+}
+
+/**
+ * log_json_str() - append a JSON string
+ * @b:		buffer to append to
+ * @s:		the characters, SGR escape sequences are left out
+ * @length:	length of @s
+ */
+static void log_json_str(struct xf_strb *b, const char *s, int length)
+{
+	int i = 0, start = 0;
+	xf_strb_append(b, "\"");
+	for (; i < length; i++) {
+		unsigned char c = s[i];
+		if (c >= 0x20 && c != '"' && c != '\\')
+			continue;
+		xf_strb_appendf(b, "%.*s", i - start, s + start);
+		if (c == '\x1b' && i + 1 < length && s[i + 1] == '[') {
+			for (i += 2; i < length && s[i] != 'm'; i++);
+		} else if (c == '"' || c == '\\') {
+			xf_strb_appendf(b, "\\%c", c);
+		} else if (c == '\n') {
+			xf_strb_append(b, "\\n");
+		} else if (c == '\t') {
+			xf_strb_append(b, "\\t");
+		} else {
+			xf_strb_appendf(b, "\\u%04x", c);
+		}
+		start = i + 1;
+	}
+	if (start < length)
+		xf_strb_appendf(b, "%.*s", length - start, s + start);
+	xf_strb_append(b, "\"");
+}
+
+/**
+ * log_json_line() - append a line as a JSON object
+ * @b:		buffer to append to
+ * @ln:		the line
+ *
+ * {"t_ns":1234,"origin":"core/mod.c+33","lvl":"INF","msg":"...","kv":{...}}
+ */
+static void log_json_line(struct xf_strb *b, const struct log_line *ln)
+{
+	static const char *lvls[] = { "ERR", "WRN", "INF", "TXT", "DBG" };
+	const struct log_fields *fl = ln->fields;
+	xf_strb_appendf(b, "{\"t_ns\":%llu,\"origin\":", ln->time);
+	log_json_str(b, ln->origin, ln->origin_len);
+	xf_strb_appendf(b, ",\"lvl\":\"%s\",\"msg\":", lvls[ln->lvl - '1']);
+	log_json_str(b, ln->body, fl ? fl->msg_len : ln->body_len - 1);
+	if (fl) {
+		xf_strb_append(b, ",\"kv\":{");
+		for (int i = 0; i < fl->count; i++) {
+			const struct log_field *f = fl->a + i;
+			if (i)
+				xf_strb_append(b, ",");
+			log_json_str(b, f->key, strlen(f->key));
+			xf_strb_append(b, ":");
+			switch (f->type) {
+			case LOG_FIELD_INT:
+			case LOG_FIELD_DUR:
+				xf_strb_appendf(b, "%lld", f->v.i);
+				break;
+			case LOG_FIELD_FLOAT:
+				if (isfinite(f->v.f))
+					xf_strb_appendf(b, "%.17g", f->v.f);
+				else
+					xf_strb_append(b, "null");
+				break;
+			case LOG_FIELD_STR:
+				if (f->v.s)
+					log_json_str(b, f->v.s, strlen(f->v.s));
+				else
+					xf_strb_append(b, "null");
+				break;
+			}
+		}
+		xf_strb_append(b, "}");
+	}
+	xf_strb_append(b, "}\n");
+}
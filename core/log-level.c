@@ -0,0 +1,274 @@
+/**
+ * DOC: ce-log level filtering
+ * A message passes the call site filter (log_site_pass() in ce-aux.h) when
+ * its level is within both
+ *
+ *	the threshold of its origin - the longest matching override, or
+ *	@log_level when none matches;
+ *
+ *	the most verbose sink - the text, memory-mapped and compressed log
+ *	files and the flight recorder, or %DBG
+ *	while a binary log or other raw listeners are attached.
+ *
+ * The text log files then apply their own thresholds in logfile_callback().
+ *
+ * The call sites cache the result and recompute it when @log_gen changes,
+ * log_level_changed() bumps it whenever any of the inputs above change.
+ */
+
+int log_gen = 1;
+__thread int log_line_on = 1;
+
+static int log_level =
+#ifdef NDEBUG
+'2'; /* default WRN */
+#else
+'5'; /* debug DBG */
+#endif
+
+static int lfile_thres_max = '5'; /* most verbose text log file */
+static int lmap_thres_max = '0'; /* most verbose memory-mapped file */
+static int llz_thres_max = '0'; /* most verbose compressed file */
+static int lsock_thres_max = '0'; /* most verbose log socket */
+static int lflight_thres = '0'; /* the flight recorder */
+
+/**
+ * struct log_override - a per-origin threshold
+ * @origin:	a source file ("core/mod.c") or a directory ("glx/")
+ * @length:	length of @origin
+ * @lvl:	the threshold level character
+ */
+struct log_override {
+	char *origin;
+	int length;
+	int lvl;
+};
+
+static struct log_override *lovr_a = NULL;
+static int lovr_length = 0;
+static int lovr_size = 0;
+static pthread_mutex_t lovr_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * log_lvlmcro() - get the level character of a level macro
+ * @lvlmcro:	%DBG, %INF, ...
+ */
+static int log_lvlmcro(const char *lvlmcro)
+{
+	assert(lvlmcro != NULL);
+	size_t l = strlen(lvlmcro);
+	assert(l >= 2 && lvlmcro[l - 1] == ':');
+	assert(lvlmcro[l - 2] >= '1' && '5' >= lvlmcro[l - 2]);
+	return lvlmcro[l - 2];
+}
+
+/**
+ * log_lvl_parse() - parse a level name
+ * @s:		"err", "wrn", "inf", "txt" or "dbg"
+ * @length:	length of @s
+ *
+ * Return:	the level character or negative if invalid
+ */
+static int log_lvl_parse(const char *s, int length)
+{
+	static const char *lvls[] = { "err", "wrn", "inf", "txt", "dbg" };
+	for (int i = 0; i < sizeof(lvls) / sizeof(lvls[0]); i++) {
+		if (length == 3 && !strncmp(s, lvls[i], 3))
+			return '1' + i;
+	}
+	return -1;
+}
+
+/**
+ * log_level_changed() - make the call sites recompute their filter
+ */
+static void log_level_changed()
+{
+	__atomic_add_fetch(&log_gen, 1, __ATOMIC_RELEASE);
+}
+
+void log_site_init(struct log_site *site, const char *fmt)
+{
+	int gen = __atomic_load_n(&log_gen, __ATOMIC_ACQUIRE);
+	const char *c = strchr(fmt, ':');
+	int lvl = 0, on = 1;
+	if (c && c[1] >= '1' && c[1] <= '5' && c[2] == ':')
+		lvl = c[1];
+	if (lvl) {
+		const char *e;
+		for (e = c; e > fmt && *e != '+'; e--); /* origin ends at '+' */
+		int thres = __atomic_load_n(&log_level, __ATOMIC_RELAXED);
+		int best = -1;
+		pthread_mutex_lock(&lovr_mutex);
+		for (int i = 0; i < lovr_length; i++) {
+			struct log_override *o = lovr_a + i;
+			if (o->length <= best || o->length > e - fmt
+					|| strncmp(fmt, o->origin, o->length))
+				continue;
+			if (o->length != e - fmt && o->origin[o->length - 1] != '/')
+				continue;
+			best = o->length;
+			thres = o->lvl;
+		}
+		pthread_mutex_unlock(&lovr_mutex);
+
+		int sink = __atomic_load_n(&lfile_thres_max, __ATOMIC_RELAXED);
+		int lmap = __atomic_load_n(&lmap_thres_max, __ATOMIC_RELAXED);
+		if (lmap > sink)
+			sink = lmap;
+		int lz = __atomic_load_n(&llz_thres_max, __ATOMIC_RELAXED);
+		if (lz > sink)
+			sink = lz;
+		int sock = __atomic_load_n(&lsock_thres_max, __ATOMIC_RELAXED);
+		if (sock > sink)
+			sink = sock;
+		int flight = __atomic_load_n(&lflight_thres, __ATOMIC_RELAXED);
+		if (flight > sink)
+			sink = flight;
+		if (__atomic_load_n(&bin_on, __ATOMIC_RELAXED)
+				|| __atomic_load_n(&raw_callb_length,
+					__ATOMIC_RELAXED) > 1)
+			sink = '5';
+		on = lvl <= thres && lvl <= sink;
+	}
+	site->lvl = lvl;
+	site->on = on;
+	__atomic_store_n(&site->gen, gen, __ATOMIC_RELEASE);
+}
+
+void log_level_set(const char *lvlmcro)
+{
+	__atomic_store_n(&log_level, log_lvlmcro(lvlmcro), __ATOMIC_RELAXED);
+	log_level_changed();
+}
+
+int log_level_override(const char *origin, const char *lvlmcro)
+{
+	assert(origin != NULL);
+	int length = strlen(origin);
+	int i;
+	if (!length)
+		return -1;
+	pthread_mutex_lock(&lovr_mutex);
+	for (i = 0; i < lovr_length; i++) {
+		if (lovr_a[i].length == length
+				&& !strcmp(lovr_a[i].origin, origin))
+			break;
+	}
+	if (!lvlmcro) {
+		if (i == lovr_length) {
+			pthread_mutex_unlock(&lovr_mutex);
+			return -1;
+		}
+		free(lovr_a[i].origin);
+		lovr_a[i] = lovr_a[--lovr_length];
+	} else {
+		if (i == lovr_length) {
+			if (lovr_length >= lovr_size) {
+				lovr_size = lovr_size ? lovr_size * 2 : 4;
+				lovr_a = realloc(lovr_a,
+						lovr_size * sizeof(lovr_a[0]));
+				assert(lovr_a);
+			}
+			lovr_a[i].origin = memcpy(malloc(length + 1), origin,
+					length + 1);
+			lovr_a[i].length = length;
+			lovr_length++;
+		}
+		lovr_a[i].lvl = log_lvlmcro(lvlmcro);
+	}
+	pthread_mutex_unlock(&lovr_mutex);
+	log_level_changed();
+	return 0;
+}
+
+/**
+ * lfile_thres_update() - recompute @lfile_thres_max
+ *
+ * Called with @lfile_rwlock held.
+ */
+static void lfile_thres_update()
+{
+	int m = '0';
+	for (int i = 0; i < lfile_length; i++) {
+		if (lfile_a[i].f && lfile_a[i].lvl > m)
+			m = lfile_a[i].lvl;
+	}
+	__atomic_store_n(&lfile_thres_max, m, __ATOMIC_RELAXED);
+	log_level_changed();
+}
+
+/**
+ * log_rate_suppressed() - log how many messages a call site suppressed
+ * @fmt:	format of the site, its header is reused
+ * @count:	messages suppressed
+ */
+static void log_rate_suppressed(const char *fmt, unsigned int count)
+{
+	const char *c = strchr(fmt, ':');
+	int hdr = c && c[1] >= '1' && c[1] <= '5' && c[2] == ':'
+		? c + 3 - fmt : 0;
+	char s[hdr + 48];
+	snprintf(s, sizeof(s), "%.*s%u messages suppressed by rate limit.",
+			hdr, fmt, count);
+	struct log_site *site = log_site_cur; /* for the message let through */
+	(lputs)(s);
+	log_site_cur = site;
+}
+
+int log_rate_pass(struct log_rate *rate, unsigned int n, const char *fmt)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	unsigned long long sec = (unsigned long long) ts.tv_sec << 32;
+	unsigned long long st = __atomic_load_n(&rate->state, __ATOMIC_RELAXED);
+	unsigned long long nst;
+	do {
+		if ((st & ~0xffffffffull) != sec) {
+			nst = sec | 1;
+		} else if ((st & 0xffffffff) < n) {
+			nst = st + 1;
+		} else {
+			__atomic_add_fetch(&rate->suppressed, 1,
+					__ATOMIC_RELAXED);
+			log_line_on = 0;
+			return 0;
+		}
+	} while (!__atomic_compare_exchange_n(&rate->state, &st, nst, true,
+				__ATOMIC_RELAXED, __ATOMIC_RELAXED));
+	unsigned int k = __atomic_exchange_n(&rate->suppressed, 0,
+			__ATOMIC_RELAXED);
+	if (k)
+		log_rate_suppressed(fmt, k);
+	return 1;
+}
+
+int log_sample_pass(struct log_rate *rate, unsigned int n)
+{
+	if (n && __atomic_fetch_add(&rate->state, 1, __ATOMIC_RELAXED) % n)
+		return log_line_on = 0;
+	return 1;
+}
+
+static void log_level_free()
+{
+	pthread_mutex_lock(&lovr_mutex);
+	for (int i = 0; i < lovr_length; i++)
+		free(lovr_a[i].origin);
+	free(lovr_a);
+	lovr_a = NULL;
+	lovr_length = 0;
+	lovr_size = 0;
+	pthread_mutex_unlock(&lovr_mutex);
+}
+
+static size_t log_level_memcnt()
+{
+	size_t cnt = 0;
+	pthread_mutex_lock(&lovr_mutex);
+	cnt += lovr_size * sizeof(lovr_a[0]);
+	for (int i = 0; i < lovr_length; i++)
+		cnt += lovr_a[i].length + 1;
+	pthread_mutex_unlock(&lovr_mutex);
+	return cnt;
+}
@@ -0,0 +1,192 @@
+/**
+ * DOC: ce-log LZ codec
+ * A byte oriented LZ77 codec in the manner of LZ4 for the compressed log
+ * files: fast enough to keep up with the logging and decoded with a few
+ * branches per sequence. Every block is compressed on its own, so the
+ * blocks can be decoded starting from any of them.
+ *
+ * A compressed block is a series of sequences, each
+ *
+ *	token:		u8, the literal count in the high nibble and the match
+ *			length - 4 in the low one, 15 meaning that bytes
+ *			follow adding to it up to the first one below 255
+ *	literals:	the count extension, then the literals
+ *	offset:		u16 little endian, distance back to the match
+ *	match:		the length extension
+ *
+ * The last sequence ends after its literals.
+ *
+ * Kept free of the rest of core/log.c so that tools/logunz.c can include it
+ * as well.
+ */
+#include <stdint.h>
+#include <string.h>
+
+#define LOG_LZ_HASH_BITS 14
+/* the worst case compressed size of @n bytes */
+#define LOG_LZ_BOUND(n) ((n) + (n) / 255 + 16)
+
+static inline uint32_t log_lz_read32(const uint8_t *p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return v;
+}
+
+static inline uint32_t log_lz_hash(uint32_t v)
+{
+	return (v * 2654435761u) >> (32 - LOG_LZ_HASH_BITS);
+}
+
+/**
+ * log_lz_length() - write a length extension
+ * @op:		output position
+ * @n:		what's left of the length after the nibble
+ *
+ * Return:	the output position after the extension
+ */
+static uint8_t *log_lz_length(uint8_t *op, size_t n)
+{
+	for (; n >= 255; n -= 255)
+		*op++ = 255;
+	*op++ = n;
+	return op;
+}
+
+/**
+ * log_lz_sequence() - write a sequence
+ * @op:		output position
+ * @lit:	the literals
+ * @nlit:	count of @lit
+ * @off:	distance back to the match or %0 for the last sequence
+ * @mlen:	length of the match, at least 4 when @off is set
+ *
+ * Return:	the output position after the sequence
+ */
+static uint8_t *log_lz_sequence(uint8_t *op, const uint8_t *lit, size_t nlit,
+		size_t off, size_t mlen)
+{
+	uint8_t *token = op++;
+	mlen = off ? mlen - 4 : 0;
+	*token = (nlit >= 15 ? 15 : nlit) << 4 | (mlen >= 15 ? 15 : mlen);
+	if (nlit >= 15)
+		op = log_lz_length(op, nlit - 15);
+	memcpy(op, lit, nlit);
+	op += nlit;
+	if (!off)
+		return op;
+	*op++ = off & 0xff;
+	*op++ = off >> 8;
+	if (mlen >= 15)
+		op = log_lz_length(op, mlen - 15);
+	return op;
+}
+
+/**
+ * log_lz_compress() - compress a block
+ * @dst:	output buffer of at least LOG_LZ_BOUND(@length) bytes
+ * @src:	the data
+ * @length:	length of @src
+ * @table:	scratch of 1 << %LOG_LZ_HASH_BITS entries
+ *
+ * Return:	the compressed length
+ */
+__attribute__((unused)) /* the tools only decompress */
+static int log_lz_compress(void *dst, const void *src, int length,
+		uint32_t *table)
+{
+	const uint8_t *s = src, *ip = s, *anchor = s;
+	uint8_t *op = dst;
+	memset(table, 0, sizeof(table[0]) << LOG_LZ_HASH_BITS);
+	if (length < 16)
+		goto last;
+	/* the matches start 12 and end 5 bytes before the end at the latest */
+	const uint8_t *limit = s + length - 12, *mend = s + length - 5;
+	while (ip < limit) {
+		uint32_t v = log_lz_read32(ip);
+		uint32_t h = log_lz_hash(v);
+		const uint8_t *ref = s + table[h];
+		table[h] = ip - s;
+		if (ref >= ip || ip - ref > 0xffff
+				|| log_lz_read32(ref) != v) {
+			/* skip faster through what doesn't compress */
+			ip += 1 + ((ip - anchor) >> 6);
+			continue;
+		}
+		while (ip > anchor && ref > s && ip[-1] == ref[-1]) {
+			ip--;
+			ref--;
+		}
+		const uint8_t *m = ip + 4, *r = ref + 4;
+		while (m < mend && *m == *r) {
+			m++;
+			r++;
+		}
+		op = log_lz_sequence(op, anchor, ip - anchor, ip - ref,
+				m - ip);
+		ip = anchor = m;
+		table[log_lz_hash(log_lz_read32(ip - 2))] = ip - 2 - s;
+	}
+last:
+	op = log_lz_sequence(op, anchor, s + length - anchor, 0, 0);
+	return op - (uint8_t *) dst;
+}
+
+/**
+ * log_lz_decompress() - decompress a block
+ * @dst:	output buffer
+ * @size:	size of @dst
+ * @src:	the compressed block
+ * @length:	length of @src
+ *
+ * Return:	the decompressed length or negative if @src is corrupt or
+ *		doesn't fit @dst
+ */
+__attribute__((unused)) /* core/log.c only compresses */
+static int log_lz_decompress(void *dst, int size, const void *src, int length)
+{
+	const uint8_t *ip = src, *end = ip + length;
+	uint8_t *op = dst, *oend = op + size;
+	while (ip < end) {
+		unsigned int token = *ip++;
+		size_t nlit = token >> 4, mlen = token & 15;
+		unsigned int b = 255;
+		if (nlit == 15) {
+			for (; b == 255 && ip < end; nlit += b)
+				b = *ip++;
+			if (b == 255)
+				return -1;
+		}
+		if (nlit > end - ip || nlit > oend - op)
+			return -1;
+		memcpy(op, ip, nlit);
+		op += nlit;
+		ip += nlit;
+		if (ip == end)
+			break;
+		if (end - ip < 2)
+			return -1;
+		size_t off = ip[0] | ip[1] << 8;
+		ip += 2;
+		if (!off || off > op - (uint8_t *) dst)
+			return -1;
+		if (mlen == 15) {
+			for (b = 255; b == 255 && ip < end; mlen += b)
+				b = *ip++;
+			if (b == 255)
+				return -1;
+		}
+		mlen += 4;
+		if (mlen > oend - op)
+			return -1;
+		const uint8_t *r = op - off;
+		if (off >= mlen) {
+			memcpy(op, r, mlen);
+		} else {
+			for (size_t i = 0; i < mlen; i++)
+				op[i] = r[i];
+		}
+		op += mlen;
+	}
+	return op - (uint8_t *) dst;
+}
@@ -0,0 +1,747 @@
+/**
+ * DOC: ce-log compressed files
+ * A compressed log file gets the lines of the text logs without the escape
+ * sequences, in blocks compressed each on its own, see ce-log-lz.h for the
+ * format. The logging threads only copy their lines into the block being
+ * filled, under the mutex of the file; each file has a thread of its own
+ * compressing and writing out the full blocks, so neither compression nor
+ * disk I/O happen on the logging threads.
+ *
+ * The blocks go around in a queue of %LOG_LZ_QUEUE: the compressor owns the
+ * sealed blocks from @written up to @sealed, the one at @sealed is being
+ * filled. A logging thread only waits when the compressor has fallen a whole
+ * queue behind. A block is sealed when full, when its first line has waited
+ * %LOG_LZ_AGE_NS for more, on log_flush() and when the file is removed.
+ *
+ * The sidecar index of %LOGFILE_INDEX is kept by the compressor as well,
+ * it parses the levels and origins back out of the lines of each block.
+ */
+#include "ce-log-lz.h"
+#include "log-lz.c"
+
+#define LOG_LZ_MAX 4
+#define LOG_LZ_QUEUE 4
+#define LOG_LZ_BLOCK (1 << 18)
+#define LOG_LZ_AGE_NS (1000 * 1000 * 1000ull)
+
+/**
+ * struct log_lzbuf - a block of lines before compression
+ * @a:		the lines, %LOG_LZ_BLOCK bytes
+ * @length:	length of @a used
+ * @lines:	count of the lines ending in @a
+ * @time:	time of the earliest line
+ * @time_last:	time of the latest line
+ *
+ * The lines of the sinks locked one by one may come slightly out of order,
+ * hence the earliest and latest rather than the first and last.
+ */
+struct log_lzbuf {
+	char *a;
+	int length;
+	int lines;
+	unsigned long long time;
+	unsigned long long time_last;
+};
+
+/**
+ * struct log_lzidx - the sidecar index of a compressed file
+ * @fd:		the index file
+ * @names:	the source file of each origin id
+ * @length:	count of @names
+ * @size:	allocated size of @names, @seen and @ids
+ * @hash:	the ids + 1 by the hash of their names, open addressing
+ * @hash_size:	size of @hash, a power of two
+ * @seen:	the number + 1 of the block each origin was last seen in
+ * @ids:	the origins of the block being indexed
+ * @rec:	the records to write
+ * @rec_length:	length of @rec
+ * @rec_size:	allocated size of @rec
+ *
+ * Used by the compressor thread only.
+ */
+struct log_lzidx {
+	int fd;
+	char **names;
+	unsigned int length;
+	unsigned int size;
+	uint32_t *hash;
+	unsigned int hash_size;
+	unsigned int *seen;
+	uint32_t *ids;
+	char *rec;
+	size_t rec_length;
+	size_t rec_size;
+};
+
+/**
+ * struct log_lzfile - a compressed log file
+ * @path:	path of the file
+ * @fd:		the file
+ * @lvl:	the threshold level character
+ * @q:		the queue of blocks
+ * @sealed:	count of blocks sealed, @q[@sealed % %LOG_LZ_QUEUE] is filled
+ * @written:	count of blocks written
+ * @stop:	the compressor is to write out what's left and exit
+ * @mutex:	guards the above
+ * @wake:	signalled when a block is sealed or @stop set
+ * @done:	signalled when a block is written
+ * @thread:	the compressor
+ * @table:	hash table of the compressor
+ * @out:	the header and compressed data of the block being written
+ * @raw_bytes:	bytes of lines written
+ * @bytes:	bytes written to the file
+ * @failed:	count of blocks the writes of which failed
+ * @offset:	offset of the next block in the file
+ * @idx:	the sidecar index or %NULL
+ */
+struct log_lzfile {
+	char *path;
+	int fd;
+	int lvl;
+	struct log_lzbuf q[LOG_LZ_QUEUE];
+	unsigned int sealed;
+	unsigned int written;
+	bool stop;
+	pthread_mutex_t mutex;
+	pthread_cond_t wake;
+	pthread_cond_t done;
+	pthread_t thread;
+	uint32_t *table;
+	char *out;
+	unsigned long long raw_bytes;
+	unsigned long long bytes;
+	unsigned int failed;
+	unsigned long long offset;
+	struct log_lzidx *idx;
+};
+
+static struct log_lzfile *llz_a[LOG_LZ_MAX];
+/* writers in each slot of llz_a, as lmap_users */
+static int llz_users[LOG_LZ_MAX];
+static int llz_count = 0;
+static pthread_mutex_t llz_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * log_lzfile_seal() - pass the block being filled on to the compressor
+ * @lz:		the file, @lz->mutex held
+ */
+static void log_lzfile_seal(struct log_lzfile *lz)
+{
+	if (!lz->q[lz->sealed % LOG_LZ_QUEUE].length)
+		return;
+	lz->sealed++;
+	pthread_cond_signal(&lz->wake);
+}
+
+/**
+ * log_lzfile_append() - copy lines into the block being filled
+ * @lz:		the file, @lz->mutex held
+ * @s:		the lines
+ * @length:	length of @s
+ * @t:		time of the earliest line
+ * @t_last:	time of the latest line
+ */
+static void log_lzfile_append(struct log_lzfile *lz, const char *s,
+		int length, unsigned long long t, unsigned long long t_last)
+{
+	while (length > 0) {
+		while (lz->sealed - lz->written >= LOG_LZ_QUEUE)
+			pthread_cond_wait(&lz->done, &lz->mutex);
+		struct log_lzbuf *b = lz->q + lz->sealed % LOG_LZ_QUEUE;
+		if (b->length && b->length + length > LOG_LZ_BLOCK) {
+			log_lzfile_seal(lz); /* keep the lines whole */
+			continue;
+		}
+		int n = length < LOG_LZ_BLOCK - b->length ? length
+			: LOG_LZ_BLOCK - b->length;
+		if (!b->length || t < b->time)
+			b->time = t;
+		if (!b->length || t_last > b->time_last)
+			b->time_last = t_last;
+		memcpy(b->a + b->length, s, n);
+		b->length += n;
+		b->lines += s[n - 1] == '\n';
+		s += n;
+		length -= n;
+		if (b->length == LOG_LZ_BLOCK)
+			log_lzfile_seal(lz);
+	}
+}
+
+/**
+ * log_lzfile_write() - write all of a buffer
+ * @fd:		file to write to
+ * @s:		the data
+ * @length:	length of @s
+ *
+ * Return:	bytes written, less than @length on failure
+ */
+static size_t log_lzfile_write(int fd, const char *s, size_t length)
+{
+	size_t left = length;
+	while (left) {
+		ssize_t w = write(fd, s, left);
+		if (w < 0 && errno == EINTR)
+			continue;
+		if (w < 0)
+			break;
+		s += w;
+		left -= w;
+	}
+	return length - left;
+}
+
+/**
+ * log_lzidx_rec() - add to the index records to write
+ * @idx:	the index
+ * @data:	the data
+ * @length:	length of @data
+ */
+static void log_lzidx_rec(struct log_lzidx *idx, const void *data,
+		size_t length)
+{
+	if (idx->rec_length + length > idx->rec_size) {
+		do {
+			idx->rec_size = idx->rec_size ? idx->rec_size * 2 : 1024;
+		} while (idx->rec_length + length > idx->rec_size);
+		idx->rec = realloc(idx->rec, idx->rec_size);
+		assert(idx->rec);
+	}
+	memcpy(idx->rec + idx->rec_length, data, length);
+	idx->rec_length += length;
+}
+
+/**
+ * log_lzidx_origin() - get the id of an origin, defining it if new
+ * @idx:	the index
+ * @name:	source file of the origin
+ * @length:	length of @name
+ *
+ * Return:	the id
+ */
+static uint32_t log_lzidx_origin(struct log_lzidx *idx, const char *name,
+		int length)
+{
+	uint32_t h = 2166136261u;
+	for (int i = 0; i < length; i++)
+		h = (h ^ (unsigned char) name[i]) * 16777619u;
+	unsigned int k = h & (idx->hash_size - 1);
+	for (; idx->hash[k]; k = (k + 1) & (idx->hash_size - 1)) {
+		const char *n = idx->names[idx->hash[k] - 1];
+		if (!strncmp(n, name, length) && !n[length])
+			return idx->hash[k] - 1;
+	}
+
+	uint32_t id = idx->length++;
+	if (idx->length > idx->size) {
+		idx->size *= 2;
+		idx->names = realloc(idx->names, idx->size
+				* sizeof(idx->names[0]));
+		idx->seen = realloc(idx->seen, idx->size
+				* sizeof(idx->seen[0]));
+		idx->ids = realloc(idx->ids, idx->size * sizeof(idx->ids[0]));
+		assert(idx->names && idx->seen && idx->ids);
+	}
+	idx->names[id] = malloc(length + 1);
+	assert(idx->names[id]);
+	memcpy(idx->names[id], name, length);
+	idx->names[id][length] = '\0';
+	idx->seen[id] = 0;
+	idx->hash[k] = id + 1;
+	if (idx->length * 2 > idx->hash_size) { /* rehash */
+		free(idx->hash);
+		idx->hash_size *= 2;
+		idx->hash = calloc(idx->hash_size, sizeof(idx->hash[0]));
+		assert(idx->hash);
+		for (uint32_t i = 0; i < idx->length; i++) {
+			const char *n = idx->names[i];
+			uint32_t g = 2166136261u;
+			for (; *n; n++)
+				g = (g ^ (unsigned char) *n) * 16777619u;
+			for (k = g & (idx->hash_size - 1); idx->hash[k];
+					k = (k + 1) & (idx->hash_size - 1));
+			idx->hash[k] = i + 1;
+		}
+	}
+
+	uint32_t def[3] = { LOG_LZ_IDX_ORIGIN, sizeof(id) + length, id };
+	log_lzidx_rec(idx, def, sizeof(def));
+	log_lzidx_rec(idx, name, length);
+	return id;
+}
+
+/**
+ * log_lzidx_block() - index a block
+ * @idx:	the index
+ * @b:		the block
+ * @offset:	offset of the block in the compressed log
+ * @n:		the number of the block
+ */
+static void log_lzidx_block(struct log_lzidx *idx, const struct log_lzbuf *b,
+		unsigned long long offset, unsigned int n)
+{
+	struct log_lz_idx_block e = {
+		.offset = offset,
+		.time = b->time,
+		.time_last = b->time_last,
+	};
+	unsigned int count = 0;
+	const char *s = b->a, *end = b->a + b->length, *nl;
+	for (; s < end; s = nl + 1) {
+		nl = memchr(s, '\n', end - s);
+		if (!nl)
+			nl = end;
+		const char *origin;
+		int length;
+		int lvl = log_lz_line_parse(s, nl, &origin, &length);
+		if (!lvl)
+			continue; /* the rest of a line longer than a block */
+		e.lines++;
+		e.lvl_mask |= 1 << (lvl - '1');
+		e.lvl_lines[lvl - '1']++;
+		uint32_t id = log_lzidx_origin(idx, origin, length);
+		if (idx->seen[id] == n + 1)
+			continue;
+		idx->seen[id] = n + 1;
+		idx->ids[count++] = id;
+	}
+	e.origins = count;
+	uint32_t rec[2] = { LOG_LZ_IDX_BLOCK,
+		sizeof(e) + count * sizeof(idx->ids[0]) };
+	log_lzidx_rec(idx, rec, sizeof(rec));
+	log_lzidx_rec(idx, &e, sizeof(e));
+	log_lzidx_rec(idx, idx->ids, count * sizeof(idx->ids[0]));
+	log_lzfile_write(idx->fd, idx->rec, idx->rec_length);
+	idx->rec_length = 0;
+}
+
+/**
+ * log_lzidx_open() - create the sidecar index of a file
+ * @path:	path of the compressed file, ".idx" is appended
+ *
+ * Return:	the index or %NULL on failure
+ */
+static struct log_lzidx *log_lzidx_open(const char *path)
+{
+	char p[strlen(path) + 5];
+	snprintf(p, sizeof(p), "%s.idx", path);
+	int fd = open(p, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return NULL;
+	struct log_lz_idx_hdr hdr = {
+		.magic = LOG_LZ_IDX_MAGIC,
+		.version = LOG_LZ_IDX_VERSION,
+	};
+	if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr)) {
+		close(fd);
+		return NULL;
+	}
+	struct log_lzidx *idx = calloc(1, sizeof(*idx));
+	assert(idx);
+	idx->fd = fd;
+	idx->size = 64;
+	idx->names = malloc(idx->size * sizeof(idx->names[0]));
+	idx->seen = malloc(idx->size * sizeof(idx->seen[0]));
+	idx->ids = malloc(idx->size * sizeof(idx->ids[0]));
+	idx->hash_size = 2 * idx->size;
+	idx->hash = calloc(idx->hash_size, sizeof(idx->hash[0]));
+	assert(idx->names && idx->seen && idx->ids && idx->hash);
+	return idx;
+}
+
+static void log_lzidx_close(struct log_lzidx *idx)
+{
+	close(idx->fd);
+	for (unsigned int i = 0; i < idx->length; i++)
+		free(idx->names[i]);
+	free(idx->names);
+	free(idx->seen);
+	free(idx->ids);
+	free(idx->hash);
+	free(idx->rec);
+	free(idx);
+}
+
+static size_t log_lzidx_memcnt(const struct log_lzidx *idx)
+{
+	size_t cnt = sizeof(*idx) + idx->rec_size
+		+ idx->hash_size * sizeof(idx->hash[0])
+		+ idx->size * (sizeof(idx->names[0]) + sizeof(idx->seen[0])
+				+ sizeof(idx->ids[0]));
+	for (unsigned int i = 0; i < idx->length; i++)
+		cnt += strlen(idx->names[i]) + 1;
+	return cnt;
+}
+
+/**
+ * log_lzfile_put() - compress a block and write it out
+ * @lz:		the file
+ * @b:		the block, owned by the compressor
+ *
+ * The block is indexed once written whole.
+ */
+static void log_lzfile_put(struct log_lzfile *lz, struct log_lzbuf *b)
+{
+	struct log_lz_block *hdr = (struct log_lz_block *) lz->out;
+	char *data = lz->out + sizeof(*hdr);
+	int length = log_lz_compress(data, b->a, b->length, lz->table);
+	hdr->flags = 0;
+	if (length >= b->length) {
+		memcpy(data, b->a, b->length);
+		length = b->length;
+		hdr->flags = LOG_LZ_STORED;
+	}
+	hdr->magic = LOG_LZ_BLOCK_MAGIC;
+	hdr->raw_length = b->length;
+	hdr->length = length;
+	hdr->time = b->time;
+	hdr->time_last = b->time_last;
+	hdr->lines = b->lines;
+	hdr->check = log_lz_block_check(hdr);
+
+	size_t w = log_lzfile_write(lz->fd, lz->out, sizeof(*hdr) + length);
+	if (w < sizeof(*hdr) + length)
+		lz->failed++;
+	else if (lz->idx)
+		log_lzidx_block(lz->idx, b, lz->offset, lz->written);
+	lz->raw_bytes += b->length;
+	lz->bytes += w;
+	lz->offset += w;
+}
+
+static void *log_lzfile_thread(void *arg)
+{
+	struct log_lzfile *lz = arg;
+	pthread_mutex_lock(&lz->mutex);
+	for (;;) {
+		if (lz->written != lz->sealed) {
+			struct log_lzbuf *b = lz->q
+				+ lz->written % LOG_LZ_QUEUE;
+			pthread_mutex_unlock(&lz->mutex);
+			log_lzfile_put(lz, b);
+			pthread_mutex_lock(&lz->mutex);
+			b->length = 0;
+			b->lines = 0;
+			lz->written++;
+			pthread_cond_broadcast(&lz->done);
+			continue;
+		}
+		struct log_lzbuf *b = lz->q + lz->sealed % LOG_LZ_QUEUE;
+		if (b->length && (lz->stop
+				|| log_now() - b->time >= LOG_LZ_AGE_NS)) {
+			log_lzfile_seal(lz);
+			continue;
+		}
+		if (lz->stop)
+			break;
+		if (!b->length) {
+			pthread_cond_wait(&lz->wake, &lz->mutex);
+			continue;
+		}
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += 100 * 1000 * 1000; /* 100ms, to check the age */
+		if (ts.tv_nsec >= 1000 * 1000 * 1000) {
+			ts.tv_sec += 1;
+			ts.tv_nsec -= 1000 * 1000 * 1000;
+		}
+		pthread_cond_timedwait(&lz->wake, &lz->mutex, &ts);
+	}
+	pthread_mutex_unlock(&lz->mutex);
+	return NULL;
+}
+
+/**
+ * log_lz_write() - write formatted lines to the compressed files
+ * @buf:	the formatted lines, without SGR escape sequences
+ * @length:	length of @buf
+ * @ln:		the lines formatted, for their levels
+ * @count:	count of @ln
+ * @maxlvl:	the least important level in @ln
+ */
+static void log_lz_write(const char *buf, int length,
+		const struct log_line *ln, int count, int maxlvl)
+{
+	for (int y = 0; y < LOG_LZ_MAX; y++) {
+		if (!__atomic_load_n(&llz_a[y], __ATOMIC_RELAXED))
+			continue;
+		__atomic_add_fetch(&llz_users[y], 1, __ATOMIC_SEQ_CST);
+		struct log_lzfile *lz = __atomic_load_n(&llz_a[y],
+				__ATOMIC_SEQ_CST);
+		if (!lz) {
+			__atomic_sub_fetch(&llz_users[y], 1, __ATOMIC_RELEASE);
+			continue;
+		}
+		pthread_mutex_lock(&lz->mutex);
+		if (maxlvl <= lz->lvl) {
+			log_lzfile_append(lz, buf, length, ln[0].time,
+					ln[count - 1].time);
+		} else {
+			const char *l = buf, *nl;
+			for (int i = 0; i < count; i++, l = nl + 1) {
+				nl = memchr(l, '\n', buf + length - l);
+				if (ln[i].lvl <= lz->lvl)
+					log_lzfile_append(lz, l, nl + 1 - l,
+							ln[i].time, ln[i].time);
+			}
+		}
+		pthread_mutex_unlock(&lz->mutex);
+		__atomic_sub_fetch(&llz_users[y], 1, __ATOMIC_RELEASE);
+	}
+}
+
+/**
+ * log_lz_flush() - write out the lines in the compressed files' blocks
+ */
+static void log_lz_flush()
+{
+	pthread_mutex_lock(&llz_mutex);
+	for (int y = 0; y < LOG_LZ_MAX; y++) {
+		struct log_lzfile *lz = llz_a[y];
+		if (!lz)
+			continue;
+		pthread_mutex_lock(&lz->mutex);
+		log_lzfile_seal(lz);
+		while (lz->written != lz->sealed)
+			pthread_cond_wait(&lz->done, &lz->mutex);
+		pthread_mutex_unlock(&lz->mutex);
+	}
+	pthread_mutex_unlock(&llz_mutex);
+}
+
+/**
+ * log_lz_crash_append() - copy a line to the files, from a signal handler
+ * @s:		the line, without SGR escape sequences
+ * @length:	length of @s
+ * @lvl:	level of the line
+ * @t:		time of the line
+ *
+ * A line that doesn't fit the block being filled is dropped.
+ */
+static void log_lz_crash_append(const char *s, int length, int lvl,
+		unsigned long long t)
+{
+	for (int y = 0; y < LOG_LZ_MAX; y++) {
+		struct log_lzfile *lz = __atomic_load_n(&llz_a[y],
+				__ATOMIC_ACQUIRE);
+		if (!lz || lvl > lz->lvl)
+			continue;
+		struct log_lzbuf *b = lz->q + lz->sealed % LOG_LZ_QUEUE;
+		if (b->length + length > LOG_LZ_BLOCK)
+			continue;
+		if (!b->length || t < b->time)
+			b->time = t;
+		if (!b->length || t > b->time_last)
+			b->time_last = t;
+		memcpy(b->a + b->length, s, length);
+		b->length += length;
+		b->lines++;
+	}
+}
+
+/**
+ * log_lz_crash_flush() - write out the blocks, from a signal handler
+ *
+ * The blocks not yet written are stored uncompressed. The one the compressor
+ * may be in the middle of writing is written once more.
+ */
+static void log_lz_crash_flush()
+{
+	for (int y = 0; y < LOG_LZ_MAX; y++) {
+		struct log_lzfile *lz = __atomic_load_n(&llz_a[y],
+				__ATOMIC_ACQUIRE);
+		if (!lz)
+			continue;
+		for (unsigned int i = lz->written; i - lz->written
+				<= lz->sealed - lz->written; i++) {
+			struct log_lzbuf *b = lz->q + i % LOG_LZ_QUEUE;
+			if (!b->length)
+				continue;
+			struct log_lz_block hdr = {
+				.magic = LOG_LZ_BLOCK_MAGIC,
+				.flags = LOG_LZ_STORED,
+				.raw_length = b->length,
+				.length = b->length,
+				.time = b->time,
+				.time_last = b->time_last,
+				.lines = b->lines,
+			};
+			hdr.check = log_lz_block_check(&hdr);
+			log_crash_write(lz->fd, (const char *) &hdr,
+					sizeof(hdr));
+			log_crash_write(lz->fd, b->a, b->length);
+		}
+	}
+}
+
+/**
+ * llz_thres_update() - recompute @llz_thres_max
+ *
+ * Called with @llz_mutex held.
+ */
+static void llz_thres_update()
+{
+	int mx = '0';
+	for (int i = 0; i < LOG_LZ_MAX; i++) {
+		if (llz_a[i] && llz_a[i]->lvl > mx)
+			mx = llz_a[i]->lvl;
+	}
+	__atomic_store_n(&llz_thres_max, mx, __ATOMIC_RELAXED);
+	log_level_changed();
+}
+
+/**
+ * log_lzfile_free() - free a file whose compressor isn't running
+ * @lz:		the file
+ */
+static void log_lzfile_free(struct log_lzfile *lz)
+{
+	close(lz->fd);
+	for (int i = 0; i < LOG_LZ_QUEUE; i++)
+		free(lz->q[i].a);
+	pthread_mutex_destroy(&lz->mutex);
+	pthread_cond_destroy(&lz->wake);
+	pthread_cond_destroy(&lz->done);
+	free(lz->table);
+	free(lz->out);
+	free(lz->path);
+	if (lz->idx)
+		log_lzidx_close(lz->idx);
+	free(lz);
+}
+
+int log_lz_file_add(const char *path, int flags)
+{
+	assert(path);
+	assert(!(flags & ~LOGFILE_INDEX));
+	int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return -1;
+	struct log_lz_hdr hdr = {
+		.magic = LOG_LZ_MAGIC,
+		.version = LOG_LZ_VERSION,
+		.block_size = LOG_LZ_BLOCK,
+		.logstart = logstart,
+	};
+	if (write(fd, &hdr, sizeof(hdr)) != sizeof(hdr)) {
+		close(fd);
+		return -1;
+	}
+	struct log_lzfile *lz = calloc(1, sizeof(*lz));
+	assert(lz);
+	size_t l = strlen(path) + 1;
+	lz->path = memcpy(malloc(l), path, l);
+	lz->fd = fd;
+	lz->lvl = '5';
+	lz->offset = sizeof(hdr);
+	if ((flags & LOGFILE_INDEX) && !(lz->idx = log_lzidx_open(path))) {
+		log_lzfile_free(lz);
+		return -1;
+	}
+	for (int i = 0; i < LOG_LZ_QUEUE; i++) {
+		lz->q[i].a = malloc(LOG_LZ_BLOCK);
+		assert(lz->q[i].a);
+	}
+	lz->table = malloc(sizeof(lz->table[0]) << LOG_LZ_HASH_BITS);
+	lz->out = malloc(sizeof(struct log_lz_block)
+			+ LOG_LZ_BOUND(LOG_LZ_BLOCK));
+	assert(lz->table && lz->out);
+	pthread_mutex_init(&lz->mutex, NULL);
+	pthread_cond_init(&lz->wake, NULL);
+	pthread_cond_init(&lz->done, NULL);
+	if (pthread_create(&lz->thread, NULL, log_lzfile_thread, lz)) {
+		log_lzfile_free(lz);
+		return -1;
+	}
+
+	pthread_mutex_lock(&llz_mutex);
+	int i;
+	for (i = 0; i < LOG_LZ_MAX && llz_a[i]; i++);
+	if (i == LOG_LZ_MAX) {
+		pthread_mutex_unlock(&llz_mutex);
+		pthread_mutex_lock(&lz->mutex);
+		lz->stop = true;
+		pthread_cond_signal(&lz->wake);
+		pthread_mutex_unlock(&lz->mutex);
+		pthread_join(lz->thread, NULL);
+		log_lzfile_free(lz);
+		return -1;
+	}
+	__atomic_add_fetch(&llz_count, 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&llz_a[i], lz, __ATOMIC_RELEASE);
+	llz_thres_update();
+	pthread_mutex_unlock(&llz_mutex);
+	return i;
+}
+
+int log_lz_file_rm(int hndl)
+{
+	pthread_mutex_lock(&llz_mutex);
+	if (hndl < 0 || hndl >= LOG_LZ_MAX || !llz_a[hndl]) {
+		pthread_mutex_unlock(&llz_mutex);
+		return -1;
+	}
+	struct log_lzfile *lz = llz_a[hndl];
+	__atomic_store_n(&llz_a[hndl], NULL, __ATOMIC_SEQ_CST);
+	while (__atomic_load_n(&llz_users[hndl], __ATOMIC_SEQ_CST))
+		sched_yield();
+	__atomic_sub_fetch(&llz_count, 1, __ATOMIC_RELAXED);
+	llz_thres_update();
+	pthread_mutex_unlock(&llz_mutex);
+
+	pthread_mutex_lock(&lz->mutex);
+	lz->stop = true;
+	pthread_cond_signal(&lz->wake);
+	pthread_mutex_unlock(&lz->mutex);
+	pthread_join(lz->thread, NULL);
+	if (lz->failed)
+		lprintf(WRN "Compressed log "lBLD_"%s"_lBLD" failed to write "
+				lF_YELW"%u"_lF" blocks.\n", lz->path,
+				lz->failed);
+	lprintf(INF "Compressed log "lF_BLUE"%s"_lF" closed, "lF_BLUE"%llu"_lF
+			" bytes into "lF_BLUE"%llu"_lF".\n", lz->path,
+			lz->raw_bytes, lz->bytes);
+	log_lzfile_free(lz);
+	return hndl;
+}
+
+int log_lz_file_threshold(int hndl, const char *lvlmcro)
+{
+	int lvl = log_lvlmcro(lvlmcro);
+	pthread_mutex_lock(&llz_mutex);
+	if (hndl < 0 || hndl >= LOG_LZ_MAX || !llz_a[hndl]) {
+		pthread_mutex_unlock(&llz_mutex);
+		return -1;
+	}
+	llz_a[hndl]->lvl = lvl;
+	llz_thres_update();
+	pthread_mutex_unlock(&llz_mutex);
+	return hndl;
+}
+
+static void log_lz_rmall()
+{
+	for (int i = 0; i < LOG_LZ_MAX; i++)
+		log_lz_file_rm(i);
+}
+
+static size_t log_lz_memcnt()
+{
+	size_t cnt = 0;
+	pthread_mutex_lock(&llz_mutex);
+	for (int i = 0; i < LOG_LZ_MAX; i++) {
+		struct log_lzfile *lz = llz_a[i];
+		if (!lz)
+			continue;
+		cnt += sizeof(*lz) + strlen(lz->path) + 1
+			+ LOG_LZ_QUEUE * LOG_LZ_BLOCK
+			+ (sizeof(lz->table[0]) << LOG_LZ_HASH_BITS)
+			+ sizeof(struct log_lz_block)
+			+ LOG_LZ_BOUND(LOG_LZ_BLOCK);
+		/* the compressor may be growing it, it's a rough count */
+		if (lz->idx)
+			cnt += log_lzidx_memcnt(lz->idx);
+	}
+	pthread_mutex_unlock(&llz_mutex);
+	return cnt;
+}
@@ -0,0 +1,443 @@
+/**
+ * DOC: ce-log memory-mapped files
+ * A memory-mapped log file is preallocated to its size limit and mapped
+ * shared. The logging threads reserve their space with an atomic add and
+ * copy the lines in without holding any lock or going through stdio; what
+ * was copied is in the page cache and survives the process crashing.
+ *
+ * The thread whose reservation crosses the limit waits for the earlier
+ * reservations to complete, truncates the file to the written length and
+ * rotates it ("log" -> "log.1" -> "log.2" ...), while the threads that
+ * reserved past the limit wait for the new segment. The &struct log_mseg of
+ * the old segments stay allocated until the file is removed, as threads may
+ * still be reading their counters.
+ *
+ * If the new segment can't be opened the lines are dropped and opening it
+ * is retried by an append at most every %LOG_MMAP_RETRY_NS.
+ *
+ * After a crash the file is padded with '\0' bytes up to its size limit.
+ */
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#define LOG_MMAP_MAX 8
+#define LOG_MMAP_RETRY_NS (1000 * 1000 * 1000ull)
+
+/**
+ * struct log_mseg - a mapped segment of a log file
+ * @next:	next retired segment
+ * @fd:		the file, kept open to truncate it when done
+ * @map:	the mapping
+ * @size:	size of @map
+ * @reserved:	bytes reserved by the writers, may grow past @size
+ * @written:	bytes the writers have finished copying
+ */
+struct log_mseg {
+	struct log_mseg *next;
+	int fd;
+	char *map;
+	size_t size;
+	size_t reserved;
+	size_t written;
+};
+
+/**
+ * struct log_mmap - a memory-mapped log file
+ * @path:	path of the file, the rotated ones get ".1", ".2", ... appended
+ * @limit:	size of a file before it's rotated
+ * @keep:	count of rotated files to keep
+ * @flags:	%LOGFILE_FILTER_SGR or %0
+ * @lvl:	the threshold level character
+ * @seg:	current segment or %NULL if the file couldn't be opened
+ * @rotating:	non-zero while a thread replaces @seg, the crash handler
+ *		leaves the file alone meanwhile
+ * @retry:	log_now() time to retry opening the file at if @seg is %NULL
+ * @retired:	the earlier segments
+ * @dropped:	lines dropped as they didn't fit or the file failed
+ * @untruncated: files left at their full size with the '\0' padding, as
+ *		truncating them failed
+ */
+struct log_mmap {
+	char *path;
+	size_t limit;
+	int keep;
+	int flags;
+	int lvl;
+	struct log_mseg *seg;
+	int rotating;
+	unsigned long long retry;
+	struct log_mseg *retired;
+	unsigned long dropped;
+	unsigned long untruncated;
+};
+
+static struct log_mmap *lmap_a[LOG_MMAP_MAX];
+/* writers in each slot of lmap_a, never freed so they can be always used */
+static int lmap_users[LOG_MMAP_MAX];
+static pthread_mutex_t lmap_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int lmap_sgr_users = 0;
+
+/**
+ * log_mseg_open() - create and map a file
+ * @path:	the file to (re)create
+ * @size:	size to preallocate and map
+ *
+ * Return:	the segment or %NULL on failure, with errno set
+ */
+static struct log_mseg *log_mseg_open(const char *path, size_t size)
+{
+	int fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		return NULL;
+	/* allocated up front so a full disk can't SIGBUS the writers */
+	int e = posix_fallocate(fd, 0, size);
+	void *map = e ? MAP_FAILED : mmap(NULL, size, PROT_READ | PROT_WRITE,
+			MAP_SHARED, fd, 0);
+	if (map == MAP_FAILED) {
+		e = e ? e : errno;
+		close(fd);
+		errno = e;
+		return NULL;
+	}
+	struct log_mseg *seg = malloc(sizeof(*seg));
+	assert(seg);
+	seg->next = NULL;
+	seg->fd = fd;
+	seg->map = map;
+	seg->size = size;
+	seg->reserved = 0;
+	seg->written = 0;
+	return seg;
+}
+
+/**
+ * log_mseg_finish() - unmap a segment and truncate its file
+ * @seg:	the segment, all its writers have finished
+ * @length:	bytes written to @seg
+ *
+ * Return:	negative if the file couldn't be truncated, it keeps its '\0'
+ *		padding
+ */
+static int log_mseg_finish(struct log_mseg *seg, size_t length)
+{
+	munmap(seg->map, seg->size);
+	seg->map = NULL;
+	int rv = ftruncate(seg->fd, length);
+	close(seg->fd);
+	seg->fd = -1;
+	return rv;
+}
+
+/**
+ * log_mmap_open() - open the segment of a file after its rotation
+ * @m:		the file, @m->rotating set by the caller
+ *
+ * Reports only the first failure, to stderr as it's called from within the
+ * log.
+ */
+static void log_mmap_open(struct log_mmap *m)
+{
+	struct log_mseg *seg = log_mseg_open(m->path, m->limit);
+	if (!seg && !m->retry) {
+		char msg[256];
+		int n = snprintf(msg, sizeof(msg), "ce-log: Failed to open "
+				"the memory-mapped log %s: %s, dropping its "
+				"lines until it can be.\n", m->path,
+				strerror(errno));
+		log_crash_write(STDERR_FILENO, msg, n < sizeof(msg) ? n
+				: sizeof(msg) - 1);
+	}
+	if (!seg)
+		m->retry = log_now() + LOG_MMAP_RETRY_NS;
+	__atomic_store_n(&m->seg, seg, __ATOMIC_RELEASE);
+}
+
+/**
+ * log_mmap_reopen() - retry opening the segment of a file if it's time to
+ * @m:		the file, without a segment
+ *
+ * Return:	non-zero if @m has a segment now
+ */
+static int log_mmap_reopen(struct log_mmap *m)
+{
+	if (log_now() < __atomic_load_n(&m->retry, __ATOMIC_RELAXED)
+			|| __atomic_exchange_n(&m->rotating, 1,
+				__ATOMIC_ACQUIRE))
+		return 0;
+	if (!__atomic_load_n(&m->seg, __ATOMIC_ACQUIRE))
+		log_mmap_open(m);
+	__atomic_store_n(&m->rotating, 0, __ATOMIC_RELEASE);
+	return __atomic_load_n(&m->seg, __ATOMIC_ACQUIRE) != NULL;
+}
+
+/**
+ * log_mmap_rotate() - replace the full segment of a file
+ * @m:		the file
+ * @seg:	its current segment
+ * @length:	bytes written to @seg
+ */
+static void log_mmap_rotate(struct log_mmap *m, struct log_mseg *seg,
+		size_t length)
+{
+	__atomic_store_n(&m->rotating, 1, __ATOMIC_SEQ_CST);
+	if (log_mseg_finish(seg, length) < 0)
+		__atomic_add_fetch(&m->untruncated, 1, __ATOMIC_RELAXED);
+	size_t l = strlen(m->path);
+	char from[l + 12], to[l + 12];
+	for (int k = m->keep; k > 0; k--) {
+		if (k > 1)
+			snprintf(from, sizeof(from), "%s.%i", m->path, k - 1);
+		else
+			strcpy(from, m->path);
+		snprintf(to, sizeof(to), "%s.%i", m->path, k);
+		rename(from, to);
+	}
+	seg->next = m->retired;
+	m->retired = seg;
+	log_mmap_open(m);
+	__atomic_store_n(&m->rotating, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * log_mmap_append() - copy a line (or lines) to a file
+ * @m:		the file
+ * @s:		the text
+ * @length:	length of @s
+ */
+static void log_mmap_append(struct log_mmap *m, const char *s, size_t length)
+{
+	for (;;) {
+		struct log_mseg *seg = __atomic_load_n(&m->seg, __ATOMIC_ACQUIRE);
+		if (!seg && log_mmap_reopen(m))
+			continue;
+		if (!seg || length > seg->size) {
+			__atomic_add_fetch(&m->dropped, 1, __ATOMIC_RELAXED);
+			return;
+		}
+		size_t off = __atomic_fetch_add(&seg->reserved, length,
+				__ATOMIC_RELAXED);
+		if (off + length <= seg->size) {
+			memcpy(seg->map + off, s, length);
+			__atomic_add_fetch(&seg->written, length,
+					__ATOMIC_RELEASE);
+			return;
+		}
+		if (off <= seg->size) { /* the first one past the limit */
+			while (__atomic_load_n(&seg->written, __ATOMIC_ACQUIRE)
+					!= off)
+				sched_yield();
+			log_mmap_rotate(m, seg, off);
+			continue;
+		}
+		while (__atomic_load_n(&m->seg, __ATOMIC_ACQUIRE) == seg)
+			sched_yield();
+	}
+}
+
+/**
+ * log_mmap_write() - write formatted lines to the memory-mapped files
+ * @buf:	the formatted lines
+ * @length:	length of @buf
+ * @ln:		the lines formatted, for their levels
+ * @count:	count of @ln
+ * @maxlvl:	the least important level in @ln
+ * @sgr:	%LOGFILE_FILTER_SGR to write to the filtered files, else %0
+ */
+static void log_mmap_write(const char *buf, int length,
+		const struct log_line *ln, int count, int maxlvl, int sgr)
+{
+	for (int y = 0; y < LOG_MMAP_MAX; y++) {
+		if (!__atomic_load_n(&lmap_a[y], __ATOMIC_RELAXED))
+			continue;
+		__atomic_add_fetch(&lmap_users[y], 1, __ATOMIC_SEQ_CST);
+		struct log_mmap *m = __atomic_load_n(&lmap_a[y],
+				__ATOMIC_SEQ_CST);
+		if (!m || (m->flags & LOGFILE_FILTER_SGR) != sgr) {
+			__atomic_sub_fetch(&lmap_users[y], 1, __ATOMIC_RELEASE);
+			continue;
+		}
+		if (maxlvl <= m->lvl) {
+			log_mmap_append(m, buf, length);
+		} else {
+			const char *l = buf, *nl;
+			for (int i = 0; i < count; i++, l = nl + 1) {
+				nl = memchr(l, '\n', buf + length - l);
+				if (ln[i].lvl <= m->lvl)
+					log_mmap_append(m, l, nl + 1 - l);
+			}
+		}
+		__atomic_sub_fetch(&lmap_users[y], 1, __ATOMIC_RELEASE);
+	}
+}
+
+/**
+ * log_mmap_crash_write() - copy a line to the files, from a signal handler
+ * @s:		the line, without SGR escape sequences
+ * @length:	length of @s
+ * @lvl:	level of the line
+ *
+ * A line that doesn't fit the current segment is dropped, the files aren't
+ * rotated, nor written while another thread rotates them. The space is
+ * reserved only if it's all below the limit, the rotating thread waits for
+ * such reservations to be written.
+ */
+static void log_mmap_crash_write(const char *s, size_t length, int lvl)
+{
+	for (int y = 0; y < LOG_MMAP_MAX; y++) {
+		struct log_mmap *m = __atomic_load_n(&lmap_a[y],
+				__ATOMIC_ACQUIRE);
+		if (!m || lvl > m->lvl || __atomic_load_n(&m->rotating,
+					__ATOMIC_SEQ_CST))
+			continue;
+		struct log_mseg *seg = __atomic_load_n(&m->seg, __ATOMIC_ACQUIRE);
+		if (!seg)
+			continue;
+		size_t off = __atomic_load_n(&seg->reserved, __ATOMIC_RELAXED);
+		do {
+			if (off + length > seg->size)
+				break;
+		} while (!__atomic_compare_exchange_n(&seg->reserved, &off,
+					off + length, true, __ATOMIC_RELAXED,
+					__ATOMIC_RELAXED));
+		if (off + length > seg->size)
+			continue;
+		memcpy(seg->map + off, s, length);
+		__atomic_add_fetch(&seg->written, length, __ATOMIC_RELEASE);
+	}
+}
+
+/**
+ * lmap_thres_update() - recompute @lmap_thres_max
+ *
+ * Called with @lmap_mutex held.
+ */
+static void lmap_thres_update()
+{
+	int mx = '0';
+	for (int i = 0; i < LOG_MMAP_MAX; i++) {
+		if (lmap_a[i] && lmap_a[i]->lvl > mx)
+			mx = lmap_a[i]->lvl;
+	}
+	__atomic_store_n(&lmap_thres_max, mx, __ATOMIC_RELAXED);
+	log_level_changed();
+}
+
+int log_mmap_file_add(const char *path, size_t limit, int keep, int flags)
+{
+	assert(path && limit > 0 && keep >= 0);
+	assert(!(flags & ~LOGFILE_FILTER_SGR));
+	struct log_mseg *seg = log_mseg_open(path, limit);
+	if (!seg)
+		return -1;
+	struct log_mmap *m = malloc(sizeof(*m));
+	assert(m);
+	size_t l = strlen(path) + 1;
+	m->path = memcpy(malloc(l), path, l);
+	m->limit = limit;
+	m->keep = keep;
+	m->flags = flags;
+	m->lvl = '5';
+	m->seg = seg;
+	m->rotating = 0;
+	m->retry = 0;
+	m->retired = NULL;
+	m->dropped = 0;
+	m->untruncated = 0;
+
+	pthread_mutex_lock(&lmap_mutex);
+	int i;
+	for (i = 0; i < LOG_MMAP_MAX && lmap_a[i]; i++);
+	if (i == LOG_MMAP_MAX) {
+		pthread_mutex_unlock(&lmap_mutex);
+		log_mseg_finish(seg, 0);
+		free(seg);
+		free(m->path);
+		free(m);
+		return -1;
+	}
+	if ((flags & LOGFILE_FILTER_SGR))
+		__atomic_add_fetch(&lmap_sgr_users, 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&lmap_a[i], m, __ATOMIC_RELEASE);
+	lmap_thres_update();
+	pthread_mutex_unlock(&lmap_mutex);
+	return i;
+}
+
+int log_mmap_file_rm(int hndl)
+{
+	pthread_mutex_lock(&lmap_mutex);
+	if (hndl < 0 || hndl >= LOG_MMAP_MAX || !lmap_a[hndl]) {
+		pthread_mutex_unlock(&lmap_mutex);
+		return -1;
+	}
+	struct log_mmap *m = lmap_a[hndl];
+	__atomic_store_n(&lmap_a[hndl], NULL, __ATOMIC_SEQ_CST);
+	while (__atomic_load_n(&lmap_users[hndl], __ATOMIC_SEQ_CST))
+		sched_yield();
+	if ((m->flags & LOGFILE_FILTER_SGR))
+		__atomic_sub_fetch(&lmap_sgr_users, 1, __ATOMIC_RELAXED);
+	lmap_thres_update();
+	pthread_mutex_unlock(&lmap_mutex);
+
+	if (m->seg) {
+		if (log_mseg_finish(m->seg, m->seg->written) < 0)
+			m->untruncated++;
+		free(m->seg);
+	}
+	while (m->retired) {
+		struct log_mseg *seg = m->retired;
+		m->retired = seg->next;
+		free(seg);
+	}
+	if (m->dropped)
+		lprintf(WRN "Memory-mapped log "lBLD_"%s"_lBLD" dropped "
+				lF_YELW"%lu"_lF" lines.\n", m->path, m->dropped);
+	if (m->untruncated)
+		lprintf(WRN "Failed to truncate "lF_YELW"%lu"_lF" files of "
+				"the memory-mapped log "lBLD_"%s"_lBLD".\n",
+				m->untruncated, m->path);
+	free(m->path);
+	free(m);
+	return hndl;
+}
+
+int log_mmap_file_threshold(int hndl, const char *lvlmcro)
+{
+	int lvl = log_lvlmcro(lvlmcro);
+	pthread_mutex_lock(&lmap_mutex);
+	if (hndl < 0 || hndl >= LOG_MMAP_MAX || !lmap_a[hndl]) {
+		pthread_mutex_unlock(&lmap_mutex);
+		return -1;
+	}
+	lmap_a[hndl]->lvl = lvl;
+	lmap_thres_update();
+	pthread_mutex_unlock(&lmap_mutex);
+	return hndl;
+}
+
+static void log_mmap_rmall()
+{
+	for (int i = 0; i < LOG_MMAP_MAX; i++)
+		log_mmap_file_rm(i);
+}
+
+static size_t log_mmap_memcnt()
+{
+	size_t cnt = 0;
+	pthread_mutex_lock(&lmap_mutex);
+	for (int i = 0; i < LOG_MMAP_MAX; i++) {
+		struct log_mmap *m = lmap_a[i];
+		if (!m)
+			continue;
+		cnt += sizeof(*m) + strlen(m->path) + 1;
+		if (m->seg)
+			cnt += sizeof(*m->seg);
+		for (struct log_mseg *s = m->retired; s; s = s->next)
+			cnt += sizeof(*s);
+	}
+	pthread_mutex_unlock(&lmap_mutex);
+	return cnt;
+}
@@ -0,0 +1,77 @@
+/**
+ * DOC: ce-log SGR filtering
+ * The %LOGFILE_FILTER_SGR files get the log without the "\x1b[...m" escape
+ * sequences. log_sgr_strip() copies the text into a separate buffer in a
+ * single pass, skipping the sequences; with SSE2 it moves 16 bytes at a time
+ * up to the next escape character.
+ *
+ * Kept free of the rest of core/log.c so that tools/bench-sgr.c can include
+ * it as well.
+ */
+#include <string.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+/**
+ * log_sgr_skip() - handle the escape character at @src[i]
+ * @dst:	output buffer
+ * @y:		position in @dst
+ * @src:	input
+ * @i:		position of the escape character in @src
+ * @length:	length of @src
+ *
+ * Return:	the position in @src after the sequence, the escape character is
+ *		copied to @dst[*y] when it doesn't start a "\x1b[" sequence
+ */
+static inline int log_sgr_skip(char *dst, int *y, const char *src, int i,
+		int length)
+{
+	if (i + 1 < length && src[i + 1] == '[') {
+		/* the sequences are short, a call to memchr() costs more */
+		for (i += 2; i < length && src[i] != 'm'; i++);
+		return i < length ? i + 1 : length;
+	}
+	dst[(*y)++] = src[i];
+	return i + 1;
+}
+
+/**
+ * log_sgr_strip() - copy text without the SGR escape sequences
+ * @dst:	output buffer of at least @length bytes
+ * @src:	the text
+ * @length:	length of @src
+ *
+ * Return:	the length written to @dst
+ */
+static int log_sgr_strip(char *dst, const char *src, int length)
+{
+	int i = 0, y = 0;
+#ifdef __SSE2__
+	const __m128i esc = _mm_set1_epi8('\x1b');
+	while (i + 16 <= length) {
+		__m128i v = _mm_loadu_si128((const __m128i *) (src + i));
+		int mask = _mm_movemask_epi8(_mm_cmpeq_epi8(v, esc));
+		/* may store past the escape, it gets overwritten */
+		_mm_storeu_si128((__m128i *) (dst + y), v);
+		if (!mask) {
+			i += 16;
+			y += 16;
+			continue;
+		}
+		int n = __builtin_ctz(mask);
+		y += n;
+		i = log_sgr_skip(dst, &y, src, i + n, length);
+	}
+#endif
+	while (i < length) {
+		const char *e = memchr(src + i, '\x1b', length - i);
+		int n = e ? e - (src + i) : length - i;
+		memcpy(dst + y, src + i, n);
+		y += n;
+		i += n;
+		if (i < length)
+			i = log_sgr_skip(dst, &y, src, i, length);
+	}
+	return y;
+}
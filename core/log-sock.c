@@ -0,0 +1,434 @@
+/**
+ * DOC: ce-log sockets
+ * A log socket streams the lines of the text logs, without the escape
+ * sequences, or their JSON objects with %LOGFILE_JSON, to a collector
+ * listening on a Unix domain stream socket (see tools/logcollect.c).
+ *
+ * The logging threads only copy whole lines into the bounded queue of the
+ * socket under its mutex, dropping the lines that don't fit; each socket has
+ * a thread of its own connecting and sending with non-blocking calls, so a
+ * slow, stopped or absent collector costs the logging threads nothing but
+ * the lines dropped. The sender reconnects every %LOG_SOCK_RETRY_NS while
+ * the collector is away; what was left of a line cut by a lost connection
+ * is dropped, so a new connection starts with a whole line.
+ */
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <poll.h>
+
+#define LOG_SOCK_MAX 4
+#define LOG_SOCK_QUEUE (1 << 20)
+#define LOG_SOCK_RETRY_NS (1000 * 1000 * 1000ull)
+/* the longest log_flush() waits for a socket to send its queue */
+#define LOG_SOCK_FLUSH_NS (1000 * 1000 * 1000ull)
+
+/**
+ * struct log_sock - a log socket
+ * @path:	path of the collector's socket
+ * @flags:	%LOGFILE_JSON or %0
+ * @lvl:	the threshold level character
+ * @fd:		the connection or -1
+ * @q:		the queue, %LOG_SOCK_QUEUE bytes
+ * @head:	offset in @q of the first byte to send
+ * @length:	bytes queued from @head on, wrapping around
+ * @cut:	the line at @head was sent in part
+ * @stop:	tells the sender to send what it can and quit
+ * @mutex:	guards the fields from @q on
+ * @wake:	signals the sender
+ * @done:	signals log_flush() that the sender has made progress
+ * @thread:	the sender
+ * @sent:	bytes sent
+ * @dropped:	lines dropped as they didn't fit
+ * @connects:	count of connections made
+ */
+struct log_sock {
+	char *path;
+	int flags;
+	int lvl;
+	int fd;
+	char *q;
+	size_t head;
+	size_t length;
+	bool cut;
+	bool stop;
+	pthread_mutex_t mutex;
+	pthread_cond_t wake;
+	pthread_cond_t done;
+	pthread_t thread;
+	unsigned long long sent;
+	unsigned long long dropped;
+	unsigned int connects;
+};
+
+static struct log_sock *lsock_a[LOG_SOCK_MAX];
+/* the logging threads using each of lsock_a, for log_sock_rm() to wait */
+static int lsock_users[LOG_SOCK_MAX];
+static int lsock_txt_users = 0;
+static int lsock_json_users = 0;
+static pthread_mutex_t lsock_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * log_sock_connect() - connect to the collector
+ * @s:		the socket
+ *
+ * Return:	the connection or -1
+ */
+static int log_sock_connect(struct log_sock *s)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	strncpy(addr.sun_path, s->path, sizeof(addr.sun_path) - 1);
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC,
+			0);
+	if (fd < 0)
+		return -1;
+	/* for a Unix socket the connection is made or refused at once */
+	if (connect(fd, (struct sockaddr *) &addr, sizeof(addr))) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/**
+ * log_sock_append() - queue lines
+ * @s:		the socket, @s->mutex held
+ * @l:		the lines
+ * @length:	length of @l
+ * @lines:	count of @l
+ */
+static void log_sock_append(struct log_sock *s, const char *l, int length,
+		int lines)
+{
+	if (s->length + length > LOG_SOCK_QUEUE) {
+		s->dropped += lines;
+		return;
+	}
+	size_t tail = (s->head + s->length) % LOG_SOCK_QUEUE;
+	size_t n = LOG_SOCK_QUEUE - tail < (size_t) length
+		? LOG_SOCK_QUEUE - tail : (size_t) length;
+	memcpy(s->q + tail, l, n);
+	memcpy(s->q, l + n, length - n);
+	if (!s->length)
+		pthread_cond_signal(&s->wake);
+	s->length += length;
+}
+
+/**
+ * log_sock_advance() - take sent or dropped bytes off the queue
+ * @s:		the socket, @s->mutex held
+ * @n:		count of the bytes
+ */
+static void log_sock_advance(struct log_sock *s, size_t n)
+{
+	s->head = (s->head + n) % LOG_SOCK_QUEUE;
+	s->length -= n;
+	pthread_cond_broadcast(&s->done);
+}
+
+/**
+ * log_sock_lost() - close a lost connection
+ * @s:		the socket, @s->mutex held
+ *
+ * Drops the rest of the line that was being sent, if any.
+ */
+static void log_sock_lost(struct log_sock *s)
+{
+	close(s->fd);
+	s->fd = -1;
+	while (s->cut && s->length) {
+		size_t n = LOG_SOCK_QUEUE - s->head < s->length
+			? LOG_SOCK_QUEUE - s->head : s->length;
+		const char *nl = memchr(s->q + s->head, '\n', n);
+		if (nl) {
+			n = nl + 1 - (s->q + s->head);
+			s->cut = false;
+		}
+		log_sock_advance(s, n);
+	}
+	s->cut = false;
+	pthread_cond_broadcast(&s->done);
+}
+
+/**
+ * log_sock_thread() - connect and send the queue of a socket
+ * @arg:	the &struct log_sock
+ *
+ * Sends from the queue without holding the mutex, the logging threads only
+ * append after what's being sent. On removal sends what's queued unless the
+ * collector is away or stalls.
+ */
+static void *log_sock_thread(void *arg)
+{
+	struct log_sock *s = arg;
+	unsigned long long retry = 0;
+	pthread_mutex_lock(&s->mutex);
+	for (;;) {
+		if (s->fd < 0 && !s->stop && log_now() >= retry) {
+			pthread_mutex_unlock(&s->mutex);
+			int fd = log_sock_connect(s);
+			pthread_mutex_lock(&s->mutex);
+			s->fd = fd;
+			if (fd < 0)
+				retry = log_now() + LOG_SOCK_RETRY_NS;
+			else
+				s->connects++;
+			pthread_cond_broadcast(&s->done);
+		}
+		if (s->fd >= 0 && s->length) {
+			size_t n = LOG_SOCK_QUEUE - s->head < s->length
+				? LOG_SOCK_QUEUE - s->head : s->length;
+			const char *p = s->q + s->head;
+			pthread_mutex_unlock(&s->mutex);
+			ssize_t w = send(s->fd, p, n, MSG_NOSIGNAL);
+			int err = errno;
+			bool stalled = false, cut = w > 0 && p[w - 1] != '\n';
+			if (w < 0 && (err == EAGAIN || err == EWOULDBLOCK)) {
+				struct pollfd pfd = { s->fd, POLLOUT, 0 };
+				stalled = poll(&pfd, 1, 100) == 0;
+			}
+			pthread_mutex_lock(&s->mutex);
+			if (w > 0) {
+				s->sent += w;
+				log_sock_advance(s, w);
+				s->cut = cut;
+			} else if (w < 0 && err != EAGAIN && err != EWOULDBLOCK
+					&& err != EINTR) {
+				log_sock_lost(s);
+				retry = log_now() + LOG_SOCK_RETRY_NS;
+			}
+			if (!(s->stop && stalled))
+				continue;
+		}
+		if (s->stop)
+			break;
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_nsec += 100 * 1000 * 1000; /* 100ms, to reconnect */
+		if (ts.tv_nsec >= 1000 * 1000 * 1000) {
+			ts.tv_sec += 1;
+			ts.tv_nsec -= 1000 * 1000 * 1000;
+		}
+		pthread_cond_timedwait(&s->wake, &s->mutex, &ts);
+	}
+	pthread_mutex_unlock(&s->mutex);
+	return NULL;
+}
+
+/**
+ * log_sock_write() - queue formatted lines for the sockets
+ * @buf:	the formatted lines
+ * @length:	length of @buf
+ * @ln:		the lines formatted, for their levels
+ * @count:	count of @ln
+ * @maxlvl:	the least important level in @ln
+ * @flags:	%LOGFILE_JSON if @buf holds JSON objects, else %0
+ */
+static void log_sock_write(const char *buf, int length,
+		const struct log_line *ln, int count, int maxlvl, int flags)
+{
+	for (int y = 0; y < LOG_SOCK_MAX; y++) {
+		if (!__atomic_load_n(&lsock_a[y], __ATOMIC_RELAXED))
+			continue;
+		__atomic_add_fetch(&lsock_users[y], 1, __ATOMIC_SEQ_CST);
+		struct log_sock *s = __atomic_load_n(&lsock_a[y],
+				__ATOMIC_SEQ_CST);
+		if (!s || s->flags != flags) {
+			__atomic_sub_fetch(&lsock_users[y], 1,
+					__ATOMIC_RELEASE);
+			continue;
+		}
+		pthread_mutex_lock(&s->mutex);
+		if (maxlvl <= s->lvl) {
+			log_sock_append(s, buf, length, count);
+		} else {
+			const char *l = buf, *nl;
+			for (int i = 0; i < count; i++, l = nl + 1) {
+				nl = memchr(l, '\n', buf + length - l);
+				if (ln[i].lvl <= s->lvl)
+					log_sock_append(s, l, nl + 1 - l, 1);
+			}
+		}
+		pthread_mutex_unlock(&s->mutex);
+		__atomic_sub_fetch(&lsock_users[y], 1, __ATOMIC_RELEASE);
+	}
+}
+
+/**
+ * log_sock_flush() - wait for the sockets to send their queues
+ *
+ * Doesn't wait for the sockets whose collector is away and waits at most
+ * %LOG_SOCK_FLUSH_NS for each of the others.
+ */
+static void log_sock_flush()
+{
+	pthread_mutex_lock(&lsock_mutex);
+	for (int y = 0; y < LOG_SOCK_MAX; y++) {
+		struct log_sock *s = lsock_a[y];
+		if (!s)
+			continue;
+		unsigned long long end = log_now() + LOG_SOCK_FLUSH_NS;
+		pthread_mutex_lock(&s->mutex);
+		while (s->length && s->fd >= 0 && log_now() < end) {
+			struct timespec ts;
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_nsec += 10 * 1000 * 1000;
+			if (ts.tv_nsec >= 1000 * 1000 * 1000) {
+				ts.tv_sec += 1;
+				ts.tv_nsec -= 1000 * 1000 * 1000;
+			}
+			pthread_cond_timedwait(&s->done, &s->mutex, &ts);
+		}
+		pthread_mutex_unlock(&s->mutex);
+	}
+	pthread_mutex_unlock(&lsock_mutex);
+}
+
+/**
+ * lsock_thres_update() - recompute @lsock_thres_max and the users
+ *
+ * Called with @lsock_mutex held.
+ */
+static void lsock_thres_update()
+{
+	int mx = '0', txt = 0, json = 0;
+	for (int i = 0; i < LOG_SOCK_MAX; i++) {
+		if (!lsock_a[i])
+			continue;
+		if (lsock_a[i]->lvl > mx)
+			mx = lsock_a[i]->lvl;
+		if (lsock_a[i]->flags & LOGFILE_JSON)
+			json++;
+		else
+			txt++;
+	}
+	__atomic_store_n(&lsock_txt_users, txt, __ATOMIC_RELAXED);
+	__atomic_store_n(&lsock_json_users, json, __ATOMIC_RELAXED);
+	__atomic_store_n(&lsock_thres_max, mx, __ATOMIC_RELAXED);
+	log_level_changed();
+}
+
+/**
+ * log_sock_free() - free a socket whose sender isn't running
+ * @s:		the socket
+ */
+static void log_sock_free(struct log_sock *s)
+{
+	if (s->fd >= 0)
+		close(s->fd);
+	pthread_mutex_destroy(&s->mutex);
+	pthread_cond_destroy(&s->wake);
+	pthread_cond_destroy(&s->done);
+	free(s->q);
+	free(s->path);
+	free(s);
+}
+
+/**
+ * log_sock_stop() - stop the sender of a socket
+ * @s:		the socket, no longer in @lsock_a
+ */
+static void log_sock_stop(struct log_sock *s)
+{
+	pthread_mutex_lock(&s->mutex);
+	s->stop = true;
+	pthread_cond_signal(&s->wake);
+	pthread_mutex_unlock(&s->mutex);
+	pthread_join(s->thread, NULL);
+}
+
+int log_sock_add(const char *path, int flags)
+{
+	assert(path);
+	assert(!(flags & ~LOGFILE_JSON));
+	if (strlen(path) >= sizeof(((struct sockaddr_un *) 0)->sun_path))
+		return -1;
+	struct log_sock *s = calloc(1, sizeof(*s));
+	assert(s);
+	size_t l = strlen(path) + 1;
+	s->path = memcpy(malloc(l), path, l);
+	s->flags = flags;
+	s->lvl = '5';
+	s->fd = -1;
+	s->q = malloc(LOG_SOCK_QUEUE);
+	assert(s->path && s->q);
+	pthread_mutex_init(&s->mutex, NULL);
+	pthread_cond_init(&s->wake, NULL);
+	pthread_cond_init(&s->done, NULL);
+	if (pthread_create(&s->thread, NULL, log_sock_thread, s)) {
+		log_sock_free(s);
+		return -1;
+	}
+
+	pthread_mutex_lock(&lsock_mutex);
+	int i;
+	for (i = 0; i < LOG_SOCK_MAX && lsock_a[i]; i++);
+	if (i == LOG_SOCK_MAX) {
+		pthread_mutex_unlock(&lsock_mutex);
+		log_sock_stop(s);
+		log_sock_free(s);
+		return -1;
+	}
+	__atomic_store_n(&lsock_a[i], s, __ATOMIC_RELEASE);
+	lsock_thres_update();
+	pthread_mutex_unlock(&lsock_mutex);
+	return i;
+}
+
+int log_sock_rm(int hndl)
+{
+	pthread_mutex_lock(&lsock_mutex);
+	if (hndl < 0 || hndl >= LOG_SOCK_MAX || !lsock_a[hndl]) {
+		pthread_mutex_unlock(&lsock_mutex);
+		return -1;
+	}
+	struct log_sock *s = lsock_a[hndl];
+	__atomic_store_n(&lsock_a[hndl], NULL, __ATOMIC_SEQ_CST);
+	while (__atomic_load_n(&lsock_users[hndl], __ATOMIC_SEQ_CST))
+		sched_yield();
+	lsock_thres_update();
+	pthread_mutex_unlock(&lsock_mutex);
+
+	log_sock_stop(s);
+	if (s->dropped || s->length)
+		lprintf(WRN "Log socket "lBLD_"%s"_lBLD" dropped "lF_YELW"%llu"
+				_lF" lines, "lF_YELW"%zu"_lF" bytes left "
+				"unsent.\n", s->path, s->dropped, s->length);
+	lprintf(INF "Log socket "lF_BLUE"%s"_lF" closed, "lF_BLUE"%llu"_lF
+			" bytes sent in "lF_BLUE"%u"_lF" connections.\n",
+			s->path, s->sent, s->connects);
+	log_sock_free(s);
+	return hndl;
+}
+
+int log_sock_threshold(int hndl, const char *lvlmcro)
+{
+	int lvl = log_lvlmcro(lvlmcro);
+	pthread_mutex_lock(&lsock_mutex);
+	if (hndl < 0 || hndl >= LOG_SOCK_MAX || !lsock_a[hndl]) {
+		pthread_mutex_unlock(&lsock_mutex);
+		return -1;
+	}
+	lsock_a[hndl]->lvl = lvl;
+	lsock_thres_update();
+	pthread_mutex_unlock(&lsock_mutex);
+	return hndl;
+}
+
+static void log_sock_rmall()
+{
+	for (int i = 0; i < LOG_SOCK_MAX; i++)
+		log_sock_rm(i);
+}
+
+static size_t log_sock_memcnt()
+{
+	size_t cnt = 0;
+	pthread_mutex_lock(&lsock_mutex);
+	for (int i = 0; i < LOG_SOCK_MAX; i++) {
+		if (lsock_a[i])
+			cnt += sizeof(*lsock_a[i]) + strlen(lsock_a[i]->path)
+				+ 1 + LOG_SOCK_QUEUE;
+	}
+	pthread_mutex_unlock(&lsock_mutex);
+	return cnt;
+}
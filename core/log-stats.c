@@ -0,0 +1,177 @@
+/**
+ * DOC: ce-log call site statistics
+ * With log_stats_enable() the messages, bytes and the time spent formatting
+ * and writing (or queueing, in asynchronous mode) are counted per call site.
+ * The log_site_pass() of the lprintf() family of macros leaves the site in
+ * @log_site_cur for the function it calls.
+ *
+ * The counters live in chunks owned by core/log.c rather than in the
+ * &struct log_site of the call sites, which may be in a library that gets
+ * unloaded, and the origin of the site is copied for the same reason. The
+ * chunks are never moved, so the counters are updated without locks.
+ */
+
+#define LOG_STAT_CHUNK 256
+#define LOG_STAT_CHUNKS 64
+
+/**
+ * struct log_stat - the statistics of a call site
+ * @origin:	"file.c+33" of the site
+ * @msgs:	count of messages
+ * @bytes:	formatted bytes
+ * @fmt_ns:	nanoseconds spent formatting
+ * @write_ns:	nanoseconds spent writing or queueing the lines
+ */
+struct log_stat {
+	char *origin;
+	unsigned long long msgs;
+	unsigned long long bytes;
+	unsigned long long fmt_ns;
+	unsigned long long write_ns;
+};
+
+__thread struct log_site *log_site_cur = NULL;
+
+static int lstat_on = 0;
+static struct log_stat *lstat_chunks[LOG_STAT_CHUNKS];
+static int lstat_length = 0;
+static pthread_mutex_t lstat_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static struct log_stat *log_stat_get(int i)
+{
+	return lstat_chunks[i / LOG_STAT_CHUNK] + i % LOG_STAT_CHUNK;
+}
+
+/**
+ * log_stat_register() - give a call site its statistics
+ * @site:	the call site
+ *
+ * Return:	the statistics or %NULL if there's no room left
+ */
+static struct log_stat *log_stat_register(struct log_site *site)
+{
+	pthread_mutex_lock(&lstat_mutex);
+	int i = __atomic_load_n(&site->stat, __ATOMIC_ACQUIRE) - 1;
+	if (i >= 0) {
+		pthread_mutex_unlock(&lstat_mutex);
+		return log_stat_get(i);
+	}
+	i = lstat_length;
+	if (i >= LOG_STAT_CHUNK * LOG_STAT_CHUNKS) {
+		pthread_mutex_unlock(&lstat_mutex);
+		return NULL;
+	}
+	if (!lstat_chunks[i / LOG_STAT_CHUNK]) {
+		lstat_chunks[i / LOG_STAT_CHUNK] = calloc(LOG_STAT_CHUNK,
+				sizeof(struct log_stat));
+		assert(lstat_chunks[i / LOG_STAT_CHUNK]);
+	}
+	struct log_stat *st = log_stat_get(i);
+	int l = strlen(site->origin);
+	if (l && site->origin[l - 1] == ':')
+		l--;
+	st->origin = memcpy(malloc(l + 1), site->origin, l);
+	st->origin[l] = '\0';
+	__atomic_store_n(&lstat_length, i + 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&site->stat, i + 1, __ATOMIC_RELEASE);
+	pthread_mutex_unlock(&lstat_mutex);
+	return st;
+}
+
+/**
+ * log_stat_add() - count a message of a call site
+ * @site:	the call site or %NULL when not called through a macro
+ * @bytes:	bytes formatted
+ * @fmt_ns:	time spent formatting
+ * @write_ns:	time spent writing
+ */
+static void log_stat_add(struct log_site *site, int bytes,
+		unsigned long long fmt_ns, unsigned long long write_ns)
+{
+	if (!site || !site->origin)
+		return;
+	int i = __atomic_load_n(&site->stat, __ATOMIC_ACQUIRE) - 1;
+	struct log_stat *st = i >= 0 ? log_stat_get(i)
+		: log_stat_register(site);
+	if (!st)
+		return;
+	__atomic_add_fetch(&st->msgs, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&st->bytes, bytes, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&st->fmt_ns, fmt_ns, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&st->write_ns, write_ns, __ATOMIC_RELAXED);
+}
+
+void log_stats_enable(int on)
+{
+	__atomic_store_n(&lstat_on, on, __ATOMIC_RELAXED);
+}
+
+static int log_stat_cmp(const void *a, const void *b)
+{
+	const struct log_stat *x = a, *y = b;
+	unsigned long long tx = x->fmt_ns + x->write_ns;
+	unsigned long long ty = y->fmt_ns + y->write_ns;
+	return tx < ty ? 1 : tx > ty ? -1 : 0;
+}
+
+void log_stats_report(int n)
+{
+	int length = __atomic_load_n(&lstat_length, __ATOMIC_ACQUIRE);
+	if (!length)
+		return;
+	struct log_stat *snap = malloc(length * sizeof(*snap));
+	assert(snap);
+	unsigned long long msgs = 0, ns = 0;
+	for (int i = 0; i < length; i++) {
+		struct log_stat *st = log_stat_get(i);
+		snap[i].origin = st->origin;
+		snap[i].msgs = __atomic_load_n(&st->msgs, __ATOMIC_RELAXED);
+		snap[i].bytes = __atomic_load_n(&st->bytes, __ATOMIC_RELAXED);
+		snap[i].fmt_ns = __atomic_load_n(&st->fmt_ns, __ATOMIC_RELAXED);
+		snap[i].write_ns = __atomic_load_n(&st->write_ns,
+				__ATOMIC_RELAXED);
+		msgs += snap[i].msgs;
+		ns += snap[i].fmt_ns + snap[i].write_ns;
+	}
+	qsort(snap, length, sizeof(*snap), log_stat_cmp);
+	if (n <= 0 || n > length)
+		n = length;
+	lprintf(INF "Log call sites: "lF_BLUE"%i"_lF", messages "lF_BLUE"%llu"
+			_lF", "lF_BLUE"%.3f"_lF" ms spent, the top "lF_BLUE
+			"%i"_lF":\n", length, msgs, ns / 1e6, n);
+	for (int i = 0; i < n; i++) {
+		struct log_stat *st = snap + i;
+		lprintf(INF "%24s: "lF_BLUE"%8llu"_lF" msgs "lF_BLUE"%10llu"_lF
+				" B, format "lF_BLUE"%9.3f"_lF" ms, write "
+				lF_BLUE"%9.3f"_lF" ms\n", st->origin, st->msgs,
+				st->bytes, st->fmt_ns / 1e6, st->write_ns / 1e6);
+	}
+	free(snap);
+}
+
+static void log_stats_free()
+{
+	__atomic_store_n(&lstat_on, 0, __ATOMIC_RELAXED);
+	pthread_mutex_lock(&lstat_mutex);
+	for (int i = 0; i < lstat_length; i++)
+		free(log_stat_get(i)->origin);
+	for (int i = 0; i < LOG_STAT_CHUNKS; i++) {
+		free(lstat_chunks[i]);
+		lstat_chunks[i] = NULL;
+	}
+	lstat_length = 0;
+	pthread_mutex_unlock(&lstat_mutex);
+}
+
+static size_t log_stats_memcnt()
+{
+	size_t cnt = 0;
+	pthread_mutex_lock(&lstat_mutex);
+	for (int i = 0; i < LOG_STAT_CHUNKS; i++)
+		cnt += lstat_chunks[i] ? LOG_STAT_CHUNK * sizeof(struct log_stat)
+			: 0;
+	for (int i = 0; i < lstat_length; i++)
+		cnt += strlen(log_stat_get(i)->origin) + 1;
+	pthread_mutex_unlock(&lstat_mutex);
+	return cnt;
+}
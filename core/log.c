@@ -1,41 +1,124 @@
+/* required for clock_gettime and sem_timedwait with stdc99 */
+#define _POSIX_C_SOURCE 200809L
+#define _XOPEN_SOURCE 700 /* sigaltstack */
+
 #include <stdarg.h> /* va_list */
 #include <stdio.h>
 #include "xf-strb.h"
 #include "ce-aux.h"
 #include "ce-log.h"
+#include "ce-log-bin.h" /* LOG_LINE_MISSING */
 #include "xf-escg.h"
 #include <stdbool.h>
 #include <time.h>
+#include <sys/uio.h> /* writev */
+#include <unistd.h>
+#include <errno.h>
+#include <sched.h> /* sched_yield */
 #define __USE_UNIX98 1
 #include <pthread.h>
 
 /**
  * DOC: log-pipeline
- * lputs()/lprintf() -> log_raw_process() -> log_raw_push()
- * -> log_argcb() -> log_txt_push()
+ * lputs()/lprintf() -> log_raw_process() -> log_raw_stamp() -> log_raw_push()
+ * -> logfile_callback()
+ *
+ * log_raw_stamp() scans the complete lines once, splitting them into the
+ * fields of &struct log_line that point into the message buffer, so neither
+ * the headers nor the listeners copy or re-parse the text.
+ *
+ * In asynchronous mode (log_async_start()) log_raw_process() queues the
+ * lines and the writer thread continues from log_raw_stamp().
  */
 
-/* log_raw_push() calls these */
-static void (**raw_callb_a)(const char *str, int length);
-static int raw_callb_length = 0;
-static int raw_callb_size = 1;
-void log_raw_listen_add(void (*callb)(const char *str, int length));
-int log_raw_listen_rm(void (*callb)(const char *str, int length));
+/**
+ * struct log_listeners - the callbacks log_raw_push() calls
+ * @length:	count of @a
+ * @a:		the callbacks
+ *
+ * Never changed once published in raw_callb, log_raw_listen_add() and
+ * log_raw_listen_rm() publish a copy and free the old one when no
+ * log_raw_push() can be reading it anymore.
+ */
+struct log_listeners {
+	int length;
+	void (*a[])(const struct log_line *ln, int count);
+};
+
+static struct log_listeners *raw_callb = NULL;
+static int raw_callb_length = 0; /* for reading without the array */
+/* the log_raw_push() calls in progress, by the parity of raw_callb_epoch */
+static unsigned long raw_callb_readers[2];
+static unsigned long raw_callb_epoch = 0;
+static pthread_mutex_t raw_callb_mutex = PTHREAD_MUTEX_INITIALIZER;
+static void log_raw_listen_set(struct log_listeners *l);
 
 static pthread_key_t lraw_bufs;
 static void lraw_bufs_cleanup(void *arg);
 
 /* misc */
 static time_t logstart;
+static struct timespec logbase; /* CLOCK_MONOTONIC at logstart */
+/* time of the first piece of the line being built in thbuf */
+static __thread unsigned long long thtime;
+/* fields of the line log_kv() is processing */
+static __thread const struct log_fields *thfields;
+static size_t log_async_memcnt();
+static size_t log_bin_memcnt();
+static size_t log_level_memcnt();
+static size_t log_mmap_memcnt();
+static size_t log_stats_memcnt();
+static size_t log_crash_memcnt();
+static size_t log_lz_memcnt();
+static size_t log_sock_memcnt();
+static void log_stats_free();
+static void log_crash_disable();
+struct log_flight_rec;
+static struct log_flight_rec *lflight_a;
+static void log_flight_record(const struct log_line *ln, int count);
+static void log_mmap_rmall();
+static void log_lz_rmall();
+static void log_sock_rmall();
+static void log_lz_flush();
+static void log_sock_flush();
+static void log_crash_write(int fd, const char *s, size_t length);
+static void log_level_changed();
+static void log_level_free();
+static int log_lvlmcro(const char *lvlmcro);
 
 static void logfile_rmall();
+static void logfile_flushall();
+static void logfile_flusher_stop();
 static int logfile_add(FILE *f, int flags);
 static int logfile_rm(int id);
-static void logfile_callback(const char *str, int length);
+static void logfile_callback(const struct log_line *ln, int count);
+static int log_sgr_strip(char *dst, const char *src, int length);
+
+/* size of the batch buffers and the age at which a batch is written */
+#define LOGFILE_BATCH (1 << 16)
+#define LOGFILE_BATCH_NS (50 * 1000 * 1000ull)
 
+/**
+ * struct logfile - a text log file
+ * @flags:	&enum log_file_flags
+ * @lvl:	the threshold level character
+ * @f:		the file, written to through @fd bypassing its stdio buffer
+ * @fd:		file descriptor of @f
+ * @tty:	whether @f is a terminal, then the lines aren't held back
+ * @batch:	lines not yet written, allocated on first use
+ * @batch_length: length of @batch
+ * @batch_time:	time of the oldest line in @batch
+ * @wrlock:	guards the writes and @batch
+ */
 struct logfile {
 	unsigned int flags;
+	int lvl;
 	FILE *f;
+	int fd;
+	bool tty;
+	char *batch;
+	int batch_length;
+	unsigned long long batch_time;
 	pthread_mutex_t wrlock;
 };
 
@@ -43,8 +126,19 @@ static struct logfile *lfile_a = NULL;
 static int lfile_length = 0;
 static int lfile_size = 3;
 static int lfile_sgr_filter_users = 0;
+static int lfile_json_users = 0;
 static pthread_rwlock_t lfile_rwlock = PTHREAD_RWLOCK_INITIALIZER;
 
+/*
+ * The thread writing out the batches that have aged while no more lines
+ * came, started with the first batch held back.
+ */
+static pthread_t lflush_thread;
+static pthread_mutex_t lflush_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t lflush_wake = PTHREAD_COND_INITIALIZER;
+static int lflush_state = 0; /* 1 running, -1 stopped or failed to start */
+static bool lflush_pending = false; /* a batch was started since the scan */
+
 /**
  * A buffer for processing raw log messages before they will be written to
  * stdout/stderr and specified files.
@@ -55,6 +149,18 @@ static __thread struct xf_strb *thbuf = NULL;
  * respective files. Constructed and destructed at the same place as thbuf.
  */
 static __thread struct xf_strb *lfbuf = NULL;
+/**
+ * The lines log_raw_stamp() passes on, grown as needed and released with
+ * thbuf.
+ */
+static __thread struct log_line *thlines = NULL;
+static __thread int thlines_size = 0;
+/**
+ * The lfbuf contents without the escape sequences for the
+ * %LOGFILE_FILTER_SGR files, released with thbuf.
+ */
+static __thread char *sgrbuf = NULL;
+static __thread int sgrbuf_size = 0;
 
 /*
  * Standard output select.
@@ -65,16 +171,31 @@ static bool logstderr = true;
 size_t ce_log_memcnt()
 {
 	size_t cnt = 0;
-	if (raw_callb_a)
-		cnt += raw_callb_size * sizeof(raw_callb_a[0]);
+	pthread_mutex_lock(&raw_callb_mutex);
+	if (raw_callb)
+		cnt += sizeof(*raw_callb)
+			+ raw_callb->length * sizeof(raw_callb->a[0]);
+	pthread_mutex_unlock(&raw_callb_mutex);
+	pthread_rwlock_rdlock(&lfile_rwlock);
+	for (int i = 0; i < lfile_length; i++)
+		cnt += lfile_a[i].batch ? LOGFILE_BATCH : 0;
+	pthread_rwlock_unlock(&lfile_rwlock);
+	cnt += log_async_memcnt();
+	cnt += log_bin_memcnt();
+	cnt += log_level_memcnt();
+	cnt += log_mmap_memcnt();
+	cnt += log_stats_memcnt();
+	cnt += log_crash_memcnt();
+	cnt += log_lz_memcnt();
+	cnt += log_sock_memcnt();
 	return cnt;
 }
 
 __attribute__((constructor(110))) static void log_init()
 {
 	/* raw */
-	raw_callb_a = malloc(sizeof(raw_callb_a[0]) * raw_callb_size);
 	logstart = time(NULL);
+	clock_gettime(CLOCK_MONOTONIC, &logbase);
 	pthread_key_create(&lraw_bufs, lraw_bufs_cleanup);
 	/* txt */
 	lfile_a = malloc(sizeof(lfile_a[0]) * lfile_size);
@@ -85,8 +206,14 @@ __attribute__((constructor(110))) static void log_init()
 
 __attribute__((destructor(110))) static void log_exit()
 {
+	log_crash_disable();
+	log_async_stop();
 	lputs(INF "Logging end reached.");
 	/* txt */
+	log_mmap_rmall();
+	log_lz_rmall();
+	log_sock_rmall();
+	logfile_flusher_stop();
 	logfile_rmall();
 	log_raw_listen_rm(logfile_callback);
 	pthread_rwlock_wrlock(&lfile_rwlock);
@@ -96,105 +223,248 @@ __attribute__((destructor(110))) static void log_exit()
 	pthread_rwlock_unlock(&lfile_rwlock);
 	/* raw */
 	pthread_key_delete(lraw_bufs);
-	free(raw_callb_a);
+	pthread_mutex_lock(&raw_callb_mutex);
+	log_raw_listen_set(NULL);
+	pthread_mutex_unlock(&raw_callb_mutex);
+	log_bin_close();
+	log_level_free();
+	log_stats_free();
 }
 
 /**
- * log_raw_listen_add() - listen in on logs
- * @callb:	callback to call when new logs are appended
+ * log_raw_listen_sync() - wait for the log_raw_push() calls in progress
  *
- * A line in the log follows the format - "3f:origin.c~3:5:Hello world!\n".
- * The "3f" is hexadecimal encoded seconds since the beginning of the program,
- * "ce-origin.c~3" is the origin of the log, "5" stands for error level(%DBG)
- * where a smaller number is of more importance or a more important message,
- * these follow the format specified in ce-aux.h.
+ * Those that start later see what was published before, so flipping the
+ * epoch and waiting for the readers of the old one twice covers the readers
+ * that got the epoch before the first flip but counted themselves after.
+ * Called with raw_callb_mutex held.
+ */
+static void log_raw_listen_sync()
+{
+	for (int i = 0; i < 2; i++) {
+		unsigned long e = __atomic_fetch_add(&raw_callb_epoch, 1,
+				__ATOMIC_SEQ_CST);
+		while (__atomic_load_n(&raw_callb_readers[e & 1],
+					__ATOMIC_SEQ_CST))
+			sched_yield();
+	}
+}
+
+/**
+ * log_raw_listen_set() - publish the listeners and free the old ones
+ * @l:		the new listeners, %NULL for none
  *
- * Note that the origin part may be overridden to anything that doesn't contain
- * '\0' and ':' characters.
+ * Called with raw_callb_mutex held.
  */
-void log_raw_listen_add(void (*callb)(const char *str, int length))
+static void log_raw_listen_set(struct log_listeners *l)
 {
-	if (raw_callb_length + 1 > raw_callb_size) {
-		raw_callb_size *= 2;
-		raw_callb_a = realloc(raw_callb_a, sizeof(raw_callb_a[0])
-				* raw_callb_size);
+	struct log_listeners *old = __atomic_exchange_n(&raw_callb, l,
+			__ATOMIC_SEQ_CST);
+	__atomic_store_n(&raw_callb_length, l ? l->length : 0,
+			__ATOMIC_RELAXED);
+	log_raw_listen_sync();
+	free(old);
+}
+
+void log_raw_listen_add(void (*callb)(const struct log_line *ln, int count))
+{
+	pthread_mutex_lock(&raw_callb_mutex);
+	int length = raw_callb ? raw_callb->length : 0;
+	struct log_listeners *l = malloc(sizeof(*l)
+			+ (length + 1) * sizeof(l->a[0]));
+	assert(l);
+	if (length)
+		memcpy(l->a, raw_callb->a, length * sizeof(l->a[0]));
+	l->a[length] = callb;
+	l->length = length + 1;
+	log_raw_listen_set(l);
+	pthread_mutex_unlock(&raw_callb_mutex);
+	log_level_changed();
+}
+
+int log_raw_listen_rm(void (*callb)(const struct log_line *ln, int count))
+{
+	pthread_mutex_lock(&raw_callb_mutex);
+	int length = raw_callb ? raw_callb->length : 0;
+	int i;
+	for (i = 0; i < length && raw_callb->a[i] != callb; i++);
+	if (i == length) {
+		pthread_mutex_unlock(&raw_callb_mutex);
+		return 1;
 	}
-	raw_callb_a[raw_callb_length] = callb;
-	raw_callb_length++;
+	struct log_listeners *l = malloc(sizeof(*l)
+			+ (length - 1) * sizeof(l->a[0]));
+	assert(l);
+	memcpy(l->a, raw_callb->a, i * sizeof(l->a[0]));
+	memcpy(l->a + i, raw_callb->a + i + 1,
+			(length - i - 1) * sizeof(l->a[0]));
+	l->length = length - 1;
+	log_raw_listen_set(l);
+	pthread_mutex_unlock(&raw_callb_mutex);
+	log_level_changed();
+	return 0;
 }
 
 /**
- * log_raw_listen_rm() - remove a listening callback
- * @callb:	callback to remove
+ * log_raw_push() - passes the new logs to the log_raw_listen_add() callbacks
+ * @ln:		the lines to push
+ * @count:	count of @ln
  *
- * Return:	0 on success
+ * Takes no lock: counts itself in with the readers of the current epoch for
+ * log_raw_listen_sync() to wait for.
+ */
+static void log_raw_push(const struct log_line *ln, int count)
+{
+	unsigned long e = __atomic_load_n(&raw_callb_epoch, __ATOMIC_SEQ_CST)
+		& 1;
+	__atomic_fetch_add(&raw_callb_readers[e], 1, __ATOMIC_SEQ_CST);
+	struct log_listeners *l = __atomic_load_n(&raw_callb,
+			__ATOMIC_SEQ_CST);
+	for (int i = 0; l && i < l->length; i++)
+		l->a[i](ln, count);
+	__atomic_fetch_sub(&raw_callb_readers[e], 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * log_line_parse() - split a line into its header fields
+ * @ln:		the line to fill, the time is left as is
+ * @s:		the line, "file+line:lvl:body\n"
+ * @length:	length of @s including the '\n'
  *
- *		1 when such callback is not listed
+ * Return:	false if the line has no valid header
  */
-int log_raw_listen_rm(void (*callb)(const char *str, int length))
-{
-	for (int i = 0; i < raw_callb_length; i++) {
-		if (raw_callb_a[i] != callb) continue;
-		/* 010 */
-		memmove(raw_callb_a + i, raw_callb_a + i + 1,
-				sizeof(raw_callb_a[0])
-				* (raw_callb_length - i - 1));
-		raw_callb_length--;
-		return 0;
-	}
-	return 1;
+static bool log_line_parse(struct log_line *ln, const char *s, int length)
+{
+	const char *c = memchr(s, ':', length);
+	if (!c || c + 3 > s + length || c[1] < '1' || c[1] > '5'
+			|| c[2] != ':')
+		return false;
+	ln->origin = s;
+	ln->origin_len = c - s;
+	ln->lvl = c[1];
+	ln->body = c + 3;
+	ln->body_len = s + length - (c + 3);
+	ln->fields = NULL;
+	return true;
 }
 
 /**
- * log_raw_push() - passes the new logs to log_raw_readcb fncs
- * @s:		the lines to push, the each line beginning in the string must
- *		start with a header ('time:file+line:lvl:') and the string must
- *		end with a newline character
- * @length:	the length of @s to push, ending with a '\n' rather than a
- *		%NULL char
+ * thlines_reserve() - make room for lines in thlines
+ * @count:	count of lines needed
  */
-static void log_raw_push(const char *s, int length)
+static void thlines_reserve(int count)
 {
-	for (int i = 0; i < raw_callb_length; i++)
-		raw_callb_a[i](s, length);
+	if (count <= thlines_size)
+		return;
+	do {
+		thlines_size = thlines_size ? thlines_size * 2 : 16;
+	} while (count > thlines_size);
+	thlines = realloc(thlines, thlines_size * sizeof(thlines[0]));
+	assert(thlines);
 }
 
 /**
- * log_raw_process() - processes the newly added lines
- * @inp_buf:	line(s) to append to the log, note that the contents of the
- *		strbuf may change
+ * log_raw_stamp() - processes the newly added lines
+ * @s:		line(s) to append to the log
+ * @length:	length of @s
+ * @t:		nanoseconds since logstart to stamp the lines with
+ * @fields:	fields of the last line or %NULL
  *
- * Adds timestamps to the lines and ensures line header consistency and then
- * pushes the resulting lines to the log.
+ * Splits the complete lines into &struct log_line, stamps them and pushes
+ * them to the log. A line without a valid header is logged with a warning
+ * about it.
+ *
+ * Return:	the length of @s up to and including the last '\n'
  */
-static void log_raw_process(struct xf_strb *msg)
+static int log_raw_stamp(const char *s, int length, unsigned long long t,
+		const struct log_fields *fields)
 {
-	int i = 0, line = 0;
-	int e;
-	for (i += 0; i < msg->length - 1; i++) {
-		if (msg->a[i] != '\n')
-			continue;
-		/* Check the line header */
-		for (e = line; e < i && msg->a[e] != ':'; e++); /* file/line */
-		time_t ct = time(NULL) - logstart;
-		if (msg->a[e] == ':' && msg->a[e + 1] >= '1'
-				&& msg->a[e + 1] <= '5'
-				&& msg->a[e + 2] == ':') {
-			i += xf_strb_insertf(msg, line, "%llx:",
-					(long long unsigned) ct);
-		} else {
-			i += xf_strb_insertf(msg, line,
-					"%llx:"DBG"((missing log line header))\n"
-					"%llx:unknown+33:2:",
-					(long long unsigned) ct,
-					(long long unsigned) ct);
+	static const char missing[] = LOG_LINE_MISSING;
+	const char *line = s, *nl, *end = s + length;
+	int count = 0;
+	while (line < end && (nl = memchr(line, '\n', end - line))) {
+		thlines_reserve(count + 2);
+		struct log_line *ln = thlines + count;
+		if (!log_line_parse(ln, line, nl + 1 - line)) {
+			log_line_parse(ln, missing, sizeof(missing) - 1);
+			ln->time = t;
+			ln++;
+			count++;
+			ln->origin = LOG_LINE_UNKNOWN;
+			ln->origin_len = sizeof(LOG_LINE_UNKNOWN) - 1;
+			ln->lvl = '2';
+			ln->body = line;
+			ln->body_len = nl + 1 - line;
+			ln->fields = NULL;
 		}
-		line = i + 1;
-		assert(msg->a[i] == '\n'); /**/
+		ln->time = t;
+		count++;
+		line = nl + 1;
 	}
+	if (count && fields)
+		thlines[count - 1].fields = fields;
+	if (count && __atomic_load_n(&lflight_a, __ATOMIC_RELAXED))
+		log_flight_record(thlines, count);
+	if (count)
+		log_raw_push(thlines, count);
+	return line - s;
+}
+
+/**
+ * log_thread_init() - construct the calling thread's buffers
+ */
+static void log_thread_init()
+{
+	void *val = pthread_getspecific(lraw_bufs);
+	assert(!val);
+	struct xf_strb *bufs = malloc(sizeof(struct xf_strb) * 2);
+	thbuf = bufs;
+	lfbuf = bufs + 1;
+	xf_strb_construct(thbuf, 24);
+	xf_strb_construct(lfbuf, 24);
+	assert(thbuf->a);
+	pthread_setspecific(lraw_bufs, bufs);
+}
+
+/**
+ * log_now() - get the time to stamp a message with
+ *
+ * Return:	nanoseconds since logstart on the monotonic clock
+ */
+static inline unsigned long long log_now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (unsigned long long) (ts.tv_sec - logbase.tv_sec) * 1000000000
+		+ ts.tv_nsec - logbase.tv_nsec;
+}
+
+#include "log-kv.c"
+#include "log-async.c"
+#include "log-bin.c"
+#include "log-level.c"
+#include "log-mmap.c"
+#include "log-lzfile.c"
+#include "log-sock.c"
+#include "log-stats.c"
+#include "log-crash.c"
+
+/**
+ * log_raw_process() - passes the complete lines in a buffer on
+ * @msg:	line(s) to append to the log; the complete lines are removed
+ *
+ * The lines are stamped and pushed right away or, in asynchronous mode,
+ * queued for the writer thread.
+ */
+static void log_raw_process(struct xf_strb *msg)
+{
+	int line;
+	for (line = msg->length - 2; line >= 0 && msg->a[line] != '\n'; line--);
+	line++;
 	if (!line)
 		return;
-	log_raw_push(msg->a, line);
+	if (log_async_queue(msg->a, line, thtime, thfields) < 0)
+		log_raw_stamp(msg->a, line, thtime, thfields);
 	memmove(msg->a, msg->a + line, msg->length - line);
 	msg->length = msg->length - line;
 }
@@ -203,137 +473,416 @@ static void lraw_bufs_cleanup(void *arg)
 {
 	assert(arg == thbuf);
 	struct xf_strb *bufs = arg;
+	log_ring_release();
+	log_bin_thread_release();
+	free(thlines);
+	thlines = NULL;
+	thlines_size = 0;
+	free(sgrbuf);
+	sgrbuf = NULL;
+	sgrbuf_size = 0;
 	xf_strb_destruct(bufs);
 	xf_strb_destruct(bufs + 1);
 	free(bufs);
 }
 
-int lprintf(const char *format, ...)
+int (lprintf)(const char *format, ...)
 {
-	if (!thbuf) {
-		void *val = pthread_getspecific(lraw_bufs);
-		assert(!val);
-		struct xf_strb *bufs = malloc(sizeof(struct xf_strb) * 2);
-		thbuf = bufs;
-		lfbuf = bufs + 1;
-		xf_strb_construct(thbuf, 24);
-		xf_strb_construct(lfbuf, 24);
-		assert(thbuf->a);
-		pthread_setspecific(lraw_bufs, bufs);
-	}
+	struct log_site *site = log_site_cur;
+	log_site_cur = NULL;
+	bool stat = site && __atomic_load_n(&lstat_on, __ATOMIC_RELAXED);
+	if (!thbuf)
+		log_thread_init();
+	unsigned long long t = log_now();
+	if (thbuf->length <= 1) /* no partial line pending */
+		thtime = t;
 	va_list l;
+	if (__atomic_load_n(&bin_on, __ATOMIC_ACQUIRE)) {
+		va_start(l, format);
+		bool only = log_bin_vprintf(format, l, t);
+		va_end(l);
+		if (only) {
+			if (stat)
+				log_stat_add(site, 0, 0, log_now() - t);
+			return 0;
+		}
+	}
 	va_start(l, format);
 	int r = xf_strb_vappendf(thbuf, format, l);
 	va_end(l);
+	unsigned long long tf = stat ? log_now() : 0;
 
 	log_raw_process(thbuf);
+	if (stat)
+		log_stat_add(site, r, tf - t, log_now() - tf);
 	return r;
 }
 
-int lputs(const char *str)
+int (lputs)(const char *str)
 {
-	if (!thbuf) {
-		void *val = pthread_getspecific(lraw_bufs);
-		assert(!val);
-		struct xf_strb *bufs = malloc(sizeof(struct xf_strb) * 2);
-		thbuf = bufs;
-		lfbuf = bufs + 1;
-		xf_strb_construct(thbuf, 24);
-		xf_strb_construct(lfbuf, 24);
-		assert(thbuf->a);
-		pthread_setspecific(lraw_bufs, bufs);
+	struct log_site *site = log_site_cur;
+	log_site_cur = NULL;
+	bool stat = site && __atomic_load_n(&lstat_on, __ATOMIC_RELAXED);
+	if (!thbuf)
+		log_thread_init();
+	unsigned long long t = log_now();
+	if (thbuf->length <= 1) /* no partial line pending */
+		thtime = t;
+	if (__atomic_load_n(&bin_on, __ATOMIC_ACQUIRE) && log_bin_puts(str, t)) {
+		if (stat)
+			log_stat_add(site, 0, 0, log_now() - t);
+		return 0;
 	}
 	int c = xf_strb_append(thbuf, str);
 	c += xf_strb_append(thbuf, "\n");
+	unsigned long long tf = stat ? log_now() : 0;
 
 	log_raw_process(thbuf);
+	if (stat)
+		log_stat_add(site, c, tf - t, log_now() - tf);
 
 	return c;
 }
 
-
-/* handle some output methods */
-static int err_thres =
-#ifdef NDEBUG
-'2'; /* default WRN */
-#else
-'5'; /* debug DBG */
-#endif
-
-void log_stderr_threshold(const char *lvlmcro)
+int log_kv(const char *msg, const struct log_field *fields, int count)
 {
-	assert(lvlmcro != NULL);
-	int offs = sizeof(DBG) - 3;
-	lvlmcro += offs;
-	assert(*lvlmcro >= '1' && '5' >= *lvlmcro);
-	err_thres = *lvlmcro;
+	struct log_site *site = log_site_cur;
+	log_site_cur = NULL;
+	bool stat = site && __atomic_load_n(&lstat_on, __ATOMIC_RELAXED);
+	if (!thbuf)
+		log_thread_init();
+	unsigned long long t = log_now();
+	if (thbuf->length <= 1) /* no partial line pending */
+		thtime = t;
+	if (__atomic_load_n(&bin_on, __ATOMIC_ACQUIRE)
+			&& log_bin_kv(msg, fields, count, t)) {
+		if (stat)
+			log_stat_add(site, 0, 0, log_now() - t);
+		return 0;
+	}
+	int r = xf_strb_append(thbuf, msg);
+	/* the line may have begun with pieces before, measure from its start */
+	struct log_line ln = { .body = thbuf->a };
+	log_line_parse(&ln, thbuf->a, thbuf->length - 1);
+	struct log_fields fl = {
+		.msg_len = thbuf->a + thbuf->length - 1 - ln.body,
+		.count = count,
+		.a = fields,
+	};
+	r += log_fields_text(thbuf, fields, count);
+	r += xf_strb_append(thbuf, "\n");
 
+	unsigned long long tf = stat ? log_now() : 0;
+
+	thfields = &fl;
+	log_raw_process(thbuf);
+	thfields = NULL;
+	if (stat)
+		log_stat_add(site, r, tf - t, log_now() - tf);
+	return r;
 }
 
-static void logfile_callback(const char *str, int length)
+
+/* handle some output methods */
+void log_stderr_threshold(const char *lvlmcro)
 {
-	static const char chrlvl[5][sizeof(lF_RED "ERR" _lF ": ")] = {
-		lF_RED "ERR" _lF ": ",
-		lF_YELW "WRN" _lF ": ",
-		lF_BLUE "INF" _lF ": ",
-		lF_WHI "TXT" _lF ": ",
-		lF_CYA "DBG" _lF ": "
-	};
-	int i, y;
-	unsigned int tstmp;
-	char bufr[81];
-	for (i = 0; i < length; i++) {
-		sscanf(str + i, "%x:%80[^:]", &tstmp, bufr);
-		for (i += 0; str[i] != ':'; i++); /* skip time */
-		for (i += 1; str[i] != ':'; i++); /* skip name~line */
+	log_txt_file_threshold(logstd_id, lvlmcro);
+}
 
-		i++; /* jump over the ':' onto lvl */
-		y = i;
+#include "log-sgr.c"
 
-		for (i++; str[i] != '\n' && i < length; i++);
+/**
+ * logfile_flush() - write the batch of a file out
+ * @lf:		the file, @lf->wrlock held
+ * @s:		text to write after the batch, bypassing it, or %NULL
+ * @length:	length of @s
+ *
+ * The batch and @s go out in a single writev(). Write errors drop the text.
+ */
+static void logfile_flush(struct logfile *lf, const char *s, int length)
+{
+	struct iovec iov[2], *v = iov;
+	int n = 0;
+	if (lf->batch_length) {
+		iov[n].iov_base = lf->batch;
+		iov[n++].iov_len = lf->batch_length;
+	}
+	if (s && length) {
+		iov[n].iov_base = (void *) s;
+		iov[n++].iov_len = length;
+	}
+	fflush(lf->f); /* anything printed to it directly goes first */
+	while (n > 0) {
+		ssize_t w = writev(lf->fd, v, n);
+		if (w < 0 && errno == EINTR)
+			continue;
+		if (w < 0)
+			break;
+		for (; n > 0 && w >= v->iov_len; v++, n--)
+			w -= v->iov_len;
+		if (n) {
+			v->iov_base = (char *) v->iov_base + w;
+			v->iov_len -= w;
+		}
+	}
+	lf->batch_length = 0;
+}
 
-		xf_strb_appendf(lfbuf, "[%3u] "lF_WHI"%16s"_lF" %s%.*s",
-				tstmp, bufr, chrlvl[str[y]-'1'],
-				(i + 1) - (y + 2), str + y + 2);
+/**
+ * logfile_append() - add lines to the batch of a file
+ * @lf:		the file, @lf->wrlock held
+ * @s:		the lines
+ * @length:	length of @s
+ * @t:		time of the lines
+ */
+static void logfile_append(struct logfile *lf, const char *s, int length,
+		unsigned long long t)
+{
+	if (lf->batch_length + length > LOGFILE_BATCH) {
+		logfile_flush(lf, s, length);
+		return;
 	}
+	if (!lf->batch) {
+		lf->batch = malloc(LOGFILE_BATCH);
+		assert(lf->batch);
+	}
+	if (!lf->batch_length)
+		lf->batch_time = t;
+	memcpy(lf->batch + lf->batch_length, s, length);
+	lf->batch_length += length;
+}
 
+/**
+ * logfile_flushaged() - write the batches older than %LOGFILE_BATCH_NS out
+ *
+ * Return:	nanoseconds until the oldest batch left is due, %0 if none is
+ *		left
+ */
+static unsigned long long logfile_flushaged()
+{
+	unsigned long long due = 0;
 	pthread_rwlock_rdlock(&lfile_rwlock);
-	for (i = 0; i < lfile_length; i++) {
-		struct logfile *lf = lfile_a + i;
-		if (!lf->f || (lf->flags & LOGFILE_FILTER_SGR))
-			continue;
+	unsigned long long t = log_now();
+	for (int y = 0; y < lfile_length; y++) {
+		struct logfile *lf = lfile_a + y;
 		pthread_mutex_lock(&lf->wrlock);
-		fwrite(lfbuf->a, 1, lfbuf->length - 1, lf->f);
+		if (lf->f && lf->batch_length) {
+			unsigned long long age = t - lf->batch_time;
+			if (age >= LOGFILE_BATCH_NS)
+				logfile_flush(lf, NULL, 0);
+			else if (!due || LOGFILE_BATCH_NS - age < due)
+				due = LOGFILE_BATCH_NS - age;
+		}
 		pthread_mutex_unlock(&lf->wrlock);
 	}
-	y = lfile_sgr_filter_users;
 	pthread_rwlock_unlock(&lfile_rwlock);
+	return due;
+}
 
-	if (!y) {
-		xf_strb_clear(lfbuf);
-		return;
+static void *logfile_flusher(void *nothing)
+{
+	assert(nothing == NULL); /* As passed from pthread_create */
+	bool held = false;
+	pthread_mutex_lock(&lflush_mutex);
+	while (lflush_state > 0) {
+		if (!held && !lflush_pending) {
+			pthread_cond_wait(&lflush_wake, &lflush_mutex);
+			continue;
+		}
+		lflush_pending = false;
+		pthread_mutex_unlock(&lflush_mutex);
+		unsigned long long due = logfile_flushaged();
+		pthread_mutex_lock(&lflush_mutex);
+		held = due != 0;
+		if (!held || lflush_state <= 0)
+			continue;
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		due += ts.tv_nsec;
+		ts.tv_sec += due / (1000 * 1000 * 1000);
+		ts.tv_nsec = due % (1000 * 1000 * 1000);
+		pthread_cond_timedwait(&lflush_wake, &lflush_mutex, &ts);
 	}
+	pthread_mutex_unlock(&lflush_mutex);
+	return NULL;
+}
+
+/**
+ * logfile_flusher_wake() - have a batch just started written out once aged
+ *
+ * Starts the flusher thread on first use. Called without a @wrlock held, the
+ * failure to start isn't logged as that would come back here.
+ */
+static void logfile_flusher_wake()
+{
+	pthread_mutex_lock(&lflush_mutex);
+	if (!lflush_state)
+		lflush_state = pthread_create(&lflush_thread, NULL,
+				logfile_flusher, NULL) ? -1 : 1;
+	lflush_pending = true;
+	pthread_cond_signal(&lflush_wake);
+	pthread_mutex_unlock(&lflush_mutex);
+}
+
+/**
+ * logfile_flusher_stop() - stop the flusher thread for good
+ *
+ * The batches left are written out by logfile_rmall().
+ */
+static void logfile_flusher_stop()
+{
+	pthread_mutex_lock(&lflush_mutex);
+	bool running = lflush_state > 0;
+	lflush_state = -1;
+	pthread_cond_signal(&lflush_wake);
+	pthread_mutex_unlock(&lflush_mutex);
+	if (running)
+		pthread_join(lflush_thread, NULL);
+}
 
-	for (i = 0; i < length; i++) {
-		if (str[i] != '\x1b' || str[i + 1] != '[')
+/**
+ * logfile_write() - write formatted lines to the log files
+ * @buf:	the formatted lines
+ * @length:	length of @buf
+ * @ln:		the lines formatted, for their levels
+ * @count:	count of @ln
+ * @maxlvl:	the least important level in @ln
+ * @form:	%LOGFILE_FILTER_SGR or %LOGFILE_JSON to write to the files of
+ *		that form, else %0
+ *
+ * Files whose threshold is below @maxlvl get the lines one by one. The lines
+ * are batched, a batch is written when it's full, older than
+ * %LOGFILE_BATCH_NS, holds an %ERR line or goes to a terminal. A batch aging
+ * with no more lines coming is written by the flusher thread. Called with
+ * @lfile_rwlock held.
+ */
+static void logfile_write(const char *buf, int length,
+		const struct log_line *ln, int count, int maxlvl, int form)
+{
+	bool err = false, started = false;
+	for (int i = 0; i < count; i++)
+		err |= ln[i].lvl == '1';
+	unsigned long long t = ln[count - 1].time;
+	for (int y = 0; y < lfile_length; y++) {
+		struct logfile *lf = lfile_a + y;
+		if (!lf->f || (lf->flags & (LOGFILE_FILTER_SGR | LOGFILE_JSON))
+				!= form)
 			continue;
-		y = i;
-		for (i += 2; str[i] != 'm'; i++);
-		xf_strb_delete(lfbuf, y, i - y);
+		pthread_mutex_lock(&lf->wrlock);
+		bool empty = !lf->batch_length;
+		if (maxlvl <= lf->lvl) {
+			logfile_append(lf, buf, length, ln[0].time);
+		} else {
+			const char *l = buf, *nl;
+			for (int i = 0; i < count; i++, l = nl + 1) {
+				nl = memchr(l, '\n', buf + length - l);
+				if (ln[i].lvl <= lf->lvl)
+					logfile_append(lf, l, nl + 1 - l,
+							ln[i].time);
+			}
+		}
+		if (lf->batch_length && (lf->tty || err
+				|| t - lf->batch_time >= LOGFILE_BATCH_NS))
+			logfile_flush(lf, NULL, 0);
+		started |= empty && lf->batch_length;
+		pthread_mutex_unlock(&lf->wrlock);
 	}
+	if (started)
+		logfile_flusher_wake();
+}
 
+/**
+ * logfile_flushall() - write the batches of all files out
+ */
+static void logfile_flushall()
+{
 	pthread_rwlock_rdlock(&lfile_rwlock);
-	for (i = 0; i < lfile_length; i++) {
-		struct logfile *lf = lfile_a + i;
-		if (!lf->f || !(lf->flags & LOGFILE_FILTER_SGR))
-			continue;
+	for (int y = 0; y < lfile_length; y++) {
+		struct logfile *lf = lfile_a + y;
 		pthread_mutex_lock(&lf->wrlock);
-		fwrite(lfbuf->a, 1, lfbuf->length - 1, lf->f);
+		if (lf->f && lf->batch_length)
+			logfile_flush(lf, NULL, 0);
 		pthread_mutex_unlock(&lf->wrlock);
 	}
 	pthread_rwlock_unlock(&lfile_rwlock);
 }
 
+void log_flush()
+{
+	if (__atomic_load_n(&async_on, __ATOMIC_ACQUIRE) && !async_bypass)
+		log_async_sync();
+	logfile_flushall();
+	log_lz_flush();
+	log_sock_flush();
+}
+
+static void logfile_callback(const struct log_line *ln, int count)
+{
+	static const char chrlvl[5][sizeof(lF_RED "ERR" _lF ": ")] = {
+		lF_RED "ERR" _lF ": ",
+		lF_YELW "WRN" _lF ": ",
+		lF_BLUE "INF" _lF ": ",
+		lF_WHI "TXT" _lF ": ",
+		lF_CYA "DBG" _lF ": "
+	};
+	int i, maxlvl = '1', sgr, json;
+	xf_strb_clear(lfbuf);
+	for (i = 0; i < count; i++) {
+		if (ln[i].lvl > maxlvl)
+			maxlvl = ln[i].lvl;
+		xf_strb_appendf(lfbuf, "[%3u.%06u] "lF_WHI"%16.*s"_lF" %s%.*s",
+				(unsigned int) (ln[i].time / 1000000000),
+				(unsigned int) (ln[i].time / 1000 % 1000000),
+				ln[i].origin_len > 80 ? 80 : ln[i].origin_len,
+				ln[i].origin, chrlvl[ln[i].lvl - '1'],
+				ln[i].body_len, ln[i].body);
+	}
+
+	pthread_rwlock_rdlock(&lfile_rwlock);
+	logfile_write(lfbuf->a, lfbuf->length - 1, ln, count, maxlvl, 0);
+	sgr = lfile_sgr_filter_users;
+	json = lfile_json_users;
+	pthread_rwlock_unlock(&lfile_rwlock);
+	log_mmap_write(lfbuf->a, lfbuf->length - 1, ln, count, maxlvl, 0);
+
+	bool lz = __atomic_load_n(&llz_count, __ATOMIC_RELAXED);
+	bool sock = __atomic_load_n(&lsock_txt_users, __ATOMIC_RELAXED);
+	if (sgr || lz || sock
+			|| __atomic_load_n(&lmap_sgr_users, __ATOMIC_RELAXED)) {
+		if (sgrbuf_size < lfbuf->length) {
+			sgrbuf_size = lfbuf->length;
+			sgrbuf = realloc(sgrbuf, sgrbuf_size);
+			assert(sgrbuf);
+		}
+		int length = log_sgr_strip(sgrbuf, lfbuf->a, lfbuf->length - 1);
+
+		if (sgr) {
+			pthread_rwlock_rdlock(&lfile_rwlock);
+			logfile_write(sgrbuf, length, ln, count, maxlvl,
+					LOGFILE_FILTER_SGR);
+			pthread_rwlock_unlock(&lfile_rwlock);
+		}
+		log_mmap_write(sgrbuf, length, ln, count, maxlvl,
+				LOGFILE_FILTER_SGR);
+		if (lz)
+			log_lz_write(sgrbuf, length, ln, count, maxlvl);
+		if (sock)
+			log_sock_write(sgrbuf, length, ln, count, maxlvl, 0);
+	}
+	if (json || __atomic_load_n(&lsock_json_users, __ATOMIC_RELAXED)) {
+		xf_strb_clear(lfbuf);
+		for (i = 0; i < count; i++)
+			log_json_line(lfbuf, ln + i);
+		pthread_rwlock_rdlock(&lfile_rwlock);
+		logfile_write(lfbuf->a, lfbuf->length - 1, ln, count, maxlvl,
+				LOGFILE_JSON);
+		pthread_rwlock_unlock(&lfile_rwlock);
+		log_sock_write(lfbuf->a, lfbuf->length - 1, ln, count, maxlvl,
+				LOGFILE_JSON);
+	}
+	xf_strb_clear(lfbuf);
+}
+
 /**
  * logfile_add() - add a file to log to
  * @f:		an open file handle to log to
@@ -345,7 +894,9 @@ static void logfile_callback(const char *str, int length)
 static int logfile_add(FILE *f, int flags)
 {
 	assert(f);
-	assert(!(~((~flags) | LOGFILE_FILTER_SGR | LOGFILE_AUTOCLOSE)));
+	assert(!(~((~flags) | LOGFILE_FILTER_SGR | LOGFILE_AUTOCLOSE
+					| LOGFILE_JSON)));
+	assert(!((flags & LOGFILE_FILTER_SGR) && (flags & LOGFILE_JSON)));
 
 	pthread_rwlock_wrlock(&lfile_rwlock);
 	int i;
@@ -364,11 +915,19 @@ static int logfile_add(FILE *f, int flags)
 	}
 	struct logfile *lf = lfile_a + i;
 	lf->flags = flags;
+	lf->lvl = '5';
 	lf->f = f;
+	lf->fd = fileno(f);
+	lf->tty = isatty(lf->fd);
+	lf->batch = NULL;
+	lf->batch_length = 0;
 	pthread_mutex_init(&lf->wrlock, NULL);
 
 	if ((flags & LOGFILE_FILTER_SGR))
 		lfile_sgr_filter_users++;
+	if ((flags & LOGFILE_JSON))
+		lfile_json_users++;
+	lfile_thres_update();
 	pthread_rwlock_unlock(&lfile_rwlock);
 	return i;
 }
@@ -388,11 +947,16 @@ static int logfile_rm(int id)
 	struct logfile *lf = lfile_a + id;
 	pthread_mutex_lock(&lf->wrlock);
 
+	logfile_flush(lf, NULL, 0);
+	free(lf->batch);
+	lf->batch = NULL;
 	if ((lf->flags & LOGFILE_AUTOCLOSE))
 		fclose(lf->f);
 
 	if ((lf->flags & LOGFILE_FILTER_SGR))
 		lfile_sgr_filter_users--;
+	if ((lf->flags & LOGFILE_JSON))
+		lfile_json_users--;
 
 	lf->f = NULL;
 	pthread_mutex_unlock(&lf->wrlock);
@@ -400,6 +964,7 @@ static int logfile_rm(int id)
 	if (id == lfile_length - 1)
 		lfile_length--;
 
+	lfile_thres_update();
 	pthread_rwlock_unlock(&lfile_rwlock);
 	return id;
 }
@@ -413,16 +978,23 @@ static void logfile_rmall()
 	for (int i = 0; i < lfile_length; i++) {
 		struct logfile *lf = lfile_a + i;
 		pthread_mutex_lock(&lf->wrlock);
+		if (lf->f)
+			logfile_flush(lf, NULL, 0);
+		free(lf->batch);
+		lf->batch = NULL;
 		if ((lf->flags & LOGFILE_AUTOCLOSE)) {
 			fclose(lf->f);
 		}
 		if ((lf->flags & LOGFILE_FILTER_SGR))
 			lfile_sgr_filter_users--;
+		if ((lf->flags & LOGFILE_JSON))
+			lfile_json_users--;
 		lf->f = NULL;
 		pthread_mutex_unlock(&lf->wrlock);
 		pthread_mutex_destroy(&lf->wrlock);
 	}
 	lfile_length = 0;
+	lfile_thres_update();
 	pthread_rwlock_unlock(&lfile_rwlock);
 }
 
@@ -436,10 +1008,40 @@ int log_txt_file_rm(int hndl)
 	return logfile_rm(hndl);
 }
 
+int log_txt_file_threshold(int hndl, const char *lvlmcro)
+{
+	int lvl = log_lvlmcro(lvlmcro);
+	pthread_rwlock_wrlock(&lfile_rwlock);
+	if (hndl < 0 || hndl >= lfile_length || !lfile_a[hndl].f) {
+		pthread_rwlock_unlock(&lfile_rwlock);
+		return -1;
+	}
+	lfile_a[hndl].lvl = lvl;
+	lfile_thres_update();
+	pthread_rwlock_unlock(&lfile_rwlock);
+	return hndl;
+}
+
 
 /* options */
 #include "ce-opt.h"
 
+/**
+ * logfile_std_switch() - replace the stderr/stdout log file per @logstderr
+ */
+static void logfile_std_switch()
+{
+	pthread_rwlock_rdlock(&lfile_rwlock);
+	int lvl = lfile_a[logstd_id].lvl;
+	pthread_rwlock_unlock(&lfile_rwlock);
+	logfile_rm(logstd_id);
+	logstd_id = logfile_add(logstderr ? stderr : stdout, 0);
+	pthread_rwlock_wrlock(&lfile_rwlock);
+	lfile_a[logstd_id].lvl = lvl;
+	lfile_thres_update();
+	pthread_rwlock_unlock(&lfile_rwlock);
+}
+
 static inline int log_optcb_stdout(const char *arg)
 { /* -o, --log-stdout [true/f] */
 	int b = optarg_bool(arg);
@@ -450,8 +1052,7 @@ static inline int log_optcb_stdout(const char *arg)
 		if (!logstderr)
 			return 0;
 		logstderr = false;
-		logfile_rm(logstd_id);
-		logstd_id = logfile_add(stdout, 0);
+		logfile_std_switch();
 		lputs(INF "Logging to stdout enabled.");
 		return 0;
 	}
@@ -459,27 +1060,286 @@ static inline int log_optcb_stdout(const char *arg)
 		lprintf(WRN "Logging output already set to "lF_YELW"%s"_lF".\n",
 				logstderr ? "stderr" : "stdout");
 	logstderr = !b;
-	logfile_rm(logstd_id);
-	logstd_id = logfile_add(logstderr ? stderr : stdout, 0);
+	logfile_std_switch();
 	lprintf(INF "Logging to "lF_BLUE"%s"_lF".\n",
 			logstderr ? "stderr" : "stdout");
 	return 0;
 }
 
+static inline int log_optcb_async(const char *arg)
+{ /* --log-async [block/drop/count] */
+	int policy;
+	if (arg == NULL || !strcmp(arg, "count")) {
+		policy = LOG_ASYNC_COUNT;
+	} else if (!strcmp(arg, "drop")) {
+		policy = LOG_ASYNC_DROP;
+	} else if (!strcmp(arg, "block")) {
+		policy = LOG_ASYNC_BLOCK;
+	} else {
+		lprintf(WRN "Invalid overflow policy '"lBLD_"%s"_lBLD"'\n", arg);
+		return -1;
+	}
+	if (log_async_start(policy, 0) < 0)
+		return 0;
+	lprintf(INF "Asynchronous logging enabled, overflow policy "
+			lF_BLUE"%s"_lF".\n", arg ? arg : "count");
+	return 0;
+}
+
+static inline int log_optcb_bin(const char *arg)
+{ /* --log-bin PATH */
+	if (log_bin_open(arg) < 0)
+		return 0;
+	lprintf(INF "Binary log "lF_BLUE"%s"_lF" opened.\n", arg);
+	return 0;
+}
+
+static inline int log_optcb_bin_text(const char *arg)
+{ /* --log-bin-text err/wrn/inf/txt/dbg */
+	int lvl = log_lvl_parse(arg, strlen(arg));
+	if (lvl < 0) {
+		lprintf(WRN "Invalid log level '"lBLD_"%s"_lBLD"', expected one "
+				"of err, wrn, inf, txt or dbg.\n", arg);
+		return -1;
+	}
+	bin_text_thres = lvl;
+	return 0;
+}
+
+static inline int log_optcb_level(const char *arg)
+{ /* --log-level [ORIGIN=]LVL[,...] */
+	static const char *lvlmcros[] = { ERR, WRN, INF, TXT, DBG };
+	const char *e, *eq;
+	for (; *arg; arg = *e ? e + 1 : e) {
+		for (e = arg; *e && *e != ','; e++);
+		for (eq = arg; eq < e && *eq != '='; eq++);
+		int lvl = eq < e ? log_lvl_parse(eq + 1, e - eq - 1)
+			: log_lvl_parse(arg, e - arg);
+		if (lvl < 0) {
+			lprintf(WRN "Invalid log level in '"lBLD_"%.*s"_lBLD
+					"', expected one of err, wrn, inf, txt "
+					"or dbg.\n", (int) (e - arg), arg);
+			return -1;
+		}
+		if (eq == e) {
+			log_level_set(lvlmcros[lvl - '1']);
+			continue;
+		}
+		char origin[eq - arg + 1];
+		memcpy(origin, arg, eq - arg);
+		origin[eq - arg] = '\0';
+		if (log_level_override(origin, lvlmcros[lvl - '1']) < 0) {
+			lprintf(WRN "Invalid log origin '"lBLD_"%s"_lBLD"'.\n",
+					origin);
+			return -1;
+		}
+	}
+	return 0;
+}
+
+static inline int log_optcb_std_level(const char *arg)
+{ /* --log-std-level err/wrn/inf/txt/dbg */
+	static const char *lvlmcros[] = { ERR, WRN, INF, TXT, DBG };
+	int lvl = log_lvl_parse(arg, strlen(arg));
+	if (lvl < 0) {
+		lprintf(WRN "Invalid log level '"lBLD_"%s"_lBLD"', expected one "
+				"of err, wrn, inf, txt or dbg.\n", arg);
+		return -1;
+	}
+	log_stderr_threshold(lvlmcros[lvl - '1']);
+	return 0;
+}
+
+static inline int log_optcb_mmap(const char *arg)
+{ /* --log-mmap PATH[,SIZE[,KEEP]] */
+	const char *c = strchr(arg, ',');
+	size_t limit = 4 << 20;
+	long keep = 3;
+	if (c) {
+		char *e;
+		unsigned long long l = strtoull(c + 1, &e, 10);
+		switch (*e) {
+			case 'G': l <<= 10; /* fall through */
+			case 'M': l <<= 10; /* fall through */
+			case 'K': l <<= 10; e++;
+		}
+		if (*e == ',')
+			keep = strtol(e + 1, &e, 10);
+		if (*e || !l || keep < 0) {
+			lprintf(WRN "Invalid size or count in '"lBLD_"%s"_lBLD
+					"'.\n", c + 1);
+			return -1;
+		}
+		limit = l;
+	}
+	int length = c ? c - arg : strlen(arg);
+	char path[length + 1];
+	memcpy(path, arg, length);
+	path[length] = '\0';
+	if (log_mmap_file_add(path, limit, keep, LOGFILE_FILTER_SGR) < 0) {
+		lprintf(ERR "Failed to map log file "lBLD_"%s"_lBLD".\n", path);
+		return 0;
+	}
+	lprintf(INF "Memory-mapped log "lF_BLUE"%s"_lF" opened, rotated at "
+			lF_BLUE"%zu"_lF" bytes.\n", path, limit);
+	return 0;
+}
+
+static inline int log_optcb_json(const char *arg)
+{ /* --log-json PATH */
+	FILE *f = fopen(arg, "w");
+	if (!f) {
+		lprintf(ERR "Failed to open JSON log "lBLD_"%s"_lBLD".\n", arg);
+		return 0;
+	}
+	logfile_add(f, LOGFILE_JSON | LOGFILE_AUTOCLOSE);
+	lprintf(INF "JSON log "lF_BLUE"%s"_lF" opened.\n", arg);
+	return 0;
+}
+
+static inline int log_optcb_stats(const char *arg)
+{ /* --log-stats */
+	log_stats_enable(1);
+	return 0;
+}
+
+static inline int log_optcb_lz(const char *arg)
+{ /* --log-lz PATH[,index] */
+	const char *c = strrchr(arg, ',');
+	int flags = 0;
+	if (c && !strcmp(c + 1, "index"))
+		flags = LOGFILE_INDEX;
+	int length = flags ? c - arg : strlen(arg);
+	char path[length + 1];
+	memcpy(path, arg, length);
+	path[length] = '\0';
+	if (log_lz_file_add(path, flags) < 0) {
+		lprintf(ERR "Failed to open compressed log "lBLD_"%s"_lBLD".\n",
+				path);
+		return 0;
+	}
+	lprintf(INF "Compressed log "lF_BLUE"%s"_lF" opened%s.\n", path,
+			flags ? " with an index" : "");
+	return 0;
+}
+
+static inline int log_optcb_sock(const char *arg)
+{ /* --log-sock PATH[,json] */
+	const char *c = strrchr(arg, ',');
+	int flags = 0;
+	if (c && !strcmp(c + 1, "json"))
+		flags = LOGFILE_JSON;
+	int length = flags ? c - arg : strlen(arg);
+	char path[length + 1];
+	memcpy(path, arg, length);
+	path[length] = '\0';
+	if (log_sock_add(path, flags) < 0) {
+		lprintf(ERR "Failed to add log socket "lBLD_"%s"_lBLD".\n",
+				path);
+		return 0;
+	}
+	lprintf(INF "Logging to socket "lF_BLUE"%s"_lF"%s.\n", path,
+			flags ? " as JSON" : "");
+	return 0;
+}
+
+static inline int log_optcb_crash(const char *arg)
+{ /* --log-crash [N[,LVL]] */
+	static const char *lvlmcros[] = { ERR, WRN, INF, TXT, DBG };
+	long records = 256;
+	int lvl = '5';
+	if (arg) {
+		char *e;
+		records = strtol(arg, &e, 10);
+		if (*e == ',')
+			lvl = log_lvl_parse(e + 1, strlen(e + 1));
+		if (e == arg || (*e && *e != ',') || records < 0 || lvl < 0) {
+			lprintf(WRN "Invalid record count or level '"lBLD_"%s"
+					_lBLD"'.\n", arg);
+			return -1;
+		}
+	}
+	if (log_crash_enable(records, lvlmcros[lvl - '1']) < 0) {
+		lputs(ERR "Failed to allocate the flight recorder.");
+		return 0;
+	}
+	lprintf(INF "Crash draining enabled, flight recorder of "lF_BLUE"%li"
+			_lF" lines.\n", records);
+	return 0;
+}
+
 static int log_optcb(int index, const char *optarg)
 {
 	switch (index) {
 		case 0: return log_optcb_stdout(optarg);
+		case 1: return log_optcb_async(optarg);
+		case 2: return log_optcb_bin(optarg);
+		case 3: return log_optcb_bin_text(optarg);
+		case 4: return log_optcb_mmap(optarg);
+		case 5: return log_optcb_json(optarg);
+		case 6: return log_optcb_stats(optarg);
+		case 7: return log_optcb_crash(optarg);
+		case 8: return log_optcb_lz(optarg);
+		case 9: return log_optcb_sock(optarg);
 	};
 	assert(1 == 3); /* this should not be reached */
 }
 
+static int log_level_optcb(int index, const char *optarg)
+{
+	assert(index == 0 || index == 1);
+	return index ? log_optcb_std_level(optarg) : log_optcb_level(optarg);
+}
+
 static struct optsection log_optsection = {
 	.label = "Logging:",
 	.callback = log_optcb,
 	.opt_a = {
 		{ ARG_OPTIONAL, 'o', "log-stdout", "f/true\t"
 			"Log to stdout instead of stderr." },
+		{ ARG_OPTIONAL, '\0', "log-async", "POLICY\t"
+			"Write logs from a background thread; when its queue "
+			"is full block, drop or count (default) messages." },
+		{ ARG_REQUIRED, '\0', "log-bin", "PATH\t"
+			"Record the logs unformatted to a binary file, see "
+			"logdec." },
+		{ ARG_REQUIRED, '\0', "log-bin-text", "LVL\t"
+			"With --log-bin, format only messages up to this "
+			"level (err, wrn, inf, txt, dbg) as text." },
+		{ ARG_REQUIRED, '\0', "log-mmap", "PATH[,SIZE[,KEEP]]\t"
+			"Log to a memory-mapped file, rotated at SIZE (4M) "
+			"keeping KEEP (3) old files." },
+		{ ARG_REQUIRED, '\0', "log-json", "PATH\t"
+			"Log to a file as JSON lines, with the fields of "
+			"structured messages as members." },
+		{ ARG_NONE, '\0', "log-stats", "\t"
+			"Count the messages, bytes and time spent per log call "
+			"site, reported at exit." },
+		{ ARG_OPTIONAL, '\0', "log-crash", "N[,LVL]\t"
+			"On a crash write out the lines held back and the last "
+			"N (256) lines up to LVL (dbg) logged." },
+		{ ARG_REQUIRED, '\0', "log-lz", "PATH[,index]\t"
+			"Log to a file compressed in seekable blocks, with "
+			"an index of them in PATH.idx, see logunz." },
+		{ ARG_REQUIRED, '\0', "log-sock", "PATH[,json]\t"
+			"Stream the logs to a collector on a Unix socket, "
+			"see logcollect." },
+		{ 0, '\0', NULL, NULL },
+	},
+};
+
+/* the levels, set again while running */
+static struct optsection log_level_optsection = {
+	.label = "Log levels:",
+	.callback = log_level_optcb,
+	.live = 1,
+	.opt_a = {
+		{ ARG_REQUIRED, '\0', "log-level", "[ORIGIN=]LVL,...\t"
+			"Log only messages up to this level, optionally only "
+			"for a source file or directory (glx/=dbg)." },
+		{ ARG_REQUIRED, '\0', "log-std-level", "LVL\t"
+			"Write only messages up to this level to stderr or "
+			"stdout." },
 		{ 0, '\0', NULL, NULL },
 	},
 };
@@ -488,12 +1348,15 @@ static struct optsection log_optsection = {
 static int log_opt_added = 0;
 static void __init log_init_argcb()
 {
-	log_opt_added = opt_add(ce_options, &log_optsection) >= 0;
+	log_opt_added = opt_add(ce_options, &log_optsection) >= 0
+		&& opt_add(ce_options, &log_level_optsection) >= 0;
 }
 
 static void __exit log_exit_argcb()
 {
-	if (log_opt_added)
+	if (log_opt_added) {
+		opt_rm(ce_options, &log_level_optsection);
 		opt_rm(ce_options, &log_optsection);
+	}
 }
 
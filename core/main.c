@@ -1,26 +1,208 @@
+/* required for sigaction and sockets with stdc99 */
+#define _POSIX_C_SOURCE 200809L
 #include "ce-aux.h"
 #include "ce-log.h"
 #include "ce-opt.h"
 #include "ce-mod.h"
+#include "ce-console.h"
+#include "ce-main.h"
 #include "xf-strb.h"
 #include <stddef.h> /* NULL */
 #include <stdlib.h> /* exit(), EXIT_SUCCESS */
 #include <stdint.h>
 #include <assert.h>
+#include <stdio.h> /* snprintf */
+#include <string.h> /* strerror */
+#include <errno.h>
+#include <stdbool.h>
+#include <signal.h> /* sigaction */
+#include <pthread.h>
+#include <poll.h>
+#include <unistd.h> /* pipe */
+#include <fcntl.h> /* O_NONBLOCK */
+#include <sys/socket.h>
+#include <sys/stat.h> /* chmod */
+#include <sys/un.h>
 
 
 int (*control)() = NULL;
+void (*control_wake)() = NULL;
 
 static char *load = NULL;
 static int check = 0;
 
+/* --live [PATH], --console */
+static bool live = false;
+static char *live_path = NULL;
+static bool console = false;
+
+/* set while the live options are taken, after the --load of main() */
+static bool running = false;
+/* set while SIGHUP applies the options again, by the live thread */
+static bool reloading = false;
+
+/* the functionality loaded by --load while running, unused at exit */
+static char **live_loads = NULL;
+static int live_loads_length = 0;
+
+static int ce_main_mod_id = -1;
+
+/**
+ * struct main_task - a --load or --dump given while running
+ * @index:	index of the option in the Main section, %0 or %4
+ * @arg:	its argument, allocated, or %NULL
+ *
+ * The options use the module registry, which is the main thread's, so the
+ * live thread queues them for ce_main_tasks() and wakes control().
+ */
+struct main_task {
+	int index;
+	char *arg;
+};
+
+static struct main_task *main_tasks = NULL;
+static int main_tasks_length = 0; /* atomic, read without the mutex */
+static pthread_mutex_t main_tasks_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * live_load() - load functionality while running, for --load
+ * @fcn:	the use string
+ */
+static void live_load(const char *fcn)
+{
+	if (load && !strcmp(load, fcn))
+		return;
+	for (int i = 0; i < live_loads_length; i++) {
+		if (!strcmp(live_loads[i], fcn))
+			return; /* given again by a reload */
+	}
+	/* the loop running keeps the thread, whatever the loaded set */
+	int (*c)() = control;
+	void (*w)() = control_wake;
+	int err = ce_mod_use(ce_main_mod_id, fcn);
+	control = c;
+	__atomic_store_n(&control_wake, w, __ATOMIC_RELEASE);
+	if (err < 0) {
+		lprintf(ERR "Loading "lBLD_"%s"_lBLD" failed: %s\n", fcn,
+				ce_mod_strerr(err));
+		return;
+	}
+	size_t l = strlen(fcn) + 1;
+	live_loads = realloc(live_loads,
+			(live_loads_length + 1) * sizeof(char *));
+	assert(live_loads != NULL);
+	live_loads[live_loads_length++] = memcpy(malloc(l), fcn, l);
+	lprintf(INF "Loaded "lBLD_"%s"_lBLD".\n", fcn);
+}
+
+extern size_t ce_mod_memcnt();
+extern size_t ce_log_memcnt();
+extern void dlib_prefetch(int argc, char * const argv[]);
+extern void dlib_prefetch_end();
+
+/**
+ * dump() - log diagnostics, for --dump
+ * @what:	comma separated "mod", "mem" and "log", %NULL for all
+ */
+static void dump(const char *what)
+{
+	static const char *names[] = { "mod", "mem", "log" };
+	for (int i = 0; i < 3; i++) {
+		const char *w = what;
+		while (w && strncmp(w, names[i], 3) && (w = strchr(w, ',')))
+			w++;
+		if (what && (!w || (w[3] && w[3] != ',')))
+			continue;
+		if (i == 0) {
+			ce_mod_stats_log(1);
+		} else if (i == 1) {
+			size_t mem_mod = ce_mod_memcnt();
+			size_t mem_log = ce_log_memcnt();
+			lprintf(INF "Memory usage report: ce-mod "
+					lF_BLUE"%ti"_lF" + ce-log "lF_BLUE"%ti"
+					_lF" = "lF_BLUE"%ti"_lF".\n", mem_mod,
+					mem_log, mem_mod + mem_log);
+		} else {
+			log_stats_report(10);
+		}
+	}
+}
+
+static void main_task_add(int index, const char *arg)
+{
+	char *a = NULL;
+	if (arg) {
+		size_t l = strlen(arg) + 1;
+		a = memcpy(malloc(l), arg, l);
+	}
+	pthread_mutex_lock(&main_tasks_mutex);
+	main_tasks = realloc(main_tasks,
+			(main_tasks_length + 1) * sizeof(*main_tasks));
+	assert(main_tasks != NULL);
+	main_tasks[main_tasks_length] = (struct main_task) { index, a };
+	__atomic_store_n(&main_tasks_length, main_tasks_length + 1,
+			__ATOMIC_RELEASE);
+	pthread_mutex_unlock(&main_tasks_mutex);
+	console_queued();
+	void (*wake)() = __atomic_load_n(&control_wake, __ATOMIC_ACQUIRE);
+	if (wake)
+		wake();
+}
+
+/**
+ * main_tasks_drop() - drop the tasks queued too late for control() to run
+ */
+static void main_tasks_drop()
+{
+	for (int i = 0; i < main_tasks_length; i++) {
+		lprintf(WRN "Option "lBLD_"--%s"_lBLD" %s given as control "
+				"returned, ignoring.\n", main_tasks[i].index
+				? "dump" : "load", main_tasks[i].arg
+				? main_tasks[i].arg : "");
+		free(main_tasks[i].arg);
+	}
+	free(main_tasks);
+	main_tasks = NULL;
+	main_tasks_length = 0;
+}
+
+void ce_main_tasks()
+{
+	if (!__atomic_load_n(&main_tasks_length, __ATOMIC_ACQUIRE))
+		return;
+	pthread_mutex_lock(&main_tasks_mutex);
+	struct main_task *a = main_tasks;
+	int n = main_tasks_length;
+	main_tasks = NULL;
+	main_tasks_length = 0;
+	pthread_mutex_unlock(&main_tasks_mutex);
+	for (int i = 0; i < n; i++) {
+		if (a[i].index == 0)
+			live_load(a[i].arg);
+		else
+			dump(a[i].arg);
+		free(a[i].arg);
+	}
+	free(a);
+}
+
 static int optcb(int index, const char *optarg)
 {
-	assert(index >= 0 && index < 2);
+	assert(index >= 0 && index < 5);
 	size_t l;
+	if (running && (index == 1 || index == 2 || index == 3)) {
+		lprintf(DBG "Option "lBLD_"--%s"_lBLD" only applies at start, "
+				"ignoring.\n", index == 1 ? "check"
+				: index == 2 ? "live" : "console");
+		return index == 1;
+	}
 	switch (index) {
 	case 0:
 		assert(optarg != NULL);
+		if (running) {
+			main_task_add(0, optarg);
+			return 0;
+		}
 		if (load) {
 			if (check) {
 				lprintf(ERR "Option --check cannot be combined with --load."
@@ -47,6 +229,27 @@ static int optcb(int index, const char *optarg)
 		l = strlen(optarg) + 1;
 		load = memcpy(malloc(l), optarg, l);
 		return 0;
+	case 2:
+		live = true;
+		free(live_path);
+		live_path = NULL;
+		if (optarg) {
+			l = strlen(optarg) + 1;
+			live_path = memcpy(malloc(l), optarg, l);
+		}
+		return 0;
+	case 3:
+		live = true;
+		console = true;
+		return 0;
+	case 4:
+		if (reloading)
+			return 0;
+		if (running)
+			main_task_add(4, optarg);
+		else
+			dump(optarg);
+		return 0;
 	}
 	return 1;
 }
@@ -54,16 +257,26 @@ static int optcb(int index, const char *optarg)
 static struct optsection opts = {
 	.label = "Main:",
 	.callback = optcb,
+	.live = 1,
 	.opt_a = {
 		{ ARG_REQUIRED, 'l', "load", "FCN\t"
-			"Load functionality before giving control over." },
+			"Load functionality before giving control over, or "
+			"while running." },
 		{ ARG_REQUIRED, 'c', "check", "FCN\t"
 			"Check whether functionality can be loaded." },
+		{ ARG_OPTIONAL, '\0', "live", "PATH\t"
+			"Apply the options again on SIGHUP and those sent to "
+			"the Unix socket PATH, while running." },
+		{ ARG_NONE, '\0', "console", "\t"
+			"Apply the options given on stdin a line at a time, "
+			"while running." },
+		{ ARG_OPTIONAL, '\0', "dump", "mod,mem,log\t"
+			"Log the module, memory and log call site "
+			"statistics." },
 		{ 0, '\0', NULL, NULL },
 	},
 };
 
-static int ce_main_mod_id = -1;
 static void __init mod_init()
 {
 	int rv = opt_add(ce_options, &opts);
@@ -88,13 +301,238 @@ static void __init mod_init()
 static void __exit mod_exit()
 {
 	free(load);
+	free(live_path);
 	assert(ce_main_mod_id != -1);
 	ce_mod_rm(ce_main_mod_id);
 	opt_rm(ce_options, &opts);
 }
 
-extern size_t ce_mod_memcnt();
-extern size_t ce_log_memcnt();
+/**
+ * parse_config() - parse the options of the configuration files and the
+ *		    environment, ahead of the command line
+ *
+ * In the order of precedence from low to high: /etc/cengine.conf,
+ * $XDG_CONFIG_HOME/cengine.conf (~/.config/cengine.conf) and the CENGINE_
+ * variables, CENGINE_CONFIG naming yet another file.
+ */
+static void parse_config()
+{
+	const char *files[2] = { "/etc/cengine.conf", NULL };
+	const char *xdg = getenv("XDG_CONFIG_HOME"), *home = getenv("HOME");
+	if (xdg && !*xdg)
+		xdg = NULL; /* unset as far as the specification goes */
+	char user[(xdg ? strlen(xdg) : home ? strlen(home) : 0) + 32];
+	if (xdg) {
+		snprintf(user, sizeof(user), "%s/cengine.conf", xdg);
+		files[1] = user;
+	} else if (home && *home) {
+		snprintf(user, sizeof(user), "%s/.config/cengine.conf", home);
+		files[1] = user;
+	}
+	for (int i = 0; i < 2; i++) {
+		if (files[i] && opt_parse_file(ce_options, files[i]) < 0
+				&& errno != ENOENT)
+			lprintf(WRN "Failed to read options from "lBLD_"%s"_lBLD
+					": %s.\n", files[i], strerror(errno));
+	}
+	opt_parse_env(ce_options, "CENGINE_");
+}
+
+/*
+ * The live options: a thread waits for SIGHUP, by live_pipe, and the
+ * connections to live_path to apply options with opt_live_begin().
+ */
+static int live_argc;
+static char * const *live_argv;
+static int live_pipe[2] = { -1, -1 };
+static int live_fd = -1;
+static pthread_t live_thread;
+
+/* connections to live_path served at once, more wait to be accepted */
+#define LIVE_CONNS_MAX 4
+
+static void live_sighup(int sig)
+{
+	int e = errno;
+	char c = 'h';
+	if (write(live_pipe[1], &c, 1) < 0) {
+		/* full, reloads are pending */
+	}
+	errno = e;
+}
+
+/**
+ * live_reload() - apply the options of the files, the environment and the
+ *		   command line again, in the order of main()
+ *
+ * The one-shot options aren't run again: -h isn't live, --dump is skipped
+ * and --mod-stats-file keeps the file it has open.
+ */
+static void live_reload()
+{
+	int skipped;
+	opt_live_begin(ce_options);
+	reloading = true;
+	parse_config();
+	opt_parse(ce_options, live_argc, live_argv, 1);
+	reloading = false;
+	int rejected = opt_live_end(ce_options, &skipped);
+	lprintf(INF "Options reloaded, "lF_BLUE"%d"_lF" rejected, "
+			lF_BLUE"%d"_lF" not live.\n", rejected, skipped);
+}
+
+/**
+ * live_accept() - accept a connection to the socket
+ * @conns:	consoles of the connections, @fd_in %-1 if free
+ * @p:		poll entries of @conns
+ *
+ * Return:	non-zero if @conns is full after accepting
+ */
+static int live_accept(struct console *conns, struct pollfd *p)
+{
+	int i, fd = accept(live_fd, NULL, NULL);
+	if (fd < 0)
+		return 0;
+	/* a reply a peer doesn't read mustn't stop the other consoles */
+	if (fcntl(fd, F_SETFL, O_NONBLOCK)) {
+		close(fd);
+		return 0;
+	}
+	for (i = 0; conns[i].fd_in >= 0; i++);
+	console_init(conns + i, fd, fd);
+	p[i].fd = fd;
+	for (i = 0; i < LIVE_CONNS_MAX && conns[i].fd_in >= 0; i++);
+	return i == LIVE_CONNS_MAX;
+}
+
+static void *live_run(void *arg)
+{
+	static struct console in; /* --console */
+	static struct console conns[LIVE_CONNS_MAX];
+	console_init(&in, STDIN_FILENO, STDOUT_FILENO);
+	struct pollfd p[3 + LIVE_CONNS_MAX] = {
+		{ live_pipe[0], POLLIN, 0 },
+		{ console ? STDIN_FILENO : -1, POLLIN, 0 },
+		{ live_fd, POLLIN, 0 },
+	};
+	for (int i = 0; i < LIVE_CONNS_MAX; i++) {
+		conns[i].fd_in = -1;
+		p[3 + i] = (struct pollfd) { -1, POLLIN, 0 };
+	}
+	while (1) {
+		if (poll(p, 3 + LIVE_CONNS_MAX, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			lprintf(ERR "Live options stopped: %s.\n",
+					strerror(errno));
+			break;
+		}
+		char c;
+		if ((p[0].revents & POLLIN) && read(live_pipe[0], &c, 1) == 1) {
+			if (c == 'q')
+				break;
+			live_reload();
+		}
+		if ((p[1].revents & (POLLIN | POLLHUP))
+				&& console_read(&in) < 0)
+			p[1].fd = -1; /* end of stdin */
+		for (int i = 0; i < LIVE_CONNS_MAX; i++) {
+			if (!(p[3 + i].revents & (POLLIN | POLLHUP | POLLERR))
+					|| console_read(conns + i) >= 0)
+				continue;
+			close(conns[i].fd_in);
+			conns[i].fd_in = p[3 + i].fd = -1;
+			p[2].fd = live_fd; /* a connection is free again */
+		}
+		if ((p[2].revents & POLLIN) && live_accept(conns, p + 3))
+			p[2].fd = -1; /* full, accepted once one closes */
+	}
+	for (int i = 0; i < LIVE_CONNS_MAX; i++) {
+		if (conns[i].fd_in >= 0)
+			close(conns[i].fd_in);
+	}
+	return NULL;
+}
+
+/**
+ * live_listen() - listen on the Unix socket @live_path
+ *
+ * Return:	the socket or %-1
+ */
+static int live_listen()
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	if (strlen(live_path) >= sizeof(addr.sun_path)) {
+		lprintf(ERR "Live options socket path "lBLD_"%s"_lBLD" is too "
+				"long.\n", live_path);
+		return -1;
+	}
+	strcpy(addr.sun_path, live_path);
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+	unlink(live_path);
+	/* the options are this user's to give, connecting needs write */
+	if (fd < 0 || bind(fd, (struct sockaddr *) &addr, sizeof(addr))
+			|| chmod(live_path, 0600) || listen(fd, 4)) {
+		lprintf(ERR "Failed to listen on "lBLD_"%s"_lBLD": %s.\n",
+				live_path, strerror(errno));
+		if (fd >= 0)
+			close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/**
+ * live_start() - start taking options while running, for --live
+ * @argc:	argument count of main()
+ * @argv:	argument vector of main(), parsed again on SIGHUP
+ */
+static void live_start(int argc, char * const *argv)
+{
+	live_argc = argc;
+	live_argv = argv;
+	if (pipe(live_pipe) || fcntl(live_pipe[1], F_SETFL, O_NONBLOCK)) {
+		lprintf(ERR "Failed to start live options: %s.\n",
+				strerror(errno));
+		live = false;
+		return;
+	}
+	if (live_path)
+		live_fd = live_listen();
+	if (pthread_create(&live_thread, NULL, live_run, NULL)) {
+		lputs(ERR "Failed to start the live options thread.");
+		close(live_pipe[0]);
+		close(live_pipe[1]);
+		if (live_fd >= 0)
+			close(live_fd);
+		live = false;
+		return;
+	}
+	struct sigaction sa = { .sa_handler = live_sighup };
+	sigemptyset(&sa.sa_mask);
+	sigaction(SIGHUP, &sa, NULL);
+	lprintf(INF "Live options on SIGHUP%s%s"lF_BLUE"%s"_lF".\n",
+			console ? ", stdin" : "",
+			live_fd >= 0 ? " and " : "",
+			live_fd >= 0 ? live_path : "");
+}
+
+static void live_stop()
+{
+	signal(SIGHUP, SIG_DFL);
+	char c = 'q';
+	if (write(live_pipe[1], &c, 1) != 1)
+		lputs(WRN "Failed to stop the live options thread.");
+	else
+		pthread_join(live_thread, NULL);
+	close(live_pipe[0]);
+	close(live_pipe[1]);
+	if (live_fd >= 0) {
+		close(live_fd);
+		unlink(live_path);
+	}
+}
+
 int main(int argc, char * const *args)
 {
 	if (ce_main_mod_id == -1) {
@@ -105,7 +543,10 @@ int main(int argc, char * const *args)
 
 	lputs(INF "cengine-main reached.");
 
+	dlib_prefetch(argc, args);
+	parse_config();
 	opt_parse(ce_options, argc, args, 1);
+	dlib_prefetch_end();
 
 	if (load) {
 		int err = ce_mod_use(modid, load);
@@ -116,26 +557,35 @@ int main(int argc, char * const *args)
 			return !!err;
 	}
 
+	running = true;
+	if (live)
+		live_start(argc, args);
 	if (control) {
 		control();
 	} else {
 		lprintf(ERR "Nothing to give control over to.\n");
 	}
+	if (live)
+		live_stop();
+	running = false;
+	main_tasks_drop();
 
-	if (load) {
-		ce_mod_unuse(modid, load);
+	if (load || live_loads) {
+		while (live_loads_length) {
+			char *fcn = live_loads[--live_loads_length];
+			ce_mod_unuse(modid, fcn);
+			free(fcn);
+		}
+		free(live_loads);
+		if (load)
+			ce_mod_unuse(modid, load);
 		ce_mod_cleanup();
 	}
 
 #ifdef MEMCNT_ENABLED
 	//memcnt_status(stderr);
 #endif
-	size_t mem_mod = ce_mod_memcnt();
-	size_t mem_log = ce_log_memcnt();
-	lprintf(INF "Memory usage report: ce-mod "lF_BLUE"%ti"_lF" "
-			"+ ce-log "lF_BLUE"%ti"_lF" "
-			"= "lF_BLUE"%ti"_lF".\n",
-			mem_mod, mem_log, mem_mod + mem_log);
+	dump(NULL);
 	return EXIT_SUCCESS;
 }
 
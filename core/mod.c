@@ -1,6 +1,10 @@
+/* required for clock_gettime with stdc99 */
+#define _POSIX_C_SOURCE 200809L
+
 #include "ce-aux.h"
 #include "ce-log.h"
 #include "ce-mod.h"
+#include "ce-opt.h"
 #include "xf-htable.h"
 #include "xf-strb.h"
 #define XF_MREGION_EXP_ALLOC(total,initsize,previous) \
@@ -11,6 +15,9 @@
 #include <stdint.h> /* uint8_t */
 #include <ctype.h> /* isspace */
 #include <stdbool.h>
+#include <pthread.h>
+#include <time.h> /* clock_gettime */
+#include <errno.h> /* ETIMEDOUT */
 #define NAMEINF_UNSPECIF UINT8_MAX
 
 /**
@@ -399,6 +406,27 @@ struct hashentry {
 
 static struct xf_htable fcn_lookup = { .buckets = NULL, };
 static struct xf_htable *fcn_l = &fcn_lookup; /* convinient use */
+#define FCN_LOOKUP_BITS 4 /* 16 buckets */
+/* names hashed to each fcn_lookup bucket, see ce_mod_stats() */
+static uint16_t fcn_lookup_chain[1 << FCN_LOOKUP_BITS];
+
+/**
+ * DOC: static struct mod_stat;
+ * Counters reported by ce_mod_stats(). They are updated with relaxed atomic
+ * additions via STAT_ADD() so a snapshot may be taken from any thread.
+ */
+static struct {
+	int mods_loaded;
+	int fcns_loaded;
+	unsigned long resolves;
+	unsigned long retries;
+	unsigned long loads;
+	unsigned long load_fails;
+	unsigned long unloads;
+} mod_stat;
+#define STAT_ADD(field, n) \
+	__atomic_add_fetch(&mod_stat.field, n, __ATOMIC_RELAXED)
+#define STAT_GET(field) __atomic_load_n(&mod_stat.field, __ATOMIC_RELAXED)
 
 /**
  * fcn_parent_set() - iterate a parent to include a child
@@ -555,6 +583,8 @@ static int fcn_get(int fcn_nl, const char *fcn_n, int variable)
 	struct fcn_inf *f;
 	assert(e != NULL); /* if this actually fails at some point, handle it */
 	if (e->index == fcns_length) {
+		fcn_lookup_chain[xf_hash_hsieh_superfast(name_add, b.length - 1)
+			& ((1 << FCN_LOOKUP_BITS) - 1)]++;
 		fcns_length++;
 		if(!fcns_expand(fcns_length)) {
 			static int wrnonce = 0;
@@ -826,6 +856,244 @@ static int refb_fcn_cnt(struct refb *b, int fcn_index);
 
 #include "mod-refb.c"
 
+/**
+ * DOC: lifecycle events
+ * Subscribers added with ce_mod_listen() are kept in an immutable
+ * &struct ev_listeners array. Changing the subscriptions publishes a new
+ * array with an atomic store, so ev_dispatch() never takes a lock: it
+ * announces itself in @ev_readers and reads whatever array is published.
+ *
+ * Replaced arrays are retired to @ev_retired and released once no
+ * dispatch is running; a dispatcher that (un)subscribes from within a
+ * callback thus never waits for itself.
+ */
+
+/**
+ * struct ev_listener - a ce_mod_listen() subscription
+ * @callb:	function to call
+ * @arg:	passed to @callb
+ * @events:	CE_MOD_EV_* flags the subscription is interested in
+ * @hndl:	handle returned to the subscriber
+ */
+struct ev_listener {
+	void (*callb)(const struct ce_mod_event *ev, void *arg);
+	void *arg;
+	int events;
+	int hndl;
+};
+
+/**
+ * struct ev_listeners - a published array of subscriptions
+ * @length:	count of &struct ev_listener's in @a
+ * @events:	CE_MOD_EV_* flags any of @a is interested in
+ * @retired:	next array in the @ev_retired list
+ * @a:		the subscriptions
+ */
+struct ev_listeners {
+	int length;
+	int events;
+	struct ev_listeners *retired;
+	struct ev_listener a[];
+};
+
+static struct ev_listeners *ev_pub = NULL; /* atomic access only */
+static int ev_events = 0; /* atomic, @events of ev_pub */
+static struct ev_listeners *ev_retired = NULL; /* guarded by ev_mutex */
+static int ev_readers = 0; /* dispatches in progress */
+static int ev_hndl_next = 1;
+static pthread_mutex_t ev_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/**
+ * ev_reclaim() - free the retired arrays if no dispatch can be reading them
+ *
+ * Must be called with @ev_mutex held.
+ */
+static void ev_reclaim()
+{
+	if (__atomic_load_n(&ev_readers, __ATOMIC_SEQ_CST))
+		return;
+	while (ev_retired) {
+		struct ev_listeners *old = ev_retired;
+		ev_retired = old->retired;
+		free(old);
+	}
+}
+
+/**
+ * ev_publish() - replace the published subscription array
+ * @l:		the new array, or %NULL for no subscriptions
+ *
+ * Must be called with @ev_mutex held.
+ */
+static void ev_publish(struct ev_listeners *l)
+{
+	__atomic_store_n(&ev_events, l ? l->events : 0, __ATOMIC_RELAXED);
+	struct ev_listeners *old = __atomic_exchange_n(&ev_pub, l,
+			__ATOMIC_SEQ_CST);
+	if (old) {
+		old->retired = ev_retired;
+		ev_retired = old;
+	}
+	/* A dispatch starting after this point sees @l. */
+	ev_reclaim();
+}
+
+int ce_mod_listen(void (*callb)(const struct ce_mod_event *ev, void *arg),
+		void *arg, int events)
+{
+	assert(callb != NULL);
+	if (!(events & CE_MOD_EV_ALL))
+		return -1;
+
+	pthread_mutex_lock(&ev_mutex);
+	struct ev_listeners *cur = __atomic_load_n(&ev_pub, __ATOMIC_ACQUIRE);
+	int len = cur ? cur->length : 0;
+	struct ev_listeners *l = malloc(sizeof(struct ev_listeners)
+			+ (len + 1) * sizeof(struct ev_listener));
+	assert(l != NULL);
+	if (len)
+		memcpy(l->a, cur->a, len * sizeof(struct ev_listener));
+	l->length = len + 1;
+	l->events = (cur ? cur->events : 0) | events;
+	l->retired = NULL;
+	l->a[len].callb = callb;
+	l->a[len].arg = arg;
+	l->a[len].events = events;
+	l->a[len].hndl = ev_hndl_next++;
+	int hndl = l->a[len].hndl;
+	ev_publish(l);
+	pthread_mutex_unlock(&ev_mutex);
+	return hndl;
+}
+
+int ce_mod_unlisten(int hndl)
+{
+	pthread_mutex_lock(&ev_mutex);
+	struct ev_listeners *cur = __atomic_load_n(&ev_pub, __ATOMIC_ACQUIRE);
+	int i, len = cur ? cur->length : 0;
+	for (i = 0; i < len && cur->a[i].hndl != hndl; i++);
+	if (i == len) {
+		pthread_mutex_unlock(&ev_mutex);
+		return -1;
+	}
+	struct ev_listeners *l = NULL;
+	if (len > 1) {
+		l = malloc(sizeof(struct ev_listeners)
+				+ (len - 1) * sizeof(struct ev_listener));
+		assert(l != NULL);
+		memcpy(l->a, cur->a, i * sizeof(struct ev_listener));
+		memcpy(l->a + i, cur->a + i + 1,
+				(len - i - 1) * sizeof(struct ev_listener));
+		l->length = len - 1;
+		l->events = 0;
+		for (int e = 0; e < l->length; e++)
+			l->events |= l->a[e].events;
+		l->retired = NULL;
+	}
+	ev_publish(l);
+	pthread_mutex_unlock(&ev_mutex);
+	return 0;
+}
+
+/**
+ * ev_dispatch() - pass an event to the interested subscribers
+ * @ev:		the event to pass
+ */
+static void ev_dispatch(const struct ce_mod_event *ev)
+{
+	__atomic_add_fetch(&ev_readers, 1, __ATOMIC_SEQ_CST);
+	struct ev_listeners *l = __atomic_load_n(&ev_pub, __ATOMIC_SEQ_CST);
+	if (l && (l->events & ev->type)) {
+		for (int i = 0; i < l->length; i++) {
+			if (l->a[i].events & ev->type)
+				l->a[i].callb(ev, l->a[i].arg);
+		}
+	}
+	/* the last reader out frees what publishing meanwhile retired */
+	if (!__atomic_sub_fetch(&ev_readers, 1, __ATOMIC_SEQ_CST)
+			&& !pthread_mutex_trylock(&ev_mutex)) {
+		ev_reclaim();
+		pthread_mutex_unlock(&ev_mutex);
+	}
+}
+
+/**
+ * ev_wanted() - whether anyone subscribes to given event types
+ * @type:	CE_MOD_EV_* flags
+ *
+ * Lets the event senders skip assembling events no one listens to. Reads
+ * @ev_events, the published array may be retired and freed meanwhile.
+ */
+static inline int ev_wanted(int type)
+{
+	return __atomic_load_n(&ev_events, __ATOMIC_RELAXED) & type;
+}
+
+/**
+ * mod_id_get() - the ce_mod_add() identifier of a module
+ * @mod_index:	index in @mods_a
+ */
+static int mod_id_get(int mod_index)
+{
+	struct id_t id = {
+		.index = mod_index,
+		.iter = mods_a[mod_index].iter,
+		.iserr = 0,
+	};
+	int v;
+	memcpy(&v, &id, sizeof(v));
+	return v;
+}
+
+/**
+ * ev_send_mod() - dispatch a module (un)load or failure event
+ * @type:	%CE_MOD_EV_LOAD, %CE_MOD_EV_UNLOAD or %CE_MOD_EV_FAIL
+ * @mod_index:	the module concerned
+ * @err:	the error code for %CE_MOD_EV_FAIL
+ *
+ * For (un)load events, %CE_MOD_EV_PROVIDER events for all the functionality
+ * provided by the module follow.
+ */
+static void ev_send_mod(int type, int mod_index, int err)
+{
+	if (!ev_wanted(type | CE_MOD_EV_PROVIDER))
+		return;
+	struct mod_inf *minf = mods_a + mod_index;
+	struct ce_mod_event ev = {
+		.type = type,
+		.mod_id = mod_id_get(mod_index),
+		.err = err,
+	};
+	mod_inf_name_get(minf, &ev.name_len, &ev.name);
+	ev_dispatch(&ev);
+	if (type == CE_MOD_EV_FAIL)
+		return;
+
+	ev.type = CE_MOD_EV_PROVIDER;
+	for (int i = 0; i < minf->fcn_cnt; i++) {
+		struct fcn_inf *f = fcns_a + minf->additional[i].index;
+		if (f->expands && fcns_a[f->parent].variable == 1) {
+			/* variable rebind: 'parent=child' */
+			struct fcn_inf *p = fcns_a + f->parent;
+			ev.fcn_len = p->name_len;
+			ev.fcn = fcn_inf_name(p);
+			ev.bind_len = f->name_len - p->name_len - 1;
+			ev.bind = fcn_inf_name(f) + p->name_len + 1;
+		} else {
+			ev.fcn_len = f->name_len;
+			ev.fcn = fcn_inf_name(f);
+			ev.bind_len = ev.name_len;
+			ev.bind = ev.name;
+		}
+		if (type == CE_MOD_EV_UNLOAD) {
+			ev.bind_len = 0;
+			ev.bind = NULL;
+		}
+		ev_dispatch(&ev);
+	}
+}
+
+
 __attribute__((constructor(130))) static void ce_mod_init()
 {
 	mods_a = malloc(sizeof(mods_a[0]) * mods_size);
@@ -834,7 +1102,7 @@ __attribute__((constructor(130))) static void ce_mod_init()
 		mods_a[i].iter = 0;
 	}
 	fcns_a = malloc(sizeof(fcns_a[0]) * fcns_size);
-	xf_htable_construct(fcn_l, 4/*16 buckets*/, sizeof(struct hashentry),
+	xf_htable_construct(fcn_l, FCN_LOOKUP_BITS, sizeof(struct hashentry),
 			xf_hash_hsieh_superfast);
 	fcn_names = xf_mregion_create(128);
 
@@ -875,6 +1143,10 @@ __attribute__((destructor(130))) static void ce_mod_exit()
 		refb_destruct(top_use);
 		free(top_use);
 	}
+	pthread_mutex_lock(&ev_mutex);
+	ev_publish(NULL);
+	assert(ev_retired == NULL);
+	pthread_mutex_unlock(&ev_mutex);
 
 	xf_mregion_destroy(fcn_names);
 	xf_htable_destruct(fcn_l);
@@ -952,10 +1224,248 @@ size_t ce_mod_memcnt()
 
 	if (fcn_lookup.buckets)
 		cnt += xf_htable_memcnt(fcn_l);
+
+	/* listen and unlisten may retire and free the arrays meanwhile */
+	pthread_mutex_lock(&ev_mutex);
+	struct ev_listeners *l = __atomic_load_n(&ev_pub, __ATOMIC_ACQUIRE);
+	if (l)
+		cnt += sizeof(*l) + l->length * sizeof(l->a[0]);
+	for (l = ev_retired; l; l = l->retired)
+		cnt += sizeof(*l) + l->length * sizeof(l->a[0]);
+	pthread_mutex_unlock(&ev_mutex);
 	return cnt;
 
 }
 
+void ce_mod_stats_counters(struct ce_mod_stats *st)
+{
+	assert(st != NULL);
+	memset(st, 0, sizeof(*st));
+	st->mods_loaded = STAT_GET(mods_loaded);
+	st->fcns_loaded = STAT_GET(fcns_loaded);
+	st->resolves = STAT_GET(resolves);
+	st->retries = STAT_GET(retries);
+	st->loads = STAT_GET(loads);
+	st->load_fails = STAT_GET(load_fails);
+	st->unloads = STAT_GET(unloads);
+}
+
+void ce_mod_stats(struct ce_mod_stats *st)
+{
+	ce_mod_stats_counters(st);
+	st->mods_registered = mods_count;
+	st->fcns = fcns_length;
+	st->refb_overflow = top_use != NULL ? top_use->overflow_len : 0;
+
+	st->scratch[0] = b1.a ? b1.size : 0;
+	st->scratch[1] = b2.a ? b2.size : 0;
+	st->scratch[2] = b3 ? b3_size * sizeof(b3[0]) : 0;
+	st->scratch[3] = b4.a ? b4.size : 0;
+	st->scratch[4] = b5 ? b5_size * sizeof(b5[0]) : 0;
+	st->scratch_generic = bgeneric_size;
+
+	int i, names = 0;
+	st->lookup_buckets = 1 << FCN_LOOKUP_BITS;
+	st->lookup_used = 0;
+	st->lookup_chain_max = 0;
+	for (i = 0; i < st->lookup_buckets; i++) {
+		int c = fcn_lookup_chain[i];
+		names += c;
+		st->lookup_used += c != 0;
+		if (c > st->lookup_chain_max)
+			st->lookup_chain_max = c;
+	}
+	st->lookup_load = names / (float) st->lookup_buckets;
+}
+
+void ce_mod_stats_log(int full)
+{
+	struct ce_mod_stats st;
+	if (full)
+		ce_mod_stats(&st);
+	else
+		ce_mod_stats_counters(&st);
+	if (full) {
+		lprintf(INF "Module stats: mods "lF_BLUE"%i"_lF" registered, "
+				"fcns "lF_BLUE"%i"_lF"; refb overflow "
+				lF_BLUE"%i"_lF".\n", st.mods_registered,
+				st.fcns, st.refb_overflow);
+		lprintf(INF "Module stats: scratch b1-b5 "
+				lF_BLUE"%i %i %i %i %i"_lF" generic "
+				lF_BLUE"%i"_lF"; lookup "lF_BLUE"%i/%i"_lF
+				" buckets used, max chain "lF_BLUE"%i"_lF
+				", load "lF_BLUE"%.2f"_lF".\n",
+				st.scratch[0], st.scratch[1], st.scratch[2],
+				st.scratch[3], st.scratch[4],
+				st.scratch_generic, st.lookup_used,
+				st.lookup_buckets, st.lookup_chain_max,
+				st.lookup_load);
+	}
+	lprintf(INF "Module stats: mods "lF_BLUE"%i"_lF" and fcns "lF_BLUE
+			"%i"_lF" loaded; resolves "lF_BLUE"%lu"_lF", retries "
+			lF_BLUE"%lu"_lF", loads "lF_BLUE"%lu"_lF", failed "
+			lF_BLUE"%lu"_lF", unloads "lF_BLUE"%lu"_lF".\n",
+			st.mods_loaded, st.fcns_loaded, st.resolves,
+			st.retries, st.loads, st.load_fails, st.unloads);
+}
+
+/**
+ * stats_export() - append a statistics record to @stats_file
+ * @f:		file to write to
+ * @full:	as of ce_mod_stats_log()
+ *
+ * Writes a single line of space separated 'key=value' pairs, prefixed
+ * with the unix time, of the counters only unless @full.
+ */
+static void stats_export(FILE *f, int full)
+{
+	struct ce_mod_stats st;
+	if (!full) {
+		ce_mod_stats_counters(&st);
+		fprintf(f, "%lld mods_loaded=%i fcns_loaded=%i resolves=%lu "
+				"retries=%lu loads=%lu load_fails=%lu "
+				"unloads=%lu\n", (long long) time(NULL),
+				st.mods_loaded, st.fcns_loaded, st.resolves,
+				st.retries, st.loads, st.load_fails,
+				st.unloads);
+		fflush(f);
+		return;
+	}
+	ce_mod_stats(&st);
+	fprintf(f, "%lld mods=%i mods_loaded=%i fcns=%i fcns_loaded=%i "
+			"refb_overflow=%i b1=%i b2=%i b3=%i b4=%i b5=%i "
+			"bgeneric=%i lookup_buckets=%i lookup_used=%i "
+			"lookup_chain_max=%i lookup_load=%.3f resolves=%lu "
+			"retries=%lu loads=%lu load_fails=%lu unloads=%lu\n",
+			(long long) time(NULL), st.mods_registered,
+			st.mods_loaded, st.fcns, st.fcns_loaded,
+			st.refb_overflow, st.scratch[0], st.scratch[1],
+			st.scratch[2], st.scratch[3], st.scratch[4],
+			st.scratch_generic, st.lookup_buckets, st.lookup_used,
+			st.lookup_chain_max, st.lookup_load, st.resolves,
+			st.retries, st.loads, st.load_fails, st.unloads);
+	fflush(f);
+}
+
+/* periodic statistics reporting, --mod-stats */
+static int stats_interval = 0; /* seconds, 0 when not reporting */
+static FILE *stats_file = NULL;
+static char *stats_path = NULL; /* of stats_file, not reopened if given again */
+static int stats_stop = 0;
+static pthread_t stats_thread;
+static pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t stats_cond = PTHREAD_COND_INITIALIZER;
+
+static void *stats_report(void *nothing)
+{
+	pthread_mutex_lock(&stats_mutex);
+	while (!stats_stop) {
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec += stats_interval;
+		int e = 0;
+		while (!stats_stop && e != ETIMEDOUT)
+			e = pthread_cond_timedwait(&stats_cond, &stats_mutex, &ts);
+		if (stats_stop)
+			break;
+		/* the registry is the loading thread's, counters only */
+		ce_mod_stats_log(0);
+		if (stats_file)
+			stats_export(stats_file, 0);
+	}
+	pthread_mutex_unlock(&stats_mutex);
+	return NULL;
+}
+
+static void stats_report_stop()
+{
+	pthread_mutex_lock(&stats_mutex);
+	int running = stats_interval > 0;
+	stats_stop = 1;
+	pthread_cond_signal(&stats_cond);
+	pthread_mutex_unlock(&stats_mutex);
+	if (running)
+		pthread_join(stats_thread, NULL);
+	if (stats_file) {
+		stats_export(stats_file, 1);
+		fclose(stats_file);
+		stats_file = NULL;
+	}
+	free(stats_path);
+	stats_path = NULL;
+}
+
+static int stats_optcb(int index, const char *optarg)
+{
+	assert(optarg != NULL);
+	if (index == 1) {
+		pthread_mutex_lock(&stats_mutex);
+		if (stats_file && !strcmp(stats_path, optarg)) {
+			pthread_mutex_unlock(&stats_mutex);
+			return 0; /* given again by a reload */
+		}
+		if (stats_file)
+			fclose(stats_file);
+		free(stats_path);
+		stats_path = NULL;
+		stats_file = fopen(optarg, "a");
+		if (stats_file) {
+			size_t l = strlen(optarg) + 1;
+			stats_path = memcpy(malloc(l), optarg, l);
+		}
+		pthread_mutex_unlock(&stats_mutex);
+		if (!stats_file) {
+			lprintf(ERR "Cannot open module stats file "
+					lF_RED"%s"_lF".\n", optarg);
+			return 1;
+		}
+		return 0;
+	}
+	assert(index == 0);
+	int secs = atoi(optarg);
+	if (secs <= 0) {
+		lprintf(WRN "Invalid module stats interval '"lBLD_"%s"_lBLD
+				"'.\n", optarg);
+		return 1;
+	}
+	pthread_mutex_lock(&stats_mutex);
+	int running = stats_interval > 0;
+	stats_interval = secs;
+	pthread_cond_signal(&stats_cond);
+	pthread_mutex_unlock(&stats_mutex);
+	if (!running && pthread_create(&stats_thread, NULL, stats_report, NULL)) {
+		lputs(ERR "Failed to start the module stats reporter.");
+		stats_interval = 0;
+		return 1;
+	}
+	return 0;
+}
+
+static struct optsection stats_opts = {
+	.label = "Module statistics:",
+	.callback = stats_optcb,
+	.live = 1,
+	.opt_a = {
+		{ ARG_REQUIRED, '\0', "mod-stats", "SECS\t"
+			"Log module registry statistics every SECS seconds." },
+		{ ARG_REQUIRED, '\0', "mod-stats-file", "PATH\t"
+			"Append the statistics to a file as key=value lines." },
+		{ 0, '\0', NULL, NULL },
+	},
+};
+
+/* Initialized separately later to allow opt's constructors to be called. */
+static void __init mod_stats_init_argcb()
+{
+	opt_add(ce_options, &stats_opts);
+}
+
+static void __exit mod_stats_exit_argcb()
+{
+	stats_report_stop();
+	opt_rm(ce_options, &stats_opts);
+}
+
 const char *ce_mod_strerr(int err)
 {
 	assert(err < 0);
@@ -1130,11 +1640,20 @@ static int mod_load(struct refb *refs, int mod_index)
 	minf->loaded = 1;
 	struct mod_inf_fcn *mfcns = minf->additional;
 	for (i = 0, l = minf->fcn_cnt; i < l; i++) {
+		if (!fcns_a[mfcns[i].index].loaded)
+			STAT_ADD(fcns_loaded, 1);
 		fcns_a[mfcns[i].index].loaded = 1;
 	}
+	STAT_ADD(mods_loaded, 1);
+	STAT_ADD(loads, 1);
+	ev_send_mod(CE_MOD_EV_LOAD, mod_index, 0);
 
 exitp:
 	minf->loading = 0;
+	if (rval < 0) {
+		STAT_ADD(load_fails, 1);
+		ev_send_mod(CE_MOD_EV_FAIL, mod_index, rval);
+	}
 	if (rval == -101) { /* undo refs on minf->load() failure */
 		for (i = 0; i < uinf_len; i++) {
 			if (uinf[i].incompat)
@@ -1188,8 +1707,13 @@ static int mod_unload(struct refb *refs, int mod_index)
 		int f = mfcns[i].index;
 		assert(fcns_a[f].loaded);
 		assert(!refb_fcn_cnt(refs, f));
+		if (fcns_a[f].loaded) /* counted once on load */
+			STAT_ADD(fcns_loaded, -1);
 		fcns_a[f].loaded = 0;
 	}
+	STAT_ADD(mods_loaded, -1);
+	STAT_ADD(unloads, 1);
+	ev_send_mod(CE_MOD_EV_UNLOAD, mod_index, 0);
 
 	/* dereference the deps */
 	struct use_inf *mdeps;
@@ -1433,6 +1957,7 @@ static int use_exec_fcn_init(struct refb *refs,
 	int rval = -8999;
 	assert(fcn_index >= 0 && fcn_index < fcns_length);
 	struct fcn_inf *f = fcns_a + fcn_index;
+	STAT_ADD(resolves, 1);
 
 	/* Make a list of providers */
 	struct provider {
@@ -1573,6 +2098,7 @@ static int use_exec_fcn_init(struct refb *refs,
 					req_ver_l, req_ver);
 			prov_a[lst].works = 0;
 			prov_valid--;
+			STAT_ADD(retries, 1);
 			continue;
 		}
 		rval = prov_a[lst].mod_index;
@@ -2065,14 +2591,20 @@ static int mod_use(int mod_index, const char *use)
 	err = use_exec(top_use, mod_index, out_len, out, vers);
 	if (root) {
 		mods_a[mod_index].loading = 0; /* should this flag be constantly set root-mod? */
-		if (err >= 0) {
+		if (err >= 0 && !mods_a[mod_index].loaded) {
+			/* mod_load() has normally done this already */
 			mods_a[mod_index].loaded = 1;
 			int i, l;
 			for (i = 0, l = mods_a[mod_index].fcn_cnt;
 					i < l; i++) {
 				int z = mods_a[mod_index].additional[i].index;
+				if (!fcns_a[z].loaded)
+					STAT_ADD(fcns_loaded, 1);
 				fcns_a[z].loaded = 1;
 			}
+			STAT_ADD(mods_loaded, 1);
+			STAT_ADD(loads, 1);
+			ev_send_mod(CE_MOD_EV_LOAD, mod_index, 0);
 		}
 		lprintf(INF "Root mod %sinitialized(err %i), should continue now..\n",
 				err >= 0 ? "" : lF_RED"NOT "_lF, err);
@@ -1,13 +1,24 @@
+/* required for mmap and environ with stdc99 */
+#define _POSIX_C_SOURCE 200809L
 #include "ce-aux.h"
 #include "ce-opt.h"
 #include <stdlib.h>	/* alloc realloc free */
 #include <stdint.h>
+#include <stdbool.h>
 #include <string.h>	/* memcmp, strlen */
 #include <ctype.h>	/* isspace */
 #include <stdio.h>	/* snprintf */
 #include <assert.h>
+#include <sys/mman.h>	/* mmap */
+#include <sys/stat.h>	/* fstat */
+#include <fcntl.h>	/* open */
+#include <unistd.h>	/* close */
+#include <errno.h>
+#include <pthread.h>
 #include "xf-htable.h"
 #include "xf-escg.h"
+#include "ce-opt-phf.h"
+#include "opt-phf.h"	/* generated by tools/optphf.c */
 
 int optarg_bool(const char *a)
 {
@@ -47,6 +58,122 @@ int optarg_bool(const char *a)
 	return -1;
 }
 
+/* tunable_set() serialized */
+static pthread_mutex_t tunable_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static bool tunable_in_bounds(const struct tunable *t, long long v)
+{
+	if (t->type == TUNABLE_BOOL)
+		return v == 0 || v == 1;
+	if (!t->min && !t->max)
+		return true;
+	if (t->type == TUNABLE_SIZE)
+		return TUNABLE_W(v) >= t->min && TUNABLE_W(v) <= t->max
+			&& TUNABLE_H(v) >= t->min && TUNABLE_H(v) <= t->max;
+	return v >= t->min && v <= t->max;
+}
+
+int tunable_set(struct tunable *t, long long value)
+{
+	assert(t != NULL);
+	if (!tunable_in_bounds(t, value))
+		return -1;
+	pthread_mutex_lock(&tunable_mutex);
+	long long old = __atomic_exchange_n(&t->value, value, __ATOMIC_RELAXED);
+	if (t->changed && old != value)
+		t->changed(t, old);
+	pthread_mutex_unlock(&tunable_mutex);
+	return 0;
+}
+
+static const struct {
+	char unit[3];
+	long long ns;
+} tunable_units[] = {
+	{ "s", 1000000000 }, { "ms", 1000000 }, { "us", 1000 }, { "ns", 1 },
+};
+
+int tunable_parse(struct tunable *t, const char *arg)
+{
+	assert(t != NULL);
+	if (!arg && t->type != TUNABLE_BOOL)
+		return -1;
+	char *e;
+	long long v;
+	switch (t->type) {
+	case TUNABLE_INT:
+		errno = 0;
+		v = strtoll(arg, &e, 0);
+		if (errno || e == arg || *e)
+			return -1;
+		break;
+	case TUNABLE_BOOL:
+		v = arg ? optarg_bool(arg) : 1;
+		if (v < 0)
+			return -1;
+		break;
+	case TUNABLE_NS: {
+		double d = strtod(arg, &e);
+		int i, n = sizeof(tunable_units) / sizeof(tunable_units[0]);
+		for (i = 0; *e && i < n; i++) {
+			if (!strcmp(e, tunable_units[i].unit))
+				break;
+		}
+		if (e == arg || i == n || !(d >= 0))
+			return -1;
+		if (*e)
+			d *= tunable_units[i].ns;
+		if (d > 9e18)
+			return -1;
+		v = d + .5;
+		break;
+	}
+	case TUNABLE_SIZE: {
+		long w = strtol(arg, &e, 10), h;
+		if (e == arg)
+			return -1;
+		if (*e == 'x') {
+			const char *s = e + 1;
+			h = strtol(s, &e, 10);
+			if (e == s)
+				return -1;
+		} else {
+			long long o = tunable_get(t);
+			h = TUNABLE_W(o) ? (long long) w * TUNABLE_H(o)
+				/ TUNABLE_W(o) : w;
+		}
+		if (*e || w < 0 || h < 0 || w > INT32_MAX || h > INT32_MAX)
+			return -1;
+		v = TUNABLE_WH(w, h);
+		break;
+	}
+	default:
+		assert(false);
+		return -1;
+	}
+	return tunable_set(t, v);
+}
+
+int tunable_format(const struct tunable *t, char *buf, int size)
+{
+	assert(t != NULL);
+	long long v = tunable_get(t);
+	switch (t->type) {
+	case TUNABLE_BOOL:
+		return snprintf(buf, size, "%s", v ? "true" : "false");
+	case TUNABLE_NS: {
+		int i;
+		for (i = 0; v && v % tunable_units[i].ns; i++);
+		return snprintf(buf, size, "%lld%s", v / tunable_units[i].ns,
+				tunable_units[i].unit);
+	}
+	case TUNABLE_SIZE:
+		return snprintf(buf, size, "%dx%d", TUNABLE_W(v), TUNABLE_H(v));
+	default:
+		return snprintf(buf, size, "%lld", v);
+	}
+}
+
 /* Define optset and functions */
 static const int section_max = UINT8_MAX;
 static const int option_max = UINT8_MAX; /* max per section */
@@ -58,31 +185,49 @@ struct optid {
 	uint8_t optid;
 };
 struct optset {
+	pthread_mutex_t mutex; /* recursive, callbacks add options */
+	int live; /* depth of opt_live_begin() */
+	int live_rejected;
+	int live_skipped;
+
 	int section_size;
 	int section_length;
 	struct optsection **section_a;
 
+	/* the long names of opt_phf_name by slot, others in tbl_long */
+	struct optid phf_a[OPT_PHF_SLOTS];
 	struct xf_htable tbl_long;
 
-	int shrt_size;
-	int shrt_length;
-	struct {
-		char nshrt;
-		struct optid opti;
-	} *shrt_a;
+	/* the short names by character */
+	struct optid shrt_a[UINT8_MAX + 1];
+};
+static const struct optid optid_none = {
+	.sectid = UINT8_MAX, /* section_max */
+	.optid = UINT8_MAX, /* option_max */
 };
+
 struct optset *optset_construct(struct optset *set, int sect_size)
 {
 	assert(set != NULL);
 	assert(sect_size > 0);
 
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&set->mutex, &attr);
+	pthread_mutexattr_destroy(&attr);
+	set->live = 0;
+	set->live_rejected = 0;
+	set->live_skipped = 0;
+
 	set->section_size = sect_size;
 	set->section_length = 0;
 	set->section_a = malloc(sect_size * sizeof(struct optsection *));
 
-	set->shrt_size = 6;
-	set->shrt_length = 0;
-	set->shrt_a = malloc(sizeof(set->shrt_a[0]) * set->shrt_size);
+	for (int i = 0; i < OPT_PHF_SLOTS; i++)
+		set->phf_a[i] = optid_none;
+	for (int i = 0; i <= UINT8_MAX; i++)
+		set->shrt_a[i] = optid_none;
 
 	xf_htable_construct(&set->tbl_long, 4 /* 16bck */,
 			sizeof(struct optid), xf_hash_hsieh_superfast);
@@ -91,72 +236,104 @@ struct optset *optset_construct(struct optset *set, int sect_size)
 
 void optset_destruct(struct optset *set)
 {
-	assert(set != NULL && set->section_a != NULL && set->shrt_a != NULL);
+	assert(set != NULL && set->section_a != NULL);
+	opt_set_name(set, NULL);
 	free(set->section_a);
 	xf_htable_destruct(&set->tbl_long);
-	free(set->shrt_a);
+	pthread_mutex_destroy(&set->mutex);
 #ifndef NDEBUG
 	set->section_a = NULL;
-	set->shrt_a = NULL;
 #endif
 }
 
-static int opt_nshrt_add(struct optset *set, char nshrt, struct optid opti)
+/* the sets named by opt_set_name() */
+#define NAMED_MAX 16
+static struct {
+	const char *name;
+	struct optset *set;
+} named_a[NAMED_MAX];
+static pthread_mutex_t named_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+int opt_set_name(struct optset *set, const char *name)
 {
-	int i;
-	for (i = 0; i < set->shrt_length && set->shrt_a[i].nshrt < nshrt; i++);
-	if (i < set->shrt_length && set->shrt_a[i].nshrt == nshrt)
-		return 1;
+	assert(set != NULL);
+	int free_i = -1;
+	pthread_mutex_lock(&named_mutex);
+	for (int i = 0; i < NAMED_MAX; i++) {
+		if (!named_a[i].set || named_a[i].set == set) {
+			if (free_i < 0)
+				free_i = i;
+		} else if (name && !strcmp(named_a[i].name, name)) {
+			pthread_mutex_unlock(&named_mutex);
+			return -1;
+		}
+	}
+	if (name && free_i < 0) {
+		pthread_mutex_unlock(&named_mutex);
+		return -1;
+	}
+	for (int i = 0; i < NAMED_MAX; i++) {
+		if (named_a[i].set == set)
+			named_a[i].set = NULL;
+	}
+	if (name) {
+		named_a[free_i].name = name;
+		named_a[free_i].set = set;
+	}
+	pthread_mutex_unlock(&named_mutex);
+	return 0;
+}
 
-	if (set->shrt_length >= set->shrt_size) {
-		set->shrt_size *= 2;
-		set->shrt_a = realloc(set->shrt_a,
-				sizeof(set->shrt_a[0]) * set->shrt_size);
-		assert(set->shrt_a != NULL);
+struct optset *opt_set_find(const char *name)
+{
+	assert(name != NULL);
+	struct optset *set = NULL;
+	pthread_mutex_lock(&named_mutex);
+	for (int i = 0; i < NAMED_MAX && !set; i++) {
+		if (named_a[i].set && !strcmp(named_a[i].name, name))
+			set = named_a[i].set;
 	}
+	pthread_mutex_unlock(&named_mutex);
+	return set;
+}
 
-	memmove(set->shrt_a + i + 1, set->shrt_a + i,
-			(set->shrt_length - i) * sizeof(set->shrt_a[0]));
-	set->shrt_length++;
-	set->shrt_a[i].nshrt = nshrt;
-	set->shrt_a[i].opti = opti;
+static int opt_nshrt_add(struct optset *set, char nshrt, struct optid opti)
+{
+	struct optid *o = set->shrt_a + (unsigned char) nshrt;
+	if (o->sectid != section_max)
+		return 1;
+	*o = opti;
 	return 0;
 }
 static void opt_nshrt_rm_sectid(struct optset *set, int sectid)
 {
-	int i;
-	for (i = set->shrt_length - 1; i >= 0; i--) {
-		if (set->shrt_a[i].opti.sectid != sectid)
-			continue;
-		memmove(set->shrt_a + i, set->shrt_a + i + 1,
-				sizeof(set->shrt_a[0]) * (set->shrt_length - i - 1));
-		set->shrt_length--;
+	for (int i = 0; i <= UINT8_MAX; i++) {
+		if (set->shrt_a[i].sectid == sectid)
+			set->shrt_a[i] = optid_none;
 	}
 }
 static struct optid opt_nshrt_find(struct optset *set, char nshrt)
 {
-	/* binary search */
-	int imin = 0, imax = set->shrt_length - 1;
-	while (imin < imax) {
-		int imid = (imin + imax) / 2;
-		assert(imin < imax);
-		if (set->shrt_a[imid].nshrt < nshrt)
-			imin = imid + 1;
-		else
-			imax = imid;
-	}
-	if (imin == imax && set->shrt_a[imin].nshrt == nshrt)
-		return set->shrt_a[imin].opti;
+	return set->shrt_a[(unsigned char) nshrt];
+}
 
-	/* linear search
-	int i;
-	for (i = 0; i < set->shrt_length; i++) {
-		if (set->shrt_a[i].nshrt != nshrt)
-			continue;
-		return set->shrt_a[i].opti;
-	};
-	*/
-	return (struct optid) { .sectid = section_max, .optid = option_max };
+/**
+ * opt_phf_find() - find the perfect hash slot of a long name
+ * @nlong:	the name
+ * @nlong_len:	length of @nlong
+ *
+ * Return:	the slot of @nlong in opt_phf_name or %-1 if it isn't one of
+ *		the names known when built
+ */
+static int opt_phf_find(const char *nlong, int nlong_len)
+{
+	uint64_t h = opt_phf_hash(nlong, nlong_len);
+	uint32_t b = opt_phf_bucket(h, OPT_PHF_BUCKETS);
+	uint32_t i = opt_phf_slot(h, opt_phf_seed[b], OPT_PHF_SLOTS);
+	if (opt_phf_len[i] != nlong_len
+			|| memcmp(opt_phf_name[i], nlong, nlong_len))
+		return -1;
+	return i;
 }
 static int opt_nlong_add(struct optset *set, const char *nlong, int nlong_len,
 		struct optid opti)
@@ -166,17 +343,28 @@ static int opt_nlong_add(struct optset *set, const char *nlong, int nlong_len,
 				nlong_max, set, nlong);
 		return 2;
 	}
-	int a = xf_htable_add(&set->tbl_long, nlong, nlong_len, &opti);
+	int p = opt_phf_find(nlong, nlong_len);
+	int a = p < 0 ? xf_htable_add(&set->tbl_long, nlong, nlong_len, &opti)
+		: set->phf_a[p].sectid != section_max ? XF_HTABLE_ESET
+		: XF_HTABLE_ESUCCESS;
 	if (a == XF_HTABLE_ESET)
 		lprintf(ERR "opt '"lBLD_"%s"_lBLD"' duplicate entry for set %p\n",
 				nlong, set);
 	else if (a == XF_HTABLE_EFULL)
 		lprintf(ERR "opt htable bucket full for set %p\n", set);
+	else if (p >= 0)
+		set->phf_a[p] = opti;
 
 	return !(XF_HTABLE_ESUCCESS == a);
 }
 static int opt_nlong_rm(struct optset *set, const char *nlong, int nlong_len)
 {
+	int p = opt_phf_find(nlong, nlong_len);
+	if (p >= 0) {
+		int x = set->phf_a[p].sectid == section_max;
+		set->phf_a[p] = optid_none;
+		return x;
+	}
 	int x =  !(XF_HTABLE_ESUCCESS == xf_htable_remove(&set->tbl_long, nlong, nlong_len));
 	/*void *p = xf_htable_find(&set->tbl_long, nlong, nlong_len);
 	lprintf(DBG "rm %i :: find"lF_BLUE"%p"_lF"\n", x, p);*/
@@ -184,19 +372,22 @@ static int opt_nlong_rm(struct optset *set, const char *nlong, int nlong_len)
 }
 static struct optid opt_nlong_find(struct optset *set, const char *nlong, int nlong_len)
 {
+	int p = opt_phf_find(nlong, nlong_len);
+	if (p >= 0)
+		return set->phf_a[p];
 	struct optid *fnd = (struct optid *)
 		xf_htable_find(&set->tbl_long, nlong, nlong_len);
 	if (fnd == NULL)
-		return (struct optid) { .sectid = section_max, .optid = option_max };
+		return optid_none;
 	return *fnd;
 }
 
 static int opt_rm_lim(struct optset *set, struct optsection *sect, int lim);
-int opt_add(struct optset *set, struct optsection *sect)
+static int opt_add_unlocked(struct optset *set,
+		struct optsection *sect)
 {
 	assert(set != NULL && set->section_a != NULL);
 	assert(sect != NULL);
-	assert(sect->callback != NULL);
 
 	int i;
 #ifndef NDEBUG
@@ -230,6 +421,8 @@ int opt_add(struct optset *set, struct optsection *sect)
 			break;
 		}
 		struct opt* o = sect->opt_a + i;
+		assert(o->tunable ? o->has_arg != ARG_NONE
+				: sect->callback != NULL);
 
 		/* Verify argument name in .help */
 		if (o->has_arg) {
@@ -260,6 +453,14 @@ int opt_add(struct optset *set, struct optsection *sect)
 	}
 	return 0;
 }
+
+int opt_add(struct optset *set, struct optsection *sect)
+{
+	pthread_mutex_lock(&set->mutex);
+	int rv = opt_add_unlocked(set, sect);
+	pthread_mutex_unlock(&set->mutex);
+	return rv;
+}
 static int opt_rm_lim(struct optset *set, struct optsection *sect, int lim)
 {
 	struct optsection *s = NULL;
@@ -291,7 +492,10 @@ int opt_rm(struct optset *set, struct optsection *sect)
 	assert(set != NULL && set->section_a != NULL);
 	assert(sect != NULL);
 
-	return opt_rm_lim(set, sect, -1);
+	pthread_mutex_lock(&set->mutex);
+	int rv = opt_rm_lim(set, sect, -1);
+	pthread_mutex_unlock(&set->mutex);
+	return rv;
 }
 
 static int opt_help_i(struct optset *set, struct optid opti, int colspacing);
@@ -299,6 +503,7 @@ int opt_display(struct optset *set)
 {
 	/*   --log-stderr-thres  LOGLVL */
 	int i, e;
+	pthread_mutex_lock(&set->mutex);
 	for (i = 0; i < set->section_length; i++) {
 		if (set->section_a[i]->label)
 			continue;
@@ -314,6 +519,7 @@ int opt_display(struct optset *set)
 		for (e = 0; oa[e].name_short || oa[e].name_long; e++)
 			opt_help_i(set, (struct optid) { .sectid = i, .optid = e, }, 28);
 	}
+	pthread_mutex_unlock(&set->mutex);
 	return 0;
 }
 static int opt_help_i(struct optset *set, struct optid opti, int colspacing)
@@ -352,11 +558,59 @@ static int opt_help_i(struct optset *set, struct optid opti, int colspacing)
 	}
 	assert(n + 1 < blen); /* otherwise memoryleak */
 
-
-	lprintf(TXT "  "lBLD_"%-*s"_lBLD"  %s\n", colspacing + off, b, o->help + helpoff);
+	char val[48] = "";
+	if (o->tunable) {
+		char v[32];
+		tunable_format(o->tunable, v, sizeof(v));
+		snprintf(val, sizeof(val), " ["lF_BLUE"%s"_lF"]", v);
+	}
+	lprintf(TXT "  "lBLD_"%-*s"_lBLD"  %s%s\n", colspacing + off, b,
+			o->help + helpoff, val);
 	return 0;
 }
-int opt_parse(struct optset *set, int argc, char * const argv[], int offset)
+
+/**
+ * opt_call() - trigger an option
+ * @set:	the option set
+ * @opti:	the option
+ * @arg:	its argument or %NULL
+ *
+ * Sets the tunable of the option or calls back its section, showing the
+ * help of the option if it's rejected. While live, the options of the
+ * sections not &optsection.live are skipped, the rejected and skipped
+ * options are counted.
+ *
+ * Return:	non-zero if the option was rejected
+ */
+static int opt_call(struct optset *set, struct optid opti, const char *arg)
+{
+	struct optsection *sect = set->section_a[opti.sectid];
+	struct opt *o = sect->opt_a + opti.optid;
+	struct tunable *t = o->tunable;
+	int u;
+	if (set->live && !t && !sect->live) {
+		const char *name = o->name_long ? o->name_long : &o->name_short;
+		lprintf(DBG "Option \""lBLD_"%s%.*s"_lBLD"\" can't be changed "
+				"while running.\n", o->name_long ? "--" : "-",
+				o->name_long ? (int) strlen(name) : 1, name);
+		set->live_skipped++;
+		return 1;
+	}
+	if (t) {
+		u = tunable_parse(t, arg);
+		if (u)
+			lprintf(ERR "Invalid value \""lF_RED"%s"_lF"\".\n",
+					arg ? arg : "");
+	} else {
+		u = sect->callback(opti.optid, arg);
+	}
+	if (u)	opt_help_i(set, opti, 0);
+	if (u && set->live)
+		set->live_rejected++;
+	return u;
+}
+static int opt_parse_unlocked(struct optset *set, int argc,
+		char * const argv[], int offset)
 {
 	assert(argv != NULL);
 
@@ -386,8 +640,7 @@ int opt_parse(struct optset *set, int argc, char * const argv[], int offset)
 					continue;
 				}
 				z = a + e + 1;
-				int u = set->section_a[opti.sectid]->callback(opti.optid, z);
-				if (u)	opt_help_i(set, opti, 0);
+				opt_call(set, opti, z);
 				continue;
 			}
 			assert(a[e] == '\0');
@@ -398,53 +651,42 @@ int opt_parse(struct optset *set, int argc, char * const argv[], int offset)
 					opt_help_i(set, opti, 0);
 					continue;
 				}
-				int u = set->section_a[opti.sectid]->callback(opti.optid,
-						argv[i + 1]);
-				if (u)	opt_help_i(set, opti, 0);
+				opt_call(set, opti, argv[i + 1]);
 				i++;
 				continue;
 			} else if (o->has_arg == ARG_NONE) {
-				int u = set->section_a[opti.sectid]->callback(opti.optid,
-						NULL);
-				if (u)	opt_help_i(set, opti, 0);
+				opt_call(set, opti, NULL);
 				continue;
 			}
 			assert(o->has_arg == ARG_OPTIONAL);
 			z = NULL;
 			if (i + 1 < argc && argv[i + 1][0] != '-')
-				z = argv[i + 1];
+				z = argv[++i];
 
-			int u = set->section_a[opti.sectid]->callback(opti.optid, z);
-			if (u)	opt_help_i(set, opti, 0);
+			opt_call(set, opti, z);
 			continue;
 		}
 		assert(a[1] != '-' && a[1] != '\0');
 		int e;
 		for (e = 1; a[e] != '\0'; e++) {
-			struct optid opti = opt_nshrt_find(set, a[1]);
+			struct optid opti = opt_nshrt_find(set, a[e]);
 			if (opti.sectid == section_max && opti.optid == option_max) {
-				lprintf(WRN "Unrecognized short option \"-"lF_RED"%c"_lF"\"\n", a[1]);
+				lprintf(WRN "Unrecognized short option \"-"lF_RED"%c"_lF"\"\n", a[e]);
 				break;
 			}
 			struct opt *o = set->section_a[opti.sectid]->opt_a + opti.optid;
 			if (!o->has_arg) {
-				int u = set->section_a[opti.sectid]->callback(opti.optid,
-						NULL);
-				if (u)	opt_help_i(set, opti, 0);
+				opt_call(set, opti, NULL);
 				continue;
 			}
 			if (a[e + 1] != '\0') {
-				int u = set->section_a[opti.sectid]->callback(opti.optid,
-						a + e + 1);
-				if (u)	opt_help_i(set, opti, 0);
+				opt_call(set, opti, a + e + 1);
 				break;
 			}
 
 			if (i + 1 >= argc) {
 				if (o->has_arg == ARG_OPTIONAL) {
-					int u = set->section_a[opti.sectid]->callback(opti.optid,
-							NULL);
-					if (u)	opt_help_i(set, opti, 0);
+					opt_call(set, opti, NULL);
 					break;
 				} else {
 					lprintf(ERR "Short option \"-"lF_RED"%c"_lF"\" requires "
@@ -455,14 +697,10 @@ int opt_parse(struct optset *set, int argc, char * const argv[], int offset)
 			}
 
 			if (o->has_arg == ARG_OPTIONAL && argv[i + 1][0] == '-') {
-				int u = set->section_a[opti.sectid]->callback(opti.optid,
-						NULL);
-				if (u)	opt_help_i(set, opti, 0);
+				opt_call(set, opti, NULL);
 				break;
 			}
-			int u = set->section_a[opti.sectid]->callback(opti.optid,
-					argv[i + 1]);
-			if (u)	opt_help_i(set, opti, 0);
+			opt_call(set, opti, argv[i + 1]);
 			i++;
 			break;
 		}
@@ -471,13 +709,196 @@ int opt_parse(struct optset *set, int argc, char * const argv[], int offset)
 	return i;
 }
 
+int opt_parse(struct optset *set, int argc, char * const argv[], int offset)
+{
+	pthread_mutex_lock(&set->mutex);
+	int rv = opt_parse_unlocked(set, argc, argv, offset);
+	pthread_mutex_unlock(&set->mutex);
+	return rv;
+}
+
+/**
+ * opt_apply() - call back an option given by name outside of argv
+ * @set:	the option set
+ * @name:	the option name, long or a single character for short
+ * @name_len:	length of @name
+ * @arg:	the argument or %NULL
+ * @where:	"file:line" or the variable, for the messages
+ *
+ * An %ARG_NONE option takes an optarg_bool() argument, a false one skips it.
+ *
+ * Return:	non-zero if the option was rejected
+ */
+static int opt_apply(struct optset *set, const char *name, int name_len,
+		const char *arg, const char *where)
+{
+	struct optid opti = name_len == 1 ? opt_nshrt_find(set, *name)
+		: opt_nlong_find(set, name, name_len);
+	if (opti.sectid == section_max && opti.optid == option_max) {
+		lprintf(WRN "%s: Unrecognized option \""lF_RED"%.*s"_lF"\".\n",
+				where, name_len, name);
+		return 1;
+	}
+	struct opt *o = set->section_a[opti.sectid]->opt_a + opti.optid;
+	if (o->has_arg == ARG_NONE && arg) {
+		int b = optarg_bool(arg);
+		if (b < 0) {
+			lprintf(ERR "%s: Option \""lF_RED"%.*s"_lF"\" takes no "
+					"argument but a boolean.\n", where,
+					name_len, name);
+			return 1;
+		}
+		if (!b)
+			return 0;
+		arg = NULL;
+	} else if (o->has_arg == ARG_REQUIRED && !arg) {
+		lprintf(ERR "%s: Option \""lF_RED"%.*s"_lF"\" requires an "
+				"argument.\n", where, name_len, name);
+		opt_help_i(set, opti, 0);
+		return 1;
+	}
+	return opt_call(set, opti, arg);
+}
+
+/* opt_parse_file() of files named in files */
+static int opt_file_depth = 0;
+static const int opt_file_depth_max = 8;
+
+static int opt_parse_file_unlocked(struct optset *set, const char *path)
+{
+	assert(set != NULL && path != NULL);
+	if (opt_file_depth >= opt_file_depth_max) {
+		lprintf(ERR "Options file "lBLD_"%s"_lBLD" nested too deep.\n",
+				path);
+		return -1;
+	}
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	struct stat st;
+	int r = fstat(fd, &st);
+	if (r < 0 || !S_ISREG(st.st_mode)) {
+		int e = r < 0 ? errno : EINVAL;
+		close(fd);
+		errno = e;
+		return -1;
+	}
+	size_t size = st.st_size;
+	/* private and writable to terminate the arguments in place */
+	char *map = size ? mmap(NULL, size, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE, fd, 0) : NULL;
+	close(fd);
+	if (map == MAP_FAILED)
+		return -1;
+
+	opt_file_depth++;
+	char *end = map + size, *s, *nl;
+	int line = 1, rejected = 0;
+	for (s = map; s < end; s = nl + 1, line++) {
+		nl = memchr(s, '\n', end - s);
+		if (!nl)
+			nl = end;
+		for (; s < nl && isspace(*s); s++);
+		if (s == nl || *s == '#')
+			continue;
+		if (nl - s > 2 && s[0] == '-' && s[1] == '-')
+			s += 2;
+		const char *name = s;
+		for (; s < nl && !isspace(*s) && *s != '='; s++);
+		int name_len = s - name;
+		for (; s < nl && isspace(*s); s++);
+		if (s < nl && *s == '=')
+			for (s++; s < nl && isspace(*s); s++);
+		char *e = nl;
+		for (; e > s && isspace(e[-1]); e--);
+
+		char where[strlen(path) + 16];
+		snprintf(where, sizeof(where), "%s:%d", path, line);
+		const char *arg = NULL;
+		char last[e == end ? e - s + 1 : 1];
+		if (e > s && e < end) {
+			*e = '\0';
+			arg = s;
+		} else if (e > s) { /* no newline at the end to overwrite */
+			memcpy(last, s, e - s);
+			last[e - s] = '\0';
+			arg = last;
+		}
+		rejected += !!opt_apply(set, name, name_len, arg, where);
+	}
+	opt_file_depth--;
+	if (size)
+		munmap(map, size);
+	return rejected;
+}
+
+int opt_parse_file(struct optset *set, const char *path)
+{
+	pthread_mutex_lock(&set->mutex);
+	int rv = opt_parse_file_unlocked(set, path);
+	pthread_mutex_unlock(&set->mutex);
+	return rv;
+}
+
+extern char **environ;
+
+int opt_parse_env(struct optset *set, const char *prefix)
+{
+	assert(set != NULL && prefix != NULL);
+	int plen = strlen(prefix), rejected = 0;
+	pthread_mutex_lock(&set->mutex);
+	for (char **v = environ; *v; v++) {
+		if (strncmp(*v, prefix, plen))
+			continue;
+		const char *eq = strchr(*v, '=');
+		int name_len = eq - *v - plen;
+		if (!eq || name_len <= 0 || name_len > nlong_max)
+			continue;
+		char name[name_len];
+		for (int i = 0; i < name_len; i++) {
+			char c = (*v)[plen + i];
+			name[i] = c == '_' ? '-' : tolower(c);
+		}
+		char where[eq - *v + 1];
+		memcpy(where, *v, eq - *v);
+		where[eq - *v] = '\0';
+		rejected += !!opt_apply(set, name, name_len,
+				eq[1] ? eq + 1 : NULL, where);
+	}
+	pthread_mutex_unlock(&set->mutex);
+	return rejected;
+}
+
+void opt_live_begin(struct optset *set)
+{
+	assert(set != NULL);
+	pthread_mutex_lock(&set->mutex);
+	if (!set->live++) {
+		set->live_rejected = 0;
+		set->live_skipped = 0;
+	}
+}
+
+int opt_live_end(struct optset *set, int *skipped)
+{
+	assert(set != NULL && set->live > 0);
+	int rejected = set->live_rejected;
+	if (skipped)
+		*skipped = set->live_skipped;
+	set->live--;
+	pthread_mutex_unlock(&set->mutex);
+	return rejected;
+}
+
 /* ce_options */
 struct optset *ce_options = &(struct optset) {  };
 static int ce_options_helpcb(int index, const char *optarg)
 {
+	assert(index == 0);
 	opt_display(ce_options);
 	return 0;
 }
+/* not live, not displayed again by each reload */
 static struct optsection ce_options_help = {
 	.label = NULL,
 	.callback = ce_options_helpcb,
@@ -486,16 +907,37 @@ static struct optsection ce_options_help = {
 		{ 0, 0, NULL, NULL },
 	},
 };
+static int ce_options_configcb(int index, const char *optarg)
+{
+	assert(index == 0);
+	if (opt_parse_file(ce_options, optarg) < 0)
+		lprintf(ERR "Failed to read options from "lBLD_"%s"_lBLD".\n",
+				optarg);
+	return 0;
+}
+static struct optsection ce_options_config = {
+	.label = NULL,
+	.callback = ce_options_configcb,
+	.live = 1,
+	.opt_a = {
+		{ ARG_REQUIRED, '\0', "config", "FILE\t"
+			"Read options from FILE, a \"name = value\" a line." },
+		{ 0, 0, NULL, NULL },
+	},
+};
 
 __attribute__((constructor(120))) static void ce_opt_init()
 {
 	struct optset *os = optset_construct(ce_options, 3);
 	assert(os != NULL && os == ce_options);
+	opt_set_name(os, "ce");
 	opt_add(os, &ce_options_help);
+	opt_add(os, &ce_options_config);
 }
 
 __attribute__((destructor(120))) static void ce_opt_exit()
 {
+	opt_rm(ce_options, &ce_options_config);
 	opt_rm(ce_options, &ce_options_help);
 	optset_destruct(ce_options);
 }
@@ -6,3 +6,4 @@ SRC += core/mod.c
 SRC += core/main.c
 SRC += core/dlib.c
 
+SRC += core/console.c
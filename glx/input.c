@@ -212,9 +212,7 @@ static void event_handle_raw(xcb_ge_generic_event_t *ge,
 	}
 }
 
-extern pthread_mutex_t win_mutex;
-extern int win_width;
-extern int win_height;
+extern struct tunable win_size;
 
 /**
  * event_feed_xlib() - feed a given event to the xlib wire listeners
@@ -371,14 +369,9 @@ static void event_handle(int *looping, xcb_generic_event_t *event,
 		xcb_expose_event_t *ex =
 		       (xcb_expose_event_t *) event;
 		/*lprintf(DBG "XCB_EXPOSE %ix%i\n", ex->width, ex->height);*/
-		bool resize = false;
-		pthread_mutex_lock(&win_mutex);
-		if (win_width != ex->width || win_height != ex->height) {
-			win_width = ex->width;
-			win_height = ex->height;
-			resize = true;
-		}
-		pthread_mutex_unlock(&win_mutex);
+		long long size = TUNABLE_WH(ex->width, ex->height);
+		bool resize = tunable_get(&win_size) != size
+			&& !tunable_set(&win_size, size);
 		event_feed_xlib(event);
 		if (resize) {
 			struct event_triggers_pt *pt = tri->trigs_a
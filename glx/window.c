@@ -4,23 +4,45 @@
 #include "ce-opt.h"
 
 #include <assert.h>
+#include <stdbool.h>
 #include <string.h>	/* memcpy */
 #include <stdlib.h>	/* malloc */
-#include <stdio.h>	/* sscanf */
+#include <stdio.h>	/* snprintf */
 #include <X11/Xlib.h>	/* Display */
 #include <GL/glx.h>	/* glXChooseVisual */
-#include <pthread.h>	/* pthread_mutex_lock */
 
 static char *dpy_name = NULL;
 static char *win_name = NULL;
 Display *glx_dpy = NULL;
-pthread_mutex_t win_mutex = PTHREAD_MUTEX_INITIALIZER;
-int win_width = 320;
-int win_height = 180;
+static void win_size_changed(struct tunable *t, long long old);
+/* the size of the window, kept by glx/input.c as it's resized */
+struct tunable win_size = {
+	TUNABLE_SIZE, .min = 1, .max = 32767, .value = TUNABLE_WH(320, 180),
+	.changed = win_size_changed,
+};
 Window glx_win;
+static bool win_open = false;
 GLXFBConfig glx_fbc;
 static int fbconfigs_show = 0;
 
+/**
+ * win_size_changed() - resize the window to a --resolution given while
+ *			running
+ * @t:		&win_size
+ * @old:	the size before
+ *
+ * Also called as glx/input.c follows the window being resized, the window
+ * then has the size already and X leaves it be.
+ */
+static void win_size_changed(struct tunable *t, long long old)
+{
+	long long size = tunable_get(t);
+	if (!__atomic_load_n(&win_open, __ATOMIC_ACQUIRE))
+		return; /* created with it */
+	XResizeWindow(glx_dpy, glx_win, TUNABLE_W(size), TUNABLE_H(size));
+	XFlush(glx_dpy);
+}
+
 void root_win_swapbuffers()
 {
 	glXSwapBuffers(glx_dpy, glx_win);
@@ -123,13 +145,10 @@ static int load()
 		.event_mask = 0,
 	};
 
-	int w, h;
-	pthread_mutex_lock(&win_mutex);
-	w = win_width;
-	h = win_height;
-	pthread_mutex_unlock(&win_mutex);
+	long long size = tunable_get(&win_size);
 	/* Create window */
-	glx_win = XCreateWindow(glx_dpy, root, 0, 0, w, h,
+	glx_win = XCreateWindow(glx_dpy, root, 0, 0,
+			TUNABLE_W(size), TUNABLE_H(size),
 			0, vis->depth, InputOutput, vis->visual,
 			CWBackPixel | CWBorderPixel | CWColormap,
 			&wattr);
@@ -140,6 +159,7 @@ static int load()
 
 	/* Open window */
 	XMapWindow(glx_dpy, glx_win);
+	__atomic_store_n(&win_open, true, __ATOMIC_RELEASE);
 
 exitpt: ;
 
@@ -151,6 +171,7 @@ exitpt: ;
 
 static int unload()
 {
+	__atomic_store_n(&win_open, false, __ATOMIC_RELEASE);
 	XDestroyWindow(glx_dpy, glx_win);
 	XCloseDisplay(glx_dpy);
 	return 0;
@@ -158,7 +179,7 @@ static int unload()
 
 static int optcb(int index, const char *optarg)
 {
-	assert(index >= 0 && index <= 3);
+	assert(index >= 0 && index <= 3 && index != 1);
 	switch (index) {
 	case 0:
 		assert(optarg != NULL);
@@ -167,25 +188,6 @@ static int optcb(int index, const char *optarg)
 		int oa_len = strlen(optarg) + 1;
 		dpy_name = memcpy(malloc(oa_len), optarg, oa_len);
 		break;
-	case 1:
-		assert(optarg != NULL);
-		int w, h;
-		int r = sscanf(optarg, "%ix%i", &w, &h);
-		if (r == 0) {
-			lprintf(WRN "Unexpected argument for -r.\n");
-			return -1;
-		} else if (r == 1) {
-			pthread_mutex_lock(&win_mutex);
-			win_width = w;
-			win_height = (int) (w / 16.f * 9.f);
-			pthread_mutex_unlock(&win_mutex);
-		} else if (r == 2) {
-			pthread_mutex_lock(&win_mutex);
-			win_width = w;
-			win_height = h;
-			pthread_mutex_unlock(&win_mutex);
-		}
-		break;
 	case 2:
 		if (win_name)
 			free(win_name);
@@ -212,7 +214,7 @@ static struct optsection opts = {
 		{ ARG_REQUIRED, 'd', "display", "DISPLAY\t"
 			"Set the display to open the root window on." },
 		{ ARG_REQUIRED, 'r', "resolution", "WxH\t"
-			"Set the resolution of the root window." },
+			"Set the resolution of the root window.", &win_size },
 		{ ARG_OPTIONAL, 't', "title", "NAME\t"
 			"Set the name for root window." },
 		{ ARG_NONE, 'b', "fbconfigs",
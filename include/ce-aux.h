@@ -81,4 +81,187 @@ int lprintf(const char *format, ...)
  */
 int lputs(const char *s);
 
+/**
+ * DOC: Log level filtering
+ * lprintf() and lputs() are macros that check a per-call-site cache before
+ * calling the functions, so a message of a disabled level costs a compare and
+ * a branch and its arguments are never evaluated. The cache is refreshed
+ * when @log_gen changes, that is, when a threshold or an override is changed
+ * (see ce-log.h).
+ *
+ * Pieces without a log line header follow the header of the line they
+ * continue. The level of a call site is taken from the format (or the lputs()
+ * string) it is first called with.
+ */
+
+/**
+ * struct log_site - per call site cache of the level filter
+ * @gen:	@log_gen the cache is valid for
+ * @lvl:	level character of the site or %0 for header-less pieces
+ * @on:		whether messages of the site pass the filter
+ * @origin:	"file.c+33:" of the call site
+ * @stat:	index of the site's statistics plus one, %0 until it has any
+ *		(see log_stats_report() in ce-log.h)
+ */
+struct log_site {
+	int gen;
+	int lvl;
+	int on;
+	const char *origin;
+	int stat;
+};
+
+extern int log_gen;
+extern __thread int log_line_on;
+extern __thread struct log_site *log_site_cur;
+void log_site_init(struct log_site *site, const char *fmt);
+
+static inline int log_site_pass(struct log_site *site, const char *fmt)
+{
+	if (__builtin_expect(__atomic_load_n(&site->gen, __ATOMIC_ACQUIRE)
+			!= __atomic_load_n(&log_gen, __ATOMIC_RELAXED), 0))
+		log_site_init(site, fmt);
+	if (site->lvl)
+		log_line_on = site->on;
+	log_site_cur = site;
+	return log_line_on;
+}
+
+#define _LOG_FMT(fmt, ...) (fmt)
+#define lprintf(...) __extension__ ({ \
+	static struct log_site _log_site = { .origin = _FI }; \
+	log_site_pass(&_log_site, _LOG_FMT(__VA_ARGS__, "")) \
+		? lprintf(__VA_ARGS__) : 0; \
+})
+#define lputs(s) __extension__ ({ \
+	static struct log_site _log_site = { .origin = _FI }; \
+	const char *_log_s = (s); \
+	log_site_pass(&_log_site, _log_s) ? lputs(_log_s) : 0; \
+})
+
+/**
+ * DOC: Structured logging
+ * lkv() logs a message with typed fields attached, which are kept unformatted
+ * along the line - the text logs get them rendered after the message as
+ * "key=value", the %LOGFILE_JSON files as JSON members and the binary log as
+ * raw values:
+ *
+ *	lkv(INF "Frame drawn", LKV_INT("frame", n), LKV_DUR("took", ns));
+ *
+ * The message is taken as is, not as a printf format, and should be a
+ * string literal starting with a level macro.
+ */
+
+/**
+ * enum log_field_type - type of the value of a &struct log_field
+ * @LOG_FIELD_INT:	a long long in @v.i
+ * @LOG_FIELD_FLOAT:	a double in @v.f
+ * @LOG_FIELD_STR:	a '\0' terminated string in @v.s
+ * @LOG_FIELD_DUR:	a duration in nanoseconds in @v.i
+ */
+enum log_field_type {
+	LOG_FIELD_INT,
+	LOG_FIELD_FLOAT,
+	LOG_FIELD_STR,
+	LOG_FIELD_DUR,
+};
+
+/**
+ * struct log_field - a typed key-value pair of a structured message
+ * @key:	name of the field
+ * @type:	see &enum log_field_type
+ * @v:		the value
+ */
+struct log_field {
+	const char *key;
+	int type;
+	union {
+		long long i;
+		double f;
+		const char *s;
+	} v;
+};
+
+#define LKV_INT(k, x) { (k), LOG_FIELD_INT, { .i = (x) } }
+#define LKV_FLOAT(k, x) { (k), LOG_FIELD_FLOAT, { .f = (x) } }
+#define LKV_STR(k, x) { (k), LOG_FIELD_STR, { .s = (x) } }
+#define LKV_DUR(k, x) { (k), LOG_FIELD_DUR, { .i = (x) } }
+
+/**
+ * log_kv() - log a message with fields
+ * @msg:	the message, starting with a level macro
+ * @fields:	the fields
+ * @count:	count of @fields
+ *
+ * Return:	characters written to log
+ */
+int log_kv(const char *msg, const struct log_field *fields, int count);
+
+/**
+ * lkv() - log a message with fields, filtered like lprintf()
+ * @msg:	the message, starting with a level macro
+ * @...:	the fields, LKV_INT(), LKV_FLOAT(), LKV_STR() or LKV_DUR()
+ */
+#define lkv(msg, ...) __extension__ ({ \
+	static struct log_site _log_site = { .origin = _FI }; \
+	log_site_pass(&_log_site, (msg)) ? log_kv((msg), \
+		(const struct log_field[]) { __VA_ARGS__ }, \
+		sizeof((const struct log_field[]) { __VA_ARGS__ }) \
+			/ sizeof(struct log_field)) : 0; \
+})
+
+/**
+ * DOC: Log rate limiting
+ * lprintf_rate() lets at most @n messages a second through from its call
+ * site, the first message let through after some were suppressed is
+ * preceded by a line from the same site with their count. lprintf_sample()
+ * lets through every @n-th message of its call site. Both are keyed on the
+ * call site's own counters, updated with atomics, and are checked only after
+ * the level filter has passed the message.
+ *
+ * Header-less pieces following a suppressed message are suppressed as well.
+ */
+
+/**
+ * struct log_rate - per call site rate limiting state
+ * @state:	the second of the current window in the upper 32 bits, the
+ *		messages let through in it in the lower ones; for sampling the
+ *		count of messages
+ * @suppressed:	messages suppressed since the last one let through
+ */
+struct log_rate {
+	unsigned long long state;
+	unsigned int suppressed;
+};
+
+int log_rate_pass(struct log_rate *rate, unsigned int n, const char *fmt);
+int log_sample_pass(struct log_rate *rate, unsigned int n);
+
+/**
+ * lprintf_rate() - lprintf() at most @n times a second from a call site
+ * @n:		messages a second to let through
+ * @...:	lprintf() arguments
+ */
+#define lprintf_rate(n, ...) __extension__ ({ \
+	static struct log_site _log_site = { .origin = _FI }; \
+	static struct log_rate _log_rate; \
+	log_site_pass(&_log_site, _LOG_FMT(__VA_ARGS__, "")) \
+		&& log_rate_pass(&_log_rate, (n), \
+				_LOG_FMT(__VA_ARGS__, "")) \
+		? lprintf(__VA_ARGS__) : 0; \
+})
+
+/**
+ * lprintf_sample() - lprintf() every @n-th message from a call site
+ * @n:		one message in @n is let through, all of them if %0
+ * @...:	lprintf() arguments
+ */
+#define lprintf_sample(n, ...) __extension__ ({ \
+	static struct log_site _log_site = { .origin = _FI }; \
+	static struct log_rate _log_rate; \
+	log_site_pass(&_log_site, _LOG_FMT(__VA_ARGS__, "")) \
+		&& log_sample_pass(&_log_rate, (n)) \
+		? lprintf(__VA_ARGS__) : 0; \
+})
+
 #endif /* ndef _CE_AUX_H */
@@ -0,0 +1,101 @@
+#ifndef _CE_CONSOLE_H
+#define _CE_CONSOLE_H 0,1,0
+/**
+ * DOC: ce-console.h
+ * A console gives options to the option sets of a running engine a line at
+ * a time, read from stdin (--console) or the connections to the --live
+ * socket. A line is the arguments of opt_parse(), optionally led by the
+ * name of the set (opt_set_find()), &ce_options if left out:
+ *
+ *	--log-level glx/=dbg
+ *	ce --load "scn-tri" --dump mod,mem
+ *	# a comment
+ *
+ * The arguments are split at the blanks; a part quoted in double or single
+ * quotes may hold blanks and a backslash escapes the next character outside
+ * the single quotes. The options are given between opt_live_begin() and
+ * opt_live_end() and each line is replied to with a line of its own:
+ *
+ *	ok
+ *	queued
+ *	rejected 1, not live 2
+ *	error: argument 3 is not an option
+ *
+ * A line is "queued" when an option was taken but is left for another
+ * thread to apply (console_queued()), as --load is for control().
+ *
+ * The lines are split and parsed in the buffer of the console, without
+ * allocating.
+ */
+#include <stddef.h> /* size_t */
+
+#define CONSOLE_LINE_MAX 4096
+#define CONSOLE_ARGS_MAX 64
+
+/**
+ * struct console - a console reading and replying to a file descriptor
+ * @fd_in:	descriptor the lines are read from
+ * @fd_out:	descriptor the replies are written to, may be @fd_in
+ * @length:	length of the line read so far in @buf
+ * @skip:	non-zero while skipping the rest of a line too long
+ * @buf:	the line read so far
+ */
+struct console {
+	int fd_in;
+	int fd_out;
+	int length;
+	int skip;
+	char buf[CONSOLE_LINE_MAX];
+};
+
+/**
+ * console_init() - initialize a console
+ * @c:		the console
+ * @fd_in:	descriptor to read the lines from
+ * @fd_out:	descriptor to write the replies to
+ */
+void console_init(struct console *c, int fd_in, int fd_out);
+
+/**
+ * console_read() - read from a console and run its complete lines
+ * @c:		the console
+ *
+ * Reads once, what is available; call when @c->fd_in is readable. A line
+ * left without a newline at the end of the input is run as well.
+ *
+ * Return:	Negative at the end of the input or on a read error.
+ */
+int console_read(struct console *c);
+
+/**
+ * console_split() - split a line into arguments, in place
+ * @line:	the line, terminated, overwritten with the arguments
+ * @argv:	set to the arguments
+ * @max:	size of @argv
+ *
+ * Return:	the count of arguments, or negative on failure: %-1 on more than
+ *		@max arguments, %-2 on an unterminated quote.
+ */
+int console_split(char *line, char *argv[], int max);
+
+/**
+ * console_queued() - mark an option of the line being run as queued
+ *
+ * Called by the option callbacks that leave the option to another thread,
+ * for console_exec() to reply "queued" rather than "ok"; does nothing
+ * outside console_exec().
+ */
+void console_queued();
+
+/**
+ * console_exec() - run a line
+ * @line:	the line, terminated, overwritten by console_split()
+ * @reply:	set to the reply, a terminated line, or "" for a blank line or
+ *		a comment
+ * @size:	size of @reply
+ *
+ * Return:	length of @reply
+ */
+int console_exec(char *line, char *reply, size_t size);
+
+#endif
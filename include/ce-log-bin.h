@@ -0,0 +1,200 @@
+#ifndef _CE_LOG_BIN_H
+#define _CE_LOG_BIN_H 0,1,0
+
+/**
+ * DOC: binary log format
+ * The binary log (log_bin_open()) stores the format string of every call
+ * site once and afterwards only the raw arguments of each message, leaving
+ * the printf-style formatting to the decoder (logdec).
+ *
+ * The file starts with a &struct log_bin_hdr, followed by records. All the
+ * integers are in the byte order of the logging host. Each record begins
+ * with two u32 values - the site id and the length of the record data that
+ * follows:
+ *
+ *	site %LOG_BIN_SITE_DEF:	u32 id, then the format string of the site
+ *				(without the terminating '\0')
+ *
+ *	any other site:		u32 thread, u64 nanoseconds since logstart,
+ *				then the arguments
+ *
+ * The arguments are stored in the order of the conversions in the format,
+ * '*' width and precision included, as given by log_bin_conv(): ints as
+ * i32, longs and pointers as i64, floating point as double and strings as
+ * a u32 length followed by the characters. The id of lputs() messages is
+ * %LOG_BIN_SITE_PUTS, its format is "%s\n".
+ *
+ * The records of lkv() messages have %LOG_BIN_KV set in their site id, the
+ * definition of the site holds the message. Their arguments are a u32 count
+ * of fields, each stored as u8 &enum log_field_type, u8 key length, the key
+ * and the value - i64 for ints and durations, double for floats and u32
+ * length followed by the characters for strings.
+ */
+#include "ce-aux.h" /* enum log_field_type */
+#include <stdint.h>
+#include <string.h>
+#include <stdio.h>
+
+/*
+ * A line without a valid "file+line:lvl:" header is logged after the
+ * %LOG_LINE_MISSING line as a WRN of the origin %LOG_LINE_UNKNOWN, by
+ * core/log.c and logdec alike.
+ */
+#define LOG_LINE_MISSING "core/log.c:5:((missing log line header))\n"
+#define LOG_LINE_UNKNOWN "unknown+33"
+
+#define LOG_BIN_MAGIC "CELOGBIN"
+#define LOG_BIN_VERSION 2
+
+#define LOG_BIN_SITE_DEF 0
+#define LOG_BIN_SITE_PUTS 1
+#define LOG_BIN_KV 0x80000000u
+
+/**
+ * struct log_bin_hdr - the beginning of a binary log file
+ * @magic:	%LOG_BIN_MAGIC
+ * @version:	%LOG_BIN_VERSION
+ * @flags:	unused, 0
+ * @logstart:	wall clock seconds of logstart
+ */
+struct log_bin_hdr {
+	char magic[8];
+	uint32_t version;
+	uint32_t flags;
+	uint64_t logstart;
+};
+
+/**
+ * enum log_bin_arg - the stored type of a conversion argument
+ * @LOG_BIN_NONE:	consumes no argument ("%%")
+ * @LOG_BIN_INT:	i32
+ * @LOG_BIN_LONG:	i64
+ * @LOG_BIN_DOUBLE:	double
+ * @LOG_BIN_STR:	u32 length and the characters
+ * @LOG_BIN_PTR:	i64
+ * @LOG_BIN_COUNT:	"%n", the pointer is skipped and nothing stored
+ */
+enum log_bin_arg {
+	LOG_BIN_NONE,
+	LOG_BIN_INT,
+	LOG_BIN_LONG,
+	LOG_BIN_DOUBLE,
+	LOG_BIN_STR,
+	LOG_BIN_PTR,
+	LOG_BIN_COUNT,
+};
+
+/**
+ * struct log_bin_spec - a parsed printf conversion specification
+ * @width_arg:	the width is given as an int argument ('*')
+ * @prec_arg:	the precision is given as an int argument ('.*')
+ * @prec:	the literal precision or -1
+ * @ldouble:	the argument is a long double ('L')
+ * @type:	see &enum log_bin_arg
+ */
+struct log_bin_spec {
+	int width_arg;
+	int prec_arg;
+	int prec;
+	int ldouble;
+	int type;
+};
+
+/**
+ * log_bin_conv() - parse a printf conversion specification
+ * @s:		pointer to the '%' starting the specification
+ * @spec:	the parsed specification
+ *
+ * Return:	pointer after the specification
+ */
+static inline const char *log_bin_conv(const char *s, struct log_bin_spec *spec)
+{
+	int lng = 0;
+	spec->width_arg = 0;
+	spec->prec_arg = 0;
+	spec->prec = -1;
+	spec->ldouble = 0;
+	for (s++; *s && strchr("-+ #0'", *s); s++); /* flags */
+	if (*s == '*') {
+		spec->width_arg = 1;
+		s++;
+	}
+	for (; *s >= '0' && *s <= '9'; s++);
+	if (*s == '.') {
+		s++;
+		if (*s == '*') {
+			spec->prec_arg = 1;
+			s++;
+		} else {
+			for (spec->prec = 0; *s >= '0' && *s <= '9'; s++)
+				spec->prec = spec->prec * 10 + *s - '0';
+		}
+	}
+	for (; *s && strchr("hljztL", *s); s++) {
+		if (*s == 'l' || *s == 'j' || *s == 'z' || *s == 't')
+			lng = 1;
+		else if (*s == 'L')
+			spec->ldouble = 1;
+	}
+	switch (*s) {
+	case 'd': case 'i': case 'u': case 'o': case 'x': case 'X':
+		spec->type = lng ? LOG_BIN_LONG : LOG_BIN_INT;
+		break;
+	case 'c':
+		spec->type = LOG_BIN_INT;
+		break;
+	case 'f': case 'F': case 'e': case 'E': case 'g': case 'G':
+	case 'a': case 'A':
+		spec->type = LOG_BIN_DOUBLE;
+		break;
+	case 's':
+		spec->type = LOG_BIN_STR;
+		break;
+	case 'p':
+		spec->type = LOG_BIN_PTR;
+		break;
+	case 'n':
+		spec->type = LOG_BIN_COUNT;
+		break;
+	case '\0':
+		spec->type = LOG_BIN_NONE;
+		return s;
+	default: /* '%' */
+		spec->type = LOG_BIN_NONE;
+		break;
+	}
+	return s + 1;
+}
+
+/**
+ * log_field_print() - render a number field value as in the text logs
+ * @s:		output buffer
+ * @n:		size of @s
+ * @type:	%LOG_FIELD_INT, %LOG_FIELD_FLOAT or %LOG_FIELD_DUR
+ * @i:		the value of int and duration fields
+ * @f:		the value of float fields
+ *
+ * Shared by core/log.c and logdec so that both render the fields alike.
+ *
+ * Return:	as snprintf()
+ */
+static inline int log_field_print(char *s, size_t n, int type, long long i,
+		double f)
+{
+	switch (type) {
+	case LOG_FIELD_INT:
+		return snprintf(s, n, "%lld", i);
+	case LOG_FIELD_FLOAT:
+		return snprintf(s, n, "%g", f);
+	default: /* LOG_FIELD_DUR */
+		if (i < 1000 && i > -1000)
+			return snprintf(s, n, "%lldns", i);
+		else if (i < 1000000 && i > -1000000)
+			return snprintf(s, n, "%.3fus", i / 1e3);
+		else if (i < 1000000000 && i > -1000000000)
+			return snprintf(s, n, "%.3fms", i / 1e6);
+		return snprintf(s, n, "%.3fs", i / 1e9);
+	}
+}
+
+#endif /* _CE_LOG_BIN_H */
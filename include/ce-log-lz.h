@@ -0,0 +1,177 @@
+#ifndef _CE_LOG_LZ_H
+#define _CE_LOG_LZ_H 0,1,0
+
+/**
+ * DOC: compressed log format
+ * The compressed log (log_lz_file_add()) holds the lines of the text logs,
+ * without the escape sequences, in blocks compressed each on its own with
+ * the codec of core/log-lz.c.
+ *
+ * The file starts with a &struct log_lz_hdr followed by the blocks, each a
+ * &struct log_lz_block and the compressed data. All the integers are in the
+ * byte order of the logging host. A block holds whole lines, unless a line
+ * is longer than a block, and records the time of its earliest and latest
+ * line, so a reader can bisect the file by time: from any offset the next
+ * block is found by scanning for %LOG_LZ_BLOCK_MAGIC and checking @check of
+ * the header, which also lets it skip a torn block.
+ *
+ * With %LOGFILE_INDEX a sidecar index "PATH.idx" is written along, a
+ * &struct log_lz_idx_hdr followed by records, each a u32 &enum
+ * log_lz_idx_type and a u32 length of the data that follows:
+ *
+ *	%LOG_LZ_IDX_ORIGIN:	u32 id, then the source file of an origin
+ *				("core/mod.c" of "core/mod.c+33")
+ *
+ *	%LOG_LZ_IDX_BLOCK:	&struct log_lz_idx_block, then the u32 ids of
+ *				the origins with lines in the block
+ *
+ * An origin is defined before the first block using it. The blocks written
+ * from a crash handler are left out of the index.
+ */
+#include <stdint.h>
+#include <stddef.h> /* offsetof */
+#include <string.h>
+
+#define LOG_LZ_MAGIC "CELOGLZ"
+#define LOG_LZ_VERSION 1
+#define LOG_LZ_BLOCK_MAGIC 0x4b4c5a4cu /* "LZLK" */
+#define LOG_LZ_IDX_MAGIC "CELZIDX"
+#define LOG_LZ_IDX_VERSION 1
+
+/**
+ * enum log_lz_block_flags - flags of a compressed log block
+ * @LOG_LZ_STORED:	the data is stored uncompressed, as it didn't
+ *			compress or was written from a crash handler
+ */
+enum log_lz_block_flags {
+	LOG_LZ_STORED = 1 << 0,
+};
+
+/**
+ * struct log_lz_hdr - the beginning of a compressed log file
+ * @magic:	%LOG_LZ_MAGIC
+ * @version:	%LOG_LZ_VERSION
+ * @block_size:	the largest decompressed length of a block
+ * @logstart:	wall clock seconds of logstart
+ */
+struct log_lz_hdr {
+	char magic[8];
+	uint32_t version;
+	uint32_t block_size;
+	uint64_t logstart;
+};
+
+/**
+ * struct log_lz_block - the header of a block
+ * @magic:	%LOG_LZ_BLOCK_MAGIC
+ * @flags:	&enum log_lz_block_flags
+ * @raw_length:	length of the block decompressed
+ * @length:	length of the data following the header
+ * @time:	nanoseconds since logstart of the earliest line
+ * @time_last:	nanoseconds since logstart of the latest line
+ * @lines:	count of lines
+ * @check:	log_lz_block_check() of the fields above
+ */
+struct log_lz_block {
+	uint32_t magic;
+	uint32_t flags;
+	uint32_t raw_length;
+	uint32_t length;
+	uint64_t time;
+	uint64_t time_last;
+	uint32_t lines;
+	uint32_t check;
+};
+
+/**
+ * log_lz_block_check() - get the check value of a block header
+ * @b:		the header
+ *
+ * Return:	FNV-1a of the header up to @check
+ */
+static inline uint32_t log_lz_block_check(const struct log_lz_block *b)
+{
+	const unsigned char *p = (const unsigned char *) b;
+	uint32_t h = 2166136261u;
+	for (int i = 0; i < (int) offsetof(struct log_lz_block, check); i++)
+		h = (h ^ p[i]) * 16777619u;
+	return h;
+}
+
+/**
+ * enum log_lz_idx_type - the type of an index record
+ * @LOG_LZ_IDX_ORIGIN:	defines the id of an origin
+ * @LOG_LZ_IDX_BLOCK:	describes a block
+ */
+enum log_lz_idx_type {
+	LOG_LZ_IDX_ORIGIN = 1,
+	LOG_LZ_IDX_BLOCK = 2,
+};
+
+/**
+ * struct log_lz_idx_hdr - the beginning of an index file
+ * @magic:	%LOG_LZ_IDX_MAGIC
+ * @version:	%LOG_LZ_IDX_VERSION
+ * @flags:	unused, 0
+ */
+struct log_lz_idx_hdr {
+	char magic[8];
+	uint32_t version;
+	uint32_t flags;
+};
+
+/**
+ * struct log_lz_idx_block - the index entry of a block
+ * @offset:	offset of the &struct log_lz_block in the compressed log
+ * @time:	nanoseconds since logstart of the earliest line
+ * @time_last:	nanoseconds since logstart of the latest line
+ * @lines:	count of lines
+ * @lvl_mask:	bit n set for lines of level '1' + n (bit 0 for %ERR)
+ * @lvl_lines:	count of lines of each level, %ERR first
+ * @origins:	count of the origin ids following
+ */
+struct log_lz_idx_block {
+	uint64_t offset;
+	uint64_t time;
+	uint64_t time_last;
+	uint32_t lines;
+	uint32_t lvl_mask;
+	uint32_t lvl_lines[5];
+	uint32_t origins;
+};
+
+/**
+ * log_lz_line_parse() - find the origin and level of a text log line
+ * @s:		the line, "[  12.345678]      core/mod.c+33 INF: ..."
+ * @end:	end of the text @s is in
+ * @origin:	set to the source file of the origin, "core/mod.c"
+ * @origin_len:	set to the length of @origin
+ *
+ * Return:	the level character or %0 if @s isn't a log line
+ */
+static inline int log_lz_line_parse(const char *s, const char *end,
+		const char **origin, int *origin_len)
+{
+	static const char lvls[] = "ERRWRNINFTXTDBG";
+	const char *c = memchr(s, ']', end - s < 32 ? end - s : 32);
+	if (!c)
+		return 0;
+	for (c++; c < end && *c == ' '; c++);
+	const char *o = c, *plus = NULL;
+	for (; c < end && *c != ' ' && *c != '\n'; c++) {
+		if (*c == '+')
+			plus = c;
+	}
+	if (end - c < 5 || c[4] != ':')
+		return 0;
+	for (int i = 0; i < 5; i++) {
+		if (memcmp(c + 1, lvls + 3 * i, 3))
+			continue;
+		*origin = o;
+		*origin_len = (plus ? plus : c) - o;
+		return '1' + i;
+	}
+	return 0;
+}
+
+#endif /* _CE_LOG_LZ_H */
@@ -9,19 +9,90 @@
  */
 #include "xf-escg.h"
 #include <stdio.h>
+#include <stddef.h>
 
 /**
  * enum log_file_flags - flags to use with log_file_add()
  * @LOGFILE_FILTER_SGR:	filters the escape sequences
  * @LOGFILE_AUTOCLOSE:	automatically close the file on log_file_rm()
+ * @LOGFILE_JSON:	write the lines as JSON objects, one per line, with the
+ *			fields of lkv() messages as members of "kv"
+ * @LOGFILE_INDEX:	write a sidecar index of the blocks, with
+ *			log_lz_file_add() only
  */
 enum log_file_flags {
 	LOGFILE_FILTER_SGR = 1 << 0,
 	LOGFILE_AUTOCLOSE = 1 << 1,
+	LOGFILE_JSON = 1 << 2,
+	LOGFILE_INDEX = 1 << 3,
+};
+
+struct log_field;
+
+/**
+ * struct log_fields - the fields of a line logged with lkv()
+ * @msg_len:	length of the message at the beginning of the line's body,
+ *		the rendered fields follow it
+ * @count:	count of @a
+ * @a:		the fields
+ */
+struct log_fields {
+	int msg_len;
+	int count;
+	const struct log_field *a;
+};
+
+/**
+ * struct log_line - a line of the log as passed to the listeners
+ * @time:	nanoseconds since the beginning of the program, monotonic
+ * @origin:	the origin of the line, "file.c+33" as given by the level
+ *		macros of ce-aux.h, not '\0' terminated
+ * @origin_len:	length of @origin
+ * @lvl:	the level character, '1' (%ERR) to '5' (%DBG)
+ * @body:	the message, ending with a '\n'
+ * @body_len:	length of @body
+ * @fields:	the fields of an lkv() line or %NULL
+ *
+ * The strings point into the logging thread's buffers and are only valid
+ * during the callback.
+ */
+struct log_line {
+	unsigned long long time;
+	const char *origin;
+	int origin_len;
+	int lvl;
+	const char *body;
+	int body_len;
+	const struct log_fields *fields;
 };
 
 /* ce-log.c */
 
+/**
+ * log_raw_listen_add() - listen in on logs
+ * @callb:	called with the new lines of the log, possibly from several
+ *		threads at once
+ *
+ * The listeners get the lines that pass the level filter of the call sites
+ * (see log_level_set()), regardless of the log file thresholds. Listeners
+ * can be added and removed while logging goes on, the logging threads don't
+ * wait for it.
+ */
+void log_raw_listen_add(void (*callb)(const struct log_line *ln, int count));
+
+/**
+ * log_raw_listen_rm() - remove a listening callback
+ * @callb:	callback to remove
+ *
+ * Waits for the calls to @callb in progress to return, so it mustn't be
+ * called from a listener.
+ *
+ * Return:	0 on success
+ *
+ *		1 when such callback is not listed
+ */
+int log_raw_listen_rm(void (*callb)(const struct log_line *ln, int count));
+
 /**
  * log_txt_file() - open a file for logs
  * @f:		an open file handle to start writing the logs to
@@ -40,4 +111,244 @@ int log_txt_file_add(FILE *f, int flags);
  */
 int log_txt_file_rm(int hndl);
 
+/**
+ * log_txt_file_threshold() - filter the messages of a log file by level
+ * @hndl:	handle returned by log_txt_file_add()
+ * @lvlmcro:	the least important level (%DBG, %INF, ...) to write
+ *
+ * Return:	negative on failure, the handle id on success
+ */
+int log_txt_file_threshold(int hndl, const char *lvlmcro);
+
+/**
+ * log_flush() - write out the lines held back in the log files' batches
+ *
+ * The text log files are written in batches, a batch is written when it
+ * fills up, when it holds an %ERR line, when a line is added to it after it
+ * has waited 50ms and, in asynchronous mode, when the writer thread runs out
+ * of lines. Lines to terminals aren't held back. In asynchronous mode, waits
+ * for the lines queued by now to be written as well. The blocks of the
+ * compressed files are written out too, and the log sockets are given up to
+ * a second each to send their queues.
+ */
+void log_flush();
+
+/**
+ * log_crash_enable() - drain the log when the program crashes
+ * @records:	count of the last lines the flight recorder keeps, %0 for none
+ * @lvlmcro:	the least important level (%DBG, %INF, ...) the flight
+ *		recorder keeps, regardless of the log file thresholds
+ *
+ * Catches the fatal signals (and %SIGTERM, %SIGINT) to write out the lines
+ * still held back in the batches and the asynchronous queues before the
+ * signal goes on to the handler installed before, or takes its default
+ * action. On a crash the flight recorder is dumped
+ * to the stderr (or stdout) log. The recorder is allocated by the first call
+ * asking for one, later calls only change its level.
+ *
+ * Return:	negative on failure
+ */
+int log_crash_enable(int records, const char *lvlmcro);
+
+/**
+ * log_stats_enable() - count the messages of each call site
+ * @on:		whether to count
+ *
+ * The messages, bytes and the time spent formatting and writing them are
+ * counted per call site of the lprintf() family of macros. In asynchronous
+ * mode the writing time is the time spent queueing.
+ */
+void log_stats_enable(int on);
+
+/**
+ * log_stats_report() - log the call sites that took the most time
+ * @n:		count of sites to list, all if not positive
+ */
+void log_stats_report(int n);
+
+/**
+ * log_stderr_threshold() - filter the stderr (or stdout) log by level
+ * @lvlmcro:	the least important level (%DBG, %INF, ...) to write
+ */
+void log_stderr_threshold(const char *lvlmcro);
+
+/**
+ * log_mmap_file_add() - log to a memory-mapped file with rotation
+ * @path:	the file, (re)created
+ * @limit:	size at which the file is rotated, also preallocated
+ * @keep:	count of rotated files ("@path.1", "@path.2", ...) to keep
+ * @flags:	%LOGFILE_FILTER_SGR or %0
+ *
+ * The lines are copied into the mapping without locks or stdio buffering,
+ * so what was logged before a crash is in the file.
+ *
+ * Return:	negative on failure, the handle id on success
+ */
+int log_mmap_file_add(const char *path, size_t limit, int keep, int flags);
+
+/**
+ * log_mmap_file_rm() - close a memory-mapped log file
+ * @hndl:	handle returned by log_mmap_file_add()
+ *
+ * Return:	negative on failure, the handle id on success
+ */
+int log_mmap_file_rm(int hndl);
+
+/**
+ * log_mmap_file_threshold() - filter the messages of a memory-mapped file
+ * @hndl:	handle returned by log_mmap_file_add()
+ * @lvlmcro:	the least important level (%DBG, %INF, ...) to write
+ *
+ * Return:	negative on failure, the handle id on success
+ */
+int log_mmap_file_threshold(int hndl, const char *lvlmcro);
+
+/**
+ * log_lz_file_add() - log to a file compressed in blocks
+ * @path:	the file, (re)created
+ * @flags:	%LOGFILE_INDEX or %0
+ *
+ * The lines are written without the escape sequences, in blocks compressed
+ * on a thread of the file's own, see ce-log-lz.h for the format. A block is
+ * written when full, a second after its first line or on log_flush(). With
+ * %LOGFILE_INDEX the time range, levels and origins of each block are
+ * written to "@path.idx" for logunz to seek by.
+ *
+ * Return:	negative on failure, the handle id on success
+ */
+int log_lz_file_add(const char *path, int flags);
+
+/**
+ * log_lz_file_rm() - close a compressed log file
+ * @hndl:	handle returned by log_lz_file_add()
+ *
+ * Return:	negative on failure, the handle id on success
+ */
+int log_lz_file_rm(int hndl);
+
+/**
+ * log_lz_file_threshold() - filter the messages of a compressed file
+ * @hndl:	handle returned by log_lz_file_add()
+ * @lvlmcro:	the least important level (%DBG, %INF, ...) to write
+ *
+ * Return:	negative on failure, the handle id on success
+ */
+int log_lz_file_threshold(int hndl, const char *lvlmcro);
+
+/**
+ * log_sock_add() - stream the log to a collector on a Unix socket
+ * @path:	path of the collector's %SOCK_STREAM socket
+ * @flags:	%LOGFILE_JSON or %0
+ *
+ * The lines are sent without the escape sequences, or as JSON objects with
+ * %LOGFILE_JSON, one per line, from a thread of the socket's own that
+ * (re)connects to @path while it's away. The logging threads never wait for
+ * the collector: the lines that don't fit the queue of the socket (1MiB)
+ * are dropped.
+ *
+ * Return:	negative on failure, the handle id on success
+ */
+int log_sock_add(const char *path, int flags);
+
+/**
+ * log_sock_rm() - stop streaming to a log socket
+ * @hndl:	handle returned by log_sock_add()
+ *
+ * Sends what's queued unless the collector is away or stops reading.
+ *
+ * Return:	negative on failure, the handle id on success
+ */
+int log_sock_rm(int hndl);
+
+/**
+ * log_sock_threshold() - filter the messages of a log socket
+ * @hndl:	handle returned by log_sock_add()
+ * @lvlmcro:	the least important level (%DBG, %INF, ...) to send
+ *
+ * Return:	negative on failure, the handle id on success
+ */
+int log_sock_threshold(int hndl, const char *lvlmcro);
+
+/**
+ * log_level_set() - set the level threshold of lprintf() and lputs()
+ * @lvlmcro:	the least important level (%DBG, %INF, ...) to log
+ *
+ * Messages of the less important levels are dropped at the call site,
+ * before formatting. Defaults to %DBG, or %WRN with NDEBUG.
+ */
+void log_level_set(const char *lvlmcro);
+
+/**
+ * log_level_override() - set the level threshold of some call sites
+ * @origin:	a source file as in __FILE__ ("core/mod.c") or a directory
+ *		ending with '/' ("glx/")
+ * @lvlmcro:	the least important level to log from @origin, or %NULL to
+ *		remove the override
+ *
+ * Overrides log_level_set() for the matching call sites, the longest
+ * matching @origin wins.
+ *
+ * Return:	negative on failure
+ */
+int log_level_override(const char *origin, const char *lvlmcro);
+
+/**
+ * enum log_async_policy - what to do when the asynchronous queue is full
+ * @LOG_ASYNC_BLOCK:	wait for the writer thread to make room
+ * @LOG_ASYNC_DROP:	drop the message
+ * @LOG_ASYNC_COUNT:	drop the message and have the writer thread log how
+ *			many were dropped
+ */
+enum log_async_policy {
+	LOG_ASYNC_BLOCK,
+	LOG_ASYNC_DROP,
+	LOG_ASYNC_COUNT,
+};
+
+/**
+ * log_async_start() - write the logs from a background thread
+ * @policy:	see &enum log_async_policy
+ * @ring_size:	bytes of queue per logging thread, or %0 for the default
+ *		(64KiB)
+ *
+ * The logging threads then only copy their messages to a queue; the
+ * writer thread adds the headers and writes to the log files. If already
+ * started, only the @policy is changed.
+ *
+ * Return:	negative on failure
+ */
+int log_async_start(int policy, int ring_size);
+
+/**
+ * log_async_stop() - write the queued logs and return to synchronous mode
+ */
+void log_async_stop();
+
+/**
+ * log_bin_open() - record the logs to a binary file
+ * @path:	file to (re)create
+ *
+ * Only the call sites, timestamps and raw arguments of the messages are
+ * recorded, the formatting is left to the logdec tool. Replaces a binary
+ * log opened before.
+ *
+ * Return:	negative on failure
+ */
+int log_bin_open(const char *path);
+
+/**
+ * log_bin_close() - stop recording the binary log
+ */
+void log_bin_close();
+
+/**
+ * log_bin_text_threshold() - choose what is still formatted as text
+ * @lvlmcro:	the least important level (%DBG, %INF, ...) to also pass to
+ *		the text logs
+ *
+ * While a binary log is open, the less important messages are only
+ * recorded in it.
+ */
+void log_bin_text_threshold(const char *lvlmcro);
+
 #endif /* _CE_AUX_LOG_H */
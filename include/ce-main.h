@@ -0,0 +1,34 @@
+#ifndef _CE_MAIN_H
+#define _CE_MAIN_H 0,1,0
+/**
+ * DOC: ce-main.h
+ * After the --load of main(), the thread of main() is given over to the
+ * @control loop the loaded functionality set, until it returns. The --load
+ * and --dump given while running (the console, SIGHUP) use the module
+ * registry, which is that thread's, so they wait in a queue for the loop to
+ * call ce_main_tasks():
+ *
+ *	control = scn_loop;
+ *	control_wake = scn_wake;
+ *
+ * A loop that blocks sets @control_wake to a function waking it, called
+ * from any thread once a task is queued; the loop then calls
+ * ce_main_tasks() from its own thread. What is left queued once @control
+ * returns is not run.
+ */
+
+/* the loop given the thread of main(), set by the functionality loaded */
+extern int (*control)();
+
+/* wakes @control to call ce_main_tasks(), set along @control or NULL */
+extern void (*control_wake)();
+
+/**
+ * ce_main_tasks() - run the --load and --dump queued while running
+ *
+ * Call from the thread of main(), in @control; returns at once if nothing
+ * is queued.
+ */
+void ce_main_tasks();
+
+#endif /* _CE_MAIN_H */
@@ -95,4 +95,152 @@ int ce_mod_add(const struct ce_mod *mod);
 int ce_mod_rm(int mod_id);
 const char *ce_mod_strerr(int err);
 
+/**
+ * enum - module lifecycle event types
+ * @CE_MOD_EV_LOAD:	a module has been loaded
+ * @CE_MOD_EV_UNLOAD:	a module has been unloaded
+ * @CE_MOD_EV_FAIL:	loading a module failed, &struct ce_mod_event.%err
+ *			holds the error code (see ce_mod_strerr())
+ * @CE_MOD_EV_PROVIDER:	the provider of a functionality changed; for
+ *			variable functionalities ('fcn$') this is a rebind
+ *			such as 'control=colour-loop'
+ * @CE_MOD_EV_ALL:	all of the above
+ *
+ * These values are OR-ed together for the @events argument of
+ * ce_mod_listen().
+ */
+enum {
+	CE_MOD_EV_LOAD = 1 << 0,
+	CE_MOD_EV_UNLOAD = 1 << 1,
+	CE_MOD_EV_FAIL = 1 << 2,
+	CE_MOD_EV_PROVIDER = 1 << 3,
+	CE_MOD_EV_ALL = (1 << 4) - 1,
+};
+
+/**
+ * struct ce_mod_event - a module lifecycle event
+ * @type:	one of CE_MOD_EV_*
+ * @mod_id:	identifier of the module the event concerns, as returned by
+ *		ce_mod_add()
+ * @name_len:	length of @name
+ * @name:	non-terminated name of the module
+ * @err:	for %CE_MOD_EV_FAIL the error code, %0 otherwise
+ * @fcn_len:	length of @fcn
+ * @fcn:	for %CE_MOD_EV_PROVIDER the non-terminated name of the
+ *		functionality whose provider changed (the parent, 'control',
+ *		for a variable rebind), %NULL otherwise
+ * @bind_len:	length of @bind
+ * @bind:	for %CE_MOD_EV_PROVIDER the new binding - the expanding child
+ *		name ('colour-loop') for variable functionalities, the module
+ *		name otherwise; %NULL if the functionality is no longer
+ *		provided
+ *
+ * The strings are only valid for the duration of the callback.
+ */
+struct ce_mod_event {
+	int type;
+	int mod_id;
+	int name_len;
+	const char *name;
+	int err;
+	int fcn_len;
+	const char *fcn;
+	int bind_len;
+	const char *bind;
+};
+
+/**
+ * ce_mod_listen() - subscribe to module lifecycle events
+ * @callb:	function to call for each event, @arg is passed along
+ * @arg:	user pointer given to @callb
+ * @events:	CE_MOD_EV_* flags joined by bitwise OR
+ *
+ * The @callb is called on the thread that caused the event, from within
+ * module loading or unloading. Dispatching takes no locks, so the callback
+ * should not block.
+ *
+ * Return:	positive handle for ce_mod_unlisten() on success, negative on
+ *		failure
+ */
+int ce_mod_listen(void (*callb)(const struct ce_mod_event *ev, void *arg),
+		void *arg, int events);
+
+/**
+ * ce_mod_unlisten() - cancel a ce_mod_listen() subscription
+ * @hndl:	handle returned by ce_mod_listen()
+ *
+ * After this returns, @hndl's callback will not be called by events
+ * dispatched afterwards.
+ *
+ * Return:	%0 on success, negative if no such subscription exists
+ */
+int ce_mod_unlisten(int hndl);
+
+/**
+ * struct ce_mod_stats - module registry statistics
+ * @mods_registered:	modules added with ce_mod_add()
+ * @mods_loaded:	modules currently loaded
+ * @fcns:		functionalities known to the registry
+ * @fcns_loaded:	functionalities provided by a loaded module
+ * @refb_overflow:	reference counts that overflowed their 4-bit slots
+ * @scratch:		sizes in bytes of the registry's scratch buffers b1-b5
+ * @scratch_generic:	size in bytes of the generic scratch buffer
+ * @lookup_buckets:	bucket count of the functionality name lookup table
+ * @lookup_used:	buckets holding at least one name
+ * @lookup_chain_max:	names in the most crowded bucket
+ * @lookup_load:	names per bucket
+ * @resolves:		provider resolutions for a used functionality
+ * @retries:		provider load failures that led to trying another
+ *			provider
+ * @loads:		successful module loads
+ * @load_fails:		failed module loads
+ * @unloads:		module unloads
+ *
+ * The counters are kept at all times. @mods_loaded, @fcns_loaded and
+ * @resolves to @unloads are atomic and ce_mod_stats_counters() takes them
+ * from any thread; the rest describe the registry, which only the thread
+ * loading and unloading the modules may read with ce_mod_stats().
+ */
+struct ce_mod_stats {
+	int mods_registered;
+	int mods_loaded;
+	int fcns;
+	int fcns_loaded;
+	int refb_overflow;
+	int scratch[5];
+	int scratch_generic;
+	int lookup_buckets;
+	int lookup_used;
+	int lookup_chain_max;
+	float lookup_load;
+	unsigned long resolves;
+	unsigned long retries;
+	unsigned long loads;
+	unsigned long load_fails;
+	unsigned long unloads;
+};
+
+/**
+ * ce_mod_stats() - take a snapshot of the registry statistics
+ * @st:		where to store the snapshot
+ *
+ * Call from the thread loading and unloading the modules.
+ */
+void ce_mod_stats(struct ce_mod_stats *st);
+
+/**
+ * ce_mod_stats_counters() - take a snapshot of the atomic counters
+ * @st:		where to store the snapshot, the other fields zeroed
+ *
+ * Safe from any thread.
+ */
+void ce_mod_stats_counters(struct ce_mod_stats *st);
+
+/**
+ * ce_mod_stats_log() - log the registry statistics
+ * @full:	non-zero for those of ce_mod_stats(), else only the counters
+ *		of ce_mod_stats_counters()
+ */
+void ce_mod_stats_log(int full);
+
 #endif /* _CE_MOD_H */
@@ -0,0 +1,86 @@
+#ifndef _CE_OPT_PHF_H
+#define _CE_OPT_PHF_H 0,1,0
+
+/**
+ * DOC: option name perfect hash
+ * The long names of the options in the sources of the engine are known when
+ * it's built: tools/optphf.c generates a perfect hash of them into
+ * opt-phf.h of the build directory, so core/opt.c finds the slot of such a
+ * name with two hashes and a compare, its dynamic table left for the names
+ * of the libraries loaded at runtime.
+ *
+ * The hash is "hash and displace": a name is hashed once by opt_phf_hash(),
+ * the hash picks its bucket of %OPT_PHF_BUCKETS by opt_phf_bucket(), whose
+ * seed in @opt_phf_seed displaces the hash by opt_phf_slot() to the slot of
+ * the name of %OPT_PHF_SLOTS in @opt_phf_name, of the length in @opt_phf_len:
+ *
+ *	#define OPT_PHF_BUCKETS 8
+ *	#define OPT_PHF_SLOTS 37
+ *	static const uint16_t opt_phf_seed[OPT_PHF_BUCKETS] = { ... };
+ *	static const uint8_t opt_phf_len[OPT_PHF_SLOTS] = { ... };
+ *	static const char *const opt_phf_name[OPT_PHF_SLOTS] = { ... };
+ *
+ * The empty slots are "" of length %0. The names are hashed a word at a time
+ * in the byte order of the host, the generator runs where the engine does.
+ */
+#include <stdint.h>
+#include <string.h> /* memcpy */
+
+/**
+ * opt_phf_hash() - hash an option name
+ * @s:		the name
+ * @len:	length of @s
+ *
+ * Return:	the hash
+ */
+static inline uint64_t opt_phf_hash(const char *s, int len)
+{
+	uint64_t h = 0x9e3779b97f4a7c15ull ^ len, w = 0;
+	uint32_t a, b;
+	if (len >= 8) { /* the last word overlaps the one before */
+		for (int i = 0; i < len; i += 8) {
+			memcpy(&w, s + (i + 8 <= len ? i : len - 8), 8);
+			h = (h ^ w) * 0xff51afd7ed558ccdull;
+			h ^= h >> 32;
+		}
+		return h;
+	}
+	if (len >= 4) {
+		memcpy(&a, s, 4);
+		memcpy(&b, s + len - 4, 4);
+		w = (uint64_t) b << 32 | a;
+	} else if (len > 0) {
+		w = (unsigned char) s[0] | (unsigned char) s[len / 2] << 8
+			| (unsigned char) s[len - 1] << 16;
+	}
+	h = (h ^ w) * 0xff51afd7ed558ccdull;
+	return h ^ h >> 32;
+}
+
+/**
+ * opt_phf_bucket() - get the bucket of a name
+ * @h:		opt_phf_hash() of the name
+ * @buckets:	count of buckets
+ *
+ * Return:	the bucket, less than @buckets
+ */
+static inline uint32_t opt_phf_bucket(uint64_t h, uint32_t buckets)
+{
+	return (h >> 32) * buckets >> 32;
+}
+
+/**
+ * opt_phf_slot() - get the slot of a name
+ * @h:		opt_phf_hash() of the name
+ * @seed:	the seed of the bucket of the name
+ * @slots:	count of slots
+ *
+ * Return:	the slot, less than @slots
+ */
+static inline uint32_t opt_phf_slot(uint64_t h, uint32_t seed, uint32_t slots)
+{
+	uint64_t x = (h ^ seed * 0x9e3779b97f4a7c15ull) * 0xc4ceb9fe1a85ec53ull;
+	return (x >> 32) * slots >> 32;
+}
+
+#endif /* _CE_OPT_PHF_H */
@@ -1,12 +1,46 @@
 #ifndef _CE_OPT_H
-#define _CE_OPT_H 0,2,11
+#define _CE_OPT_H 0,5,0
 /**
  * DOC: ce-opt.h
  * A command-line argument based modular option mechanism.
  *
  * The input syntax of argc/v is that of getopt() with %POSIXLY_CORRECT.
  *
- * Triggering options happens via opt_parse().
+ * Triggering options happens via opt_parse(), opt_parse_file() and
+ * opt_parse_env(). Each calls the callbacks in the order the options are
+ * given, so of several sources the one parsed last takes precedence and an
+ * option can use the options added by the ones before it (-y libraries).
+ * The options files hold an option a line:
+ *
+ *	# comment
+ *	log-level = inf
+ *	dynamic-lib = scn/libscn.so
+ *	lsdevs
+ *
+ * the name is long or a single character for a short option, optionally
+ * prefixed with "--", the argument runs to the end of the line and the '='
+ * is optional.
+ */
+
+/**
+ * DOC: tunables
+ * A &struct tunable is a typed value an option sets, read with a single
+ * atomic load by tunable_get() so it can be tuned while the engine runs
+ * without the readers locking. It's given to an option of a section as
+ * @tunable of &struct opt; the option then sets it instead of calling the
+ * callback of the section, and its help shows the value:
+ *
+ *	static struct tunable frame_ns = {
+ *		TUNABLE_NS, .min = 1000, .max = 1000000000,
+ *		.value = 10*1000*1000,
+ *	};
+ *	...
+ *	{ ARG_REQUIRED, '\0', "colour-frame", "TIME\tFrame interval.",
+ *		&frame_ns },
+ *
+ * The values given are parsed and range checked by their type, and
+ * @changed of the tunable called with the old value once the new is
+ * stored, for those that need reconfiguring.
  */
 
 /**
@@ -21,6 +55,122 @@ struct optset;
  */
 extern struct optset *ce_options;
 
+/**
+ * optset_construct() - construct an option set
+ * @set:	memory for the set, of sizeof() the &struct optset in ce-opt.c
+ * @sect_size:	initial count of sections
+ *
+ * Return:	@set
+ */
+struct optset *optset_construct(struct optset *set, int sect_size);
+
+/**
+ * optset_destruct() - destruct an option set, also removing its name
+ * @set:	the set, its sections removed
+ */
+void optset_destruct(struct optset *set);
+
+/**
+ * opt_set_name() - name an option set for opt_set_find()
+ * @set:	the set
+ * @name:	its name, lasting until unnamed; %NULL unnames @set
+ *
+ * The console (ce-console.h) gives options to the set of the name leading a
+ * line. &ce_options is named "ce".
+ *
+ * Return:	Negative on failure: %-1 if @name is taken or too many sets are
+ *		named.
+ */
+int opt_set_name(struct optset *set, const char *name);
+
+/**
+ * opt_set_find() - find a named option set
+ * @name:	name of the set
+ *
+ * Return:	the set or %NULL
+ */
+struct optset *opt_set_find(const char *name);
+
+/**
+ * enum tunable_type - the type of a &struct tunable
+ * @TUNABLE_INT:	an integer, "-12", "0x40"
+ * @TUNABLE_BOOL:	%0 or %1 of optarg_bool(), no argument for %true
+ * @TUNABLE_NS:		a duration in nanoseconds, given with a unit of
+ *			ns, us, ms or s, "1.5ms"; ns when none
+ * @TUNABLE_SIZE:	width and height, "WxH", of TUNABLE_WH(); a width
+ *			alone keeps the aspect ratio of the value
+ */
+enum tunable_type {
+	TUNABLE_INT,
+	TUNABLE_BOOL,
+	TUNABLE_NS,
+	TUNABLE_SIZE,
+};
+
+#define TUNABLE_WH(w, h) ((long long) (w) << 32 | (unsigned int) (h))
+#define TUNABLE_W(v) ((int) ((v) >> 32))
+#define TUNABLE_H(v) ((int) ((v) & 0xffffffff))
+
+/**
+ * struct tunable - a value tunable while running
+ * @type:	&enum tunable_type
+ * @min:	the least value accepted, of each dimension for %TUNABLE_SIZE
+ * @max:	the greatest value accepted; no bounds if @min and @max are %0
+ * @changed:	optional, called after @value has been changed from @old;
+ *		mustn't set tunables itself
+ * @value:	the default, then the current value, read with tunable_get()
+ */
+struct tunable {
+	int type;
+	long long min, max;
+	void (*changed)(struct tunable *t, long long old);
+	long long value;
+};
+
+/**
+ * tunable_get() - read the current value of a tunable
+ * @t:		the tunable
+ *
+ * Return:	the value, for %TUNABLE_SIZE split with TUNABLE_W() and
+ *		TUNABLE_H()
+ */
+static inline long long tunable_get(const struct tunable *t)
+{
+	return __atomic_load_n(&t->value, __ATOMIC_RELAXED);
+}
+
+/**
+ * tunable_set() - set a tunable
+ * @t:		the tunable
+ * @value:	the new value
+ *
+ * The sets are serialized, the @changed callbacks see them in order.
+ *
+ * Return:	Negative if @value is out of the bounds of @t.
+ */
+int tunable_set(struct tunable *t, long long value);
+
+/**
+ * tunable_parse() - set a tunable from text
+ * @t:		the tunable
+ * @arg:	the value, by the &enum tunable_type of @t
+ *
+ * Return:	Negative if @arg is malformed or out of bounds.
+ */
+int tunable_parse(struct tunable *t, const char *arg);
+
+/**
+ * tunable_format() - write the value of a tunable as text
+ * @t:		the tunable
+ * @buf:	buffer to write to, terminated
+ * @size:	size of @buf
+ *
+ * The text is accepted by tunable_parse().
+ *
+ * Return:	the length of the text, as snprintf()
+ */
+int tunable_format(const struct tunable *t, char *buf, int size);
+
 enum {
 	ARG_NONE = 0,
 	ARG_REQUIRED = 1,
@@ -36,6 +186,8 @@ enum {
  *		line argument started with '--'
  * @help:	a short description of the option; if @has_arg, this must be
  *		prepended with 'ARGNAME\t'
+ * @tunable:	optional, the &struct tunable the option sets instead of
+ *		calling back; @has_arg mustn't be %ARG_NONE
  *
  * One of @name_short and @name_long may be %NULL (unset).
  */
@@ -44,6 +196,7 @@ struct opt {
 	char name_short;
 	const char *name_long;
 	const char *help;
+	struct tunable *tunable;
 };
 
 /**
@@ -51,12 +204,15 @@ struct opt {
  * @label:	the label unifying these options
  * @callback:	function to call when one of these options has been parsed;
  *		return any non-null value to print out the help string for
- *		given index
+ *		given index; may be %NULL if all the options set tunables
+ * @live:	non-zero if the options may be given again while running,
+ *		between opt_live_begin() and opt_live_end()
  * @opt_a:	array of options, terminated by { %0, %0, %NULL, %NULL }
  */
 struct optsection {
 	const char *label;
 	int (*callback)(int index, const char *optarg);
+	int live;
 
 	struct opt opt_a[];
 };
@@ -98,6 +254,56 @@ int opt_rm(struct optset *set, struct optsection *sect);
  */
 int opt_parse(struct optset *set, int argc, char * const argv[], int offset);
 
+/**
+ * opt_parse_file() - parse the options of a file
+ * @set:	the collection of target options
+ * @path:	the file, see the DOC of ce-opt.h for the syntax
+ *
+ * The file is mapped and scanned in place. The options are reported by
+ * "@path:line" on failure. An %ARG_NONE option may be given a boolean
+ * (optarg_bool()), it's skipped when false.
+ *
+ * Return:	Negative if the file couldn't be read, else the count of the
+ *		options rejected.
+ */
+int opt_parse_file(struct optset *set, const char *path);
+
+/**
+ * opt_parse_env() - parse the options of environment variables
+ * @set:	the collection of target options
+ * @prefix:	prefix of the variables, "CENGINE_"
+ *
+ * The name of an option is that of the variable without @prefix,
+ * lowercase and with the '_' replaced with '-': CENGINE_LOG_LEVEL=inf is
+ * --log-level=inf. An empty value is no argument.
+ *
+ * Return:	the count of the options rejected
+ */
+int opt_parse_env(struct optset *set, const char *prefix);
+
+/**
+ * opt_live_begin() - start giving options while running
+ * @set:	the option set
+ *
+ * Until opt_live_end(), the options parsed by this thread are applied only
+ * if their section is &optsection.live or they set a tunable, the others
+ * are skipped. Other threads wait to parse or add options to @set
+ * meanwhile. May be nested.
+ */
+void opt_live_begin(struct optset *set);
+
+/**
+ * opt_live_end() - end giving options while running
+ * @set:	the option set
+ * @skipped:	optional, set to the count of options skipped for not being
+ *		live
+ *
+ * The counts are of the options since the outermost opt_live_begin().
+ *
+ * Return:	the count of options rejected by their section
+ */
+int opt_live_end(struct optset *set, int *skipped);
+
 /**
  * optarg_bool() - check given string against acceptable boolean values
  * @optarg:	string to check
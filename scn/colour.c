@@ -9,6 +9,8 @@
 #include "xf-escg.h"	/* lF_WHI lBLD_ _lBLD _lF */
 #include "ce-aux.h"	/* __init lprintf */
 #include "ce-mod.h"	/* ce_mod_add */
+#include "ce-opt.h"	/* opt_add tunable_get */
+#include "ce-main.h"	/* control control_wake ce_main_tasks */
 #include "input.h"	/* input_add */
 #include <assert.h>
 #include <stdio.h>
@@ -25,12 +27,11 @@
 /* provided by root-window */
 extern void root_win_swapbuffers();
 
-/* control function called from main() after init */
-extern int (*control)();
-
 static pthread_mutex_t scn_mutex = PTHREAD_MUTEX_INITIALIZER;
 static pthread_cond_t scn_cond = PTHREAD_COND_INITIALIZER;
 static int progress = 0;
+/* set by scn_colour_wake() for the loop to run ce_main_tasks() */
+static int tasks = 0;
 
 static int input_cb(int n, int type, int x, int y);
 static struct inputset *input_set = NULL;
@@ -62,27 +63,40 @@ static struct inputsection *input_section_mot;
 
 static int input_section_active_mot;
 
+/* sleep between the frames */
+static struct tunable frame_ns = {
+	TUNABLE_NS, .min = 1000, .max = 1000*1000*1000,
+	.value = 10*1000*1000,
+};
+
+static struct optsection opts = {
+	.label = "Colour scene:",
+	.opt_a = {
+		{ ARG_REQUIRED, '\0', "colour-frame", "TIME\t"
+			"Sleep TIME between the frames (10ms).", &frame_ns },
+		{ 0, '\0', NULL, NULL },
+	},
+};
+
 static int scn_colour_loop()
 {
 	lprintf(INF "Reached colour scene loop, woo!\n");
-	struct timespec ts = {
-		.tv_sec = 0,
-		.tv_nsec = 10*1000*1000, /* 10ms */
-	};
+	struct timespec ts;
 	unsigned cnt = 0;
 	while (1) {
 		pthread_mutex_lock(&scn_mutex);
-		if (progress == -1) {
-			pthread_mutex_unlock(&scn_mutex);
-			break;
-		} else if (!progress) {
+		if (!progress && !tasks)
 			pthread_cond_wait(&scn_cond, &scn_mutex);
-			if (progress == -1) {
-				pthread_mutex_unlock(&scn_mutex);
-				break;
-			}
-		}
+		int p = progress, t = tasks;
+		tasks = 0;
 		pthread_mutex_unlock(&scn_mutex);
+		if (p == -1)
+			break;
+		if (t) {
+			ce_main_tasks();
+			if (!p)
+				continue; /* woken for the tasks only */
+		}
 
 		cnt++;
 		glClearColor( .5f, 0.f,
@@ -90,16 +104,27 @@ static int scn_colour_loop()
 				+ (cosf(cnt/6.f)) * .08f, 1.f);
 		glClear(GL_COLOR_BUFFER_BIT);
 		root_win_swapbuffers();
+		long long ns = tunable_get(&frame_ns);
+		ts.tv_sec = ns / (1000*1000*1000);
+		ts.tv_nsec = ns % (1000*1000*1000);
 		nanosleep(&ts, NULL);
 	}
 	glClearColor(0.f, 0.f, 0.f, 0.f);
 	glClear(GL_COLOR_BUFFER_BIT);
 	root_win_swapbuffers();
-	ts.tv_nsec = 300*1000*1000;
+	ts = (struct timespec) { .tv_nsec = 300*1000*1000 };
 	nanosleep(&ts, NULL);
 	return 0;
 }
 
+static void scn_colour_wake()
+{
+	pthread_mutex_lock(&scn_mutex);
+	tasks = 1;
+	pthread_cond_signal(&scn_cond);
+	pthread_mutex_unlock(&scn_mutex);
+}
+
 static int input_cb(int n, int type, int x, int y)
 {
 	if (n == 0) {
@@ -120,25 +145,9 @@ static int input_cb(int n, int type, int x, int y)
 		if (first)
 			lprintf(INF "Bye-bye.\n");
 	} else if (n == 2) {
-		struct timespec ts;
-		clock_gettime(CLOCK_REALTIME, &ts);
-		static struct timespec ts_last = {
-			.tv_sec = 0,
-			.tv_nsec = 0,
-		};
-		if (ts_last.tv_sec < ts.tv_sec || (ts_last.tv_sec == ts.tv_sec
-					&& ts_last.tv_nsec < ts.tv_nsec)) {
-			ts_last.tv_sec = ts.tv_sec;
-			ts_last.tv_nsec = ts.tv_nsec
-				+ 200 * 1000 * 1000; /* 200ms */
-			if (ts_last.tv_nsec >= 1000 * 1000 * 1000) {
-				ts_last.tv_sec += 1;
-				ts_last.tv_nsec -= 1000 * 1000 * 1000;
-			}
-			lprintf(TXT "Mouse movement (%s): %2i %2i\n",
-					(type == INPUT_EVENT_MOTION) ? "motion"
-						: "pointer", x, y);
-		}
+		lprintf_rate(5, TXT "Mouse movement (%s): %2i %2i\n",
+				(type == INPUT_EVENT_MOTION) ? "motion"
+					: "pointer", x, y);
 	} else if (n == 3) {
 		assert(type == INPUT_EVENT_FIRE);
 		lprintf(TXT "Mouse wheel up triggered! (pt %2i %2i)\n",
@@ -171,6 +180,7 @@ static int input_cb(int n, int type, int x, int y)
 static int load()
 {
 	control = scn_colour_loop;
+	control_wake = scn_colour_wake;
 	lprintf(INF lF_WHI lBLD_"scn~colour selected."_lBLD _lF"\n");
 
 	input_set = input_set_create();
@@ -211,9 +221,12 @@ static void __init code_load()
 	};
 	colour_mod_id = ce_mod_add(&m);
 	assert(colour_mod_id >= 0);
+	if (opt_add(ce_options, &opts) < 0)
+		lputs(ERR "Failed to add the colour scene options.");
 }
 
 static void __exit code_unload()
 {
+	opt_rm(ce_options, &opts);
 	ce_mod_rm(colour_mod_id);
 }
@@ -1,8 +1,12 @@
+/* required for clock_gettime with stdc99 */
+#define _POSIX_C_SOURCE 199309L
 
 #include "xf-escg.h"	/* lF_RED _lF */
 #include "ce-aux.h"	/* __init lprintf */
 #include "ce-mod.h"	/* ce_mod_add */
-#include <unistd.h>	/* sleep */
+#include "ce-main.h"	/* control control_wake ce_main_tasks */
+#include <pthread.h>
+#include <time.h>	/* clock_gettime */
 #include <assert.h>
 #include <stdbool.h>
 #include <stdlib.h>
@@ -15,6 +19,19 @@ void root_win_swapbuffers();
 
 static GLuint prg;
 
+static pthread_mutex_t scn_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t scn_cond = PTHREAD_COND_INITIALIZER;
+/* set by scn_wake() for the loop to run ce_main_tasks() */
+static int tasks = 0;
+
+static void scn_wake()
+{
+	pthread_mutex_lock(&scn_mutex);
+	tasks = 1;
+	pthread_cond_signal(&scn_cond);
+	pthread_mutex_unlock(&scn_mutex);
+}
+
 static int scn_loop()
 {
 	lprintf(INF "Reached the loop woo!\n");
@@ -65,15 +82,32 @@ static int scn_loop()
 	glDrawArrays(GL_TRIANGLES, 0, 3);
 	glDisableVertexAttribArray(0);
 	root_win_swapbuffers();
-	sleep(2);
+
+	/* show it for 2s, running the tasks given meanwhile */
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	ts.tv_sec += 2;
+	pthread_mutex_lock(&scn_mutex);
+	while (1) {
+		int t = tasks;
+		tasks = 0;
+		if (t) {
+			pthread_mutex_unlock(&scn_mutex);
+			ce_main_tasks();
+			pthread_mutex_lock(&scn_mutex);
+			continue;
+		}
+		if (pthread_cond_timedwait(&scn_cond, &scn_mutex, &ts))
+			break;
+	}
+	pthread_mutex_unlock(&scn_mutex);
 	return 0;
 }
 
-extern int (*control)();
-
 static int load()
 {
 	control = scn_loop;
+	control_wake = scn_wake;
 	lprintf(INF ""lF_WHI lBLD_"scn~tri selected."_lBLD _lF"\n");
 
 	/* Shader creation */
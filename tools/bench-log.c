@@ -0,0 +1,209 @@
+/*
+ * bench-log - measures the logging throughput of several threads
+ *
+ *	bench-log [-a] [-t THREADS] [-n MSGS] [-d DIR] [SINK...]
+ *
+ * Runs THREADS (4) threads each logging MSGS (100000) messages of a mix of
+ * levels and formats with lprintf() and lputs() for each SINK, by default all
+ * of them:
+ *
+ *	stderr:		stderr, at every level
+ *	level-wrn:	/dev/null, with the call sites passing %WRN and %ERR only
+ *	file:		a file in DIR (/tmp), at every level
+ *	sgr-file:	a file in DIR, at every level with the escape sequences
+ *			stripped (%LOGFILE_FILTER_SGR)
+ *	null:		/dev/null, at every level
+ *
+ * and reports the messages per second, the p50, p99 and p999 latency of the
+ * calls and the bytes the process wrote meanwhile, from /proc/self/io. -a
+ * logs asynchronously (log_async_start()). The latencies include a
+ * clock_gettime() pair, compare them by run.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include "ce-aux.h"
+#include "ce-log.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <time.h>
+#include <pthread.h>
+#include <assert.h>
+
+static int threads = 4;
+static int msgs = 100000;
+
+static unsigned long long now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+/**
+ * written() - get the bytes the process has written
+ *
+ * Return:	the count or %0 if it can't be read
+ */
+static unsigned long long written()
+{
+	FILE *f = fopen("/proc/self/io", "r");
+	if (!f)
+		return 0;
+	char ln[128];
+	unsigned long long w = 0;
+	while (fgets(ln, sizeof(ln), f)) {
+		if (sscanf(ln, "wchar: %llu", &w) == 1)
+			break;
+	}
+	fclose(f);
+	return w;
+}
+
+/**
+ * worker() - log the message mix
+ * @arg:	the latencies of the calls, @msgs of them
+ */
+static void *worker(void *arg)
+{
+	unsigned int *lat = arg;
+	static const char *names[] = { "scn-colour", "glx-ctx", "core-opt" };
+	unsigned long long t0 = now(), t;
+	for (int i = 0; i < msgs; i++, t0 = t) {
+		switch (i % 50) {
+		case 0:
+			lprintf(ERR "Failed to open "lBLD_"%s"_lBLD": %s.\n",
+					names[i % 3], "No such file");
+			break;
+		case 1: case 2: case 3: case 4:
+			lprintf(WRN "Functionality "lF_YELW"%s"_lF
+					" unavailable, %d dependants.\n",
+					names[i % 3], i % 7);
+			break;
+		case 5: case 6: case 7: case 8: case 9:
+		case 10: case 11: case 12: case 13: case 14:
+			lputs(TXT "Mouse movement (motion).");
+			break;
+		case 15: case 16: case 17: case 18: case 19:
+		case 20: case 21: case 22: case 23: case 24:
+		case 25: case 26: case 27: case 28: case 29:
+			lprintf(DBG "Frame %d: %f ms, "lF_BLUE"%u"_lF
+					" draws.\n", i, i * 0.016, i % 300);
+			break;
+		default:
+			lprintf(INF "Module "lBLD_"%s"_lBLD" (id "lF_BLUE
+					"%d"_lF") added.\n", names[i % 3], i);
+		}
+		t = now();
+		lat[i] = t - t0;
+	}
+	return NULL;
+}
+
+static int cmp_uint(const void *a, const void *b)
+{
+	unsigned int x = *(const unsigned int *) a;
+	unsigned int y = *(const unsigned int *) b;
+	return x < y ? -1 : x > y;
+}
+
+/**
+ * run() - run the threads against the configured sinks and report
+ * @sink:	name of the sink for the report
+ */
+static void run(const char *sink)
+{
+	unsigned int *lat = malloc(sizeof(*lat) * msgs * threads);
+	pthread_t *th = malloc(sizeof(*th) * threads);
+	assert(lat && th);
+	unsigned long long w = written(), t = now();
+	for (int i = 0; i < threads; i++)
+		pthread_create(th + i, NULL, worker, lat + (size_t) i * msgs);
+	for (int i = 0; i < threads; i++)
+		pthread_join(th[i], NULL);
+	log_flush();
+	t = now() - t;
+	w = written() - w;
+
+	size_t n = (size_t) msgs * threads;
+	qsort(lat, n, sizeof(*lat), cmp_uint);
+	printf("%-10s %7d %12.0f %8u %8u %8u %12llu\n", sink, threads,
+			n / (t * 1e-9), lat[n / 2], lat[n * 99 / 100],
+			lat[n * 999 / 1000], w);
+	fflush(stdout);
+	free(lat);
+	free(th);
+}
+
+int main(int argc, char **argv)
+{
+	static const char *sinks[] = {
+		"stderr", "level-wrn", "file", "sgr-file", "null", NULL
+	};
+	const char *dir = "/tmp";
+	bool async = false;
+	int i;
+	for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+		if (!strcmp(argv[i], "-a")) {
+			async = true;
+		} else if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+			threads = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-n") && i + 1 < argc) {
+			msgs = atoi(argv[++i]);
+		} else if (!strcmp(argv[i], "-d") && i + 1 < argc) {
+			dir = argv[++i];
+		} else {
+			fprintf(stderr, "usage: %s [-a] [-t THREADS] [-n MSGS] "
+					"[-d DIR] [SINK...]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (threads < 1 || msgs < 1000) {
+		fprintf(stderr, "bench-log: at least 1 thread and 1000 "
+				"messages.\n");
+		return EXIT_FAILURE;
+	}
+	const char **run_sinks = i < argc ? (const char **) argv + i : sinks;
+	char path[strlen(dir) + 16];
+	snprintf(path, sizeof(path), "%s/bench-log.txt", dir);
+
+	log_stderr_threshold(ERR);
+	if (async)
+		log_async_start(LOG_ASYNC_BLOCK, 0);
+	printf("%-10s %7s %12s %8s %8s %8s %12s\n", "sink", "threads",
+			"msgs/s", "p50 ns", "p99 ns", "p999 ns", "bytes");
+	for (const char **s = run_sinks; *s; s++) {
+		FILE *f = NULL;
+		int flags = LOGFILE_AUTOCLOSE;
+		if (!strcmp(*s, "stderr")) {
+			log_stderr_threshold(DBG);
+		} else if (!strcmp(*s, "level-wrn")) {
+			f = fopen("/dev/null", "w");
+			log_level_set(WRN);
+		} else if (!strcmp(*s, "file")) {
+			f = fopen(path, "w");
+		} else if (!strcmp(*s, "sgr-file")) {
+			f = fopen(path, "w");
+			flags |= LOGFILE_FILTER_SGR;
+		} else if (!strcmp(*s, "null")) {
+			f = fopen("/dev/null", "w");
+		} else {
+			fprintf(stderr, "bench-log: no sink %s.\n", *s);
+			return EXIT_FAILURE;
+		}
+		int hndl = -1;
+		if (f) {
+			hndl = log_txt_file_add(f, flags);
+			log_txt_file_threshold(hndl, DBG);
+		}
+		run(*s);
+		if (hndl >= 0)
+			log_txt_file_rm(hndl);
+		log_stderr_threshold(ERR);
+		log_level_set(DBG);
+	}
+	if (async)
+		log_async_stop();
+	remove(path);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,96 @@
+/*
+ * bench-sgr - compares SGR escape sequence stripping of log text
+ *
+ *	bench-sgr [MIB]
+ *
+ * Formats MIB (default 16) mebibytes of colour-heavy log lines like
+ * logfile_callback() does and strips the escape sequences both line by line,
+ * deleting them in place one by one as core/log.c used to, and with
+ * log_sgr_strip() over the whole buffer.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include "xf-escg.h"
+#include "../core/log-sgr.c"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <assert.h>
+
+static double now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+/* the old way, each sequence deleted with a memmove of the rest */
+static int strip_delete(char *s, int length)
+{
+	for (int i = 0; i < length; i++) {
+		if (s[i] != '\x1b' || s[i + 1] != '[')
+			continue;
+		int e;
+		for (e = i + 2; e < length && s[e] != 'm'; e++);
+		e++;
+		memmove(s + i, s + e, length - e);
+		length -= e - i;
+		i--;
+	}
+	return length;
+}
+
+int main(int argc, char **argv)
+{
+	static const char *lines[] = {
+		"[%3u] "lF_WHI"%16s"_lF" "lF_BLUE"INF"_lF": Module "lBLD_
+			"scn-colour"_lBLD" (id "lF_BLUE"%u"_lF") added.\n",
+		"[%3u] "lF_WHI"%16s"_lF" "lF_CYA"DBG"_lF": Struct sizes in "
+			"bytes: mod_inf: "lF_BLUE"%u"_lF", fcn_inf: "
+			lF_BLUE"8"_lF"\n",
+		"[%3u] "lF_WHI"%16s"_lF" "lF_WHI"TXT"_lF": Mouse movement "
+			"(motion): %u 12\n",
+		"[%3u] "lF_WHI"%16s"_lF" "lF_YELW"WRN"_lF": Functionality "
+			lF_YELW"gl-context"_lF" unavailable, line %u.\n",
+	};
+	size_t size = (argc > 1 ? atoi(argv[1]) : 16) << 20;
+	char *src = malloc(size + 256), *a = malloc(size), *b = malloc(size);
+	assert(src && a && b);
+	size_t length = 0;
+	for (unsigned i = 0; length < size; i++)
+		length += sprintf(src + length, lines[i % 4], i % 1000,
+				"core/mod.c+1088", i);
+	length = size;
+	int seqs = 0;
+	for (size_t i = 0; i < length; i++)
+		seqs += src[i] == '\x1b';
+
+	double t = now();
+	memcpy(a, src, length);
+	size_t la = 0;
+	for (size_t i = 0; i < length; ) {
+		char *nl = memchr(a + i, '\n', length - i);
+		size_t l = nl ? nl + 1 - (a + i) : length - i;
+		la += strip_delete(memmove(a + la, a + i, l), l);
+		i += l;
+	}
+	double td = now() - t;
+
+	t = now();
+	int lb = log_sgr_strip(b, src, length);
+	double ts = now() - t;
+
+	int ok = la == lb && !memcmp(a, b, la);
+	printf("%zu MiB, %d sequences\n", length >> 20, seqs);
+	printf("in-place deletes:  %8.1f MiB/s\n",
+			(length >> 20) / td);
+	printf("log_sgr_strip():   %8.1f MiB/s"
+#ifdef __SSE2__
+			" (SSE2)"
+#endif
+			"\n", (length >> 20) / ts);
+	printf("outputs %s\n", ok ? "match" : "DIFFER");
+	free(src);
+	free(a);
+	free(b);
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,157 @@
+/*
+ * logcollect - collects the logs streamed with --log-sock
+ *
+ *	logcollect [-o FILE] PATH
+ *
+ * Listens on the Unix socket PATH, (re)created, and writes the lines sent
+ * by any number of engines to FILE or stdout as they come in. The lines of
+ * the connections are kept whole, a connection's line is only written once
+ * its newline is in. Exits on SIGINT or SIGTERM, removing PATH.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <signal.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <assert.h>
+
+#define MAX_CONN 64
+#define LINE_MAX_LEN (1 << 16)
+
+/**
+ * struct conn - a connection of an engine
+ * @buf:	the start of a line not yet written
+ * @length:	length of @buf
+ */
+struct conn {
+	char buf[LINE_MAX_LEN];
+	int length;
+};
+
+static volatile sig_atomic_t quit = 0;
+
+static void on_signal(int sig)
+{
+	quit = 1;
+}
+
+/**
+ * conn_read() - read from a connection and write out its whole lines
+ * @fd:		the connection
+ * @c:		its line buffer
+ * @out:	file to write to
+ *
+ * Return:	negative when the connection is closed
+ */
+static int conn_read(int fd, struct conn *c, FILE *out)
+{
+	ssize_t r = read(fd, c->buf + c->length, sizeof(c->buf) - c->length);
+	if (r < 0 && (errno == EINTR || errno == EAGAIN))
+		return 0;
+	if (r <= 0) {
+		if (c->length) /* a line cut short */
+			fprintf(out, "%.*s\n", c->length, c->buf);
+		c->length = 0;
+		return -1;
+	}
+	c->length += r;
+	int n;
+	for (n = c->length; n > 0 && c->buf[n - 1] != '\n'; n--);
+	if (!n && c->length == sizeof(c->buf))
+		n = c->length; /* too long, split it */
+	fwrite(c->buf, 1, n, out);
+	memmove(c->buf, c->buf + n, c->length - n);
+	c->length -= n;
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	FILE *out = stdout;
+	int i;
+	for (i = 1; i < argc && argv[i][0] == '-'; i++) {
+		if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+			if (!(out = fopen(argv[++i], "a"))) {
+				perror(argv[i]);
+				return EXIT_FAILURE;
+			}
+		} else {
+			break;
+		}
+	}
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	if (i + 1 != argc || strlen(argv[i]) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "usage: %s [-o FILE] PATH\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	const char *path = argv[i];
+	strcpy(addr.sun_path, path);
+
+	int lfd = socket(AF_UNIX, SOCK_STREAM, 0);
+	unlink(path);
+	if (lfd < 0 || bind(lfd, (struct sockaddr *) &addr, sizeof(addr))
+			|| listen(lfd, 16)) {
+		perror(path);
+		return EXIT_FAILURE;
+	}
+	struct sigaction sa = { .sa_handler = on_signal };
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	signal(SIGPIPE, SIG_IGN);
+
+	struct pollfd pfd[MAX_CONN + 1] = { { lfd, POLLIN, 0 } };
+	struct conn *conn[MAX_CONN + 1] = { NULL };
+	int nfds = 1, total = 0;
+	while (!quit) {
+		fflush(out);
+		if (poll(pfd, nfds, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			break;
+		}
+		if ((pfd[0].revents & POLLIN)) {
+			int fd = accept(lfd, NULL, NULL);
+			if (fd >= 0 && nfds == MAX_CONN + 1) {
+				fprintf(stderr, "logcollect: too many "
+						"connections.\n");
+				close(fd);
+			} else if (fd >= 0) {
+				pfd[nfds] = (struct pollfd) { fd, POLLIN, 0 };
+				conn[nfds] = calloc(1, sizeof(struct conn));
+				assert(conn[nfds]);
+				nfds++;
+				total++;
+			}
+		}
+		for (int y = 1; y < nfds; y++) {
+			if (!pfd[y].revents)
+				continue;
+			if (conn_read(pfd[y].fd, conn[y], out) >= 0)
+				continue;
+			close(pfd[y].fd);
+			free(conn[y]);
+			nfds--;
+			pfd[y] = pfd[nfds];
+			conn[y] = conn[nfds];
+			y--;
+		}
+	}
+	for (int y = 1; y < nfds; y++) {
+		if (conn[y]->length)
+			fprintf(out, "%.*s\n", conn[y]->length, conn[y]->buf);
+		close(pfd[y].fd);
+		free(conn[y]);
+	}
+	fflush(out);
+	close(lfd);
+	unlink(path);
+	fprintf(stderr, "logcollect: %d connections.\n", total);
+	return EXIT_SUCCESS;
+}
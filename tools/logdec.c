@@ -0,0 +1,421 @@
+/*
+ * logdec - renders a binary log written with --log-bin as the text logs
+ *
+ *	logdec [-s] [FILE]
+ *
+ * Reads FILE or stdin and writes the lines in the format of the text logs to
+ * stdout, -s filters the escape sequences like %LOGFILE_FILTER_SGR.
+ */
+#include "ce-log-bin.h"
+#include "xf-escg.h"
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <stdbool.h>
+#include <assert.h>
+
+struct buf {
+	char *a;
+	size_t length;
+	size_t size;
+};
+
+static char **sites_a = NULL;
+static uint32_t sites_size = 0;
+
+static struct buf *threads_a = NULL;
+static uint32_t threads_size = 0;
+
+static struct buf line;
+static bool filter_sgr = false;
+
+static void buf_add(struct buf *b, const char *s, size_t length)
+{
+	if (b->length + length + 1 > b->size) {
+		do {
+			b->size = b->size ? b->size * 2 : 256;
+		} while (b->length + length + 1 > b->size);
+		b->a = realloc(b->a, b->size);
+		assert(b->a);
+	}
+	memcpy(b->a + b->length, s, length);
+	b->length += length;
+	b->a[b->length] = '\0';
+}
+
+static void buf_addf(struct buf *b, const char *fmt, ...)
+	__attribute__((format(printf,2,3)));
+static void buf_addf(struct buf *b, const char *fmt, ...)
+{
+	va_list l;
+	va_start(l, fmt);
+	int n = vsnprintf(NULL, 0, fmt, l);
+	va_end(l);
+	buf_add(b, "", 0);
+	if (b->length + n + 1 > b->size) {
+		b->size = b->length + n + 1;
+		b->a = realloc(b->a, b->size);
+		assert(b->a);
+	}
+	va_start(l, fmt);
+	vsnprintf(b->a + b->length, n + 1, fmt, l);
+	va_end(l);
+	b->length += n;
+}
+
+/**
+ * emit() - print a complete log line
+ * @s:		the line - "file+line:lvl:body\n"
+ * @length:	length of @s
+ * @t:		nanoseconds since logstart
+ *
+ * Mirrors logfile_callback() in core/log.c.
+ */
+static void emit(const char *s, size_t length, uint64_t t)
+{
+	static const char chrlvl[5][sizeof(lF_RED "ERR" _lF ": ")] = {
+		lF_RED "ERR" _lF ": ",
+		lF_YELW "WRN" _lF ": ",
+		lF_BLUE "INF" _lF ": ",
+		lF_WHI "TXT" _lF ": ",
+		lF_CYA "DBG" _lF ": "
+	};
+	const char *c = memchr(s, ':', length);
+	line.length = 0;
+	if (!c || c + 2 >= s + length || c[1] < '1' || c[1] > '5'
+			|| c[2] != ':') {
+		emit(LOG_LINE_MISSING, sizeof(LOG_LINE_MISSING) - 1, t);
+		line.length = 0;
+		buf_addf(&line, "[%3u.%06u] "lF_WHI"%16s"_lF" %s%.*s",
+				(unsigned) (t / 1000000000),
+				(unsigned) (t / 1000 % 1000000),
+				LOG_LINE_UNKNOWN, chrlvl[1], (int) length, s);
+	} else {
+		int origin = c - s > 80 ? 80 : c - s;
+		buf_addf(&line, "[%3u.%06u] "lF_WHI"%16.*s"_lF" %s%.*s",
+				(unsigned) (t / 1000000000),
+				(unsigned) (t / 1000 % 1000000), origin, s,
+				chrlvl[c[1] - '1'],
+				(int) (length - (c + 3 - s)), c + 3);
+	}
+	if (filter_sgr) {
+		size_t i, y = 0;
+		for (i = 0; i < line.length; i++) {
+			if (line.a[i] == '\x1b' && line.a[i + 1] == '[') {
+				for (i += 2; i < line.length && line.a[i] != 'm'; i++);
+				continue;
+			}
+			line.a[y++] = line.a[i];
+		}
+		line.length = y;
+	}
+	fwrite(line.a, 1, line.length, stdout);
+}
+
+/**
+ * render() - format a message from its stored arguments
+ * @b:		buffer to append to
+ * @fmt:	format of the site
+ * @p:		the arguments
+ * @end:	end of the arguments
+ *
+ * Return:	negative if the arguments don't match the format
+ */
+static int render(struct buf *b, const char *fmt, const char *p,
+		const char *end)
+{
+	struct log_bin_spec spec;
+	char conv[64];
+	int32_t w = 0, prec = 0, i;
+	int64_t ll;
+	double d;
+	uint32_t len;
+#define TAKE(v) do { \
+	if (end - p < sizeof(v)) \
+		return -1; \
+	memcpy(&v, p, sizeof(v)); \
+	p += sizeof(v); \
+} while (0)
+	while (*fmt) {
+		const char *pc = strchr(fmt, '%');
+		if (!pc) {
+			buf_add(b, fmt, strlen(fmt));
+			break;
+		}
+		buf_add(b, fmt, pc - fmt);
+		fmt = log_bin_conv(pc, &spec);
+		if (spec.width_arg)
+			TAKE(w);
+		if (spec.prec_arg)
+			TAKE(prec);
+
+		/* rebuild the conversion with the stored argument type */
+		const char *mods = pc + 1;
+		for (; *mods && !strchr("hljztLdiuoxXcfFeEgGaAspn%", *mods);
+				mods++);
+		int n = mods - pc;
+		if (n > sizeof(conv) - 8)
+			return -1;
+		memcpy(conv, pc, n);
+		conv[n] = '\0';
+		if (spec.type == LOG_BIN_LONG)
+			strcat(conv, "ll");
+		else if (spec.type == LOG_BIN_INT && fmt[-1] != 'c')
+			strncat(conv, mods, strspn(mods, "h"));
+		size_t k = strlen(conv);
+		conv[k] = fmt[-1];
+		conv[k + 1] = '\0';
+
+		switch (spec.type) {
+		case LOG_BIN_NONE:
+			if (fmt[-1] == '%')
+				buf_add(b, "%", 1);
+			continue;
+		case LOG_BIN_COUNT:
+			continue;
+		case LOG_BIN_INT:
+			TAKE(i);
+			break;
+		case LOG_BIN_LONG:
+		case LOG_BIN_PTR:
+			TAKE(ll);
+			break;
+		case LOG_BIN_DOUBLE:
+			TAKE(d);
+			break;
+		case LOG_BIN_STR:
+			TAKE(len);
+			if (end - p < len)
+				return -1;
+			/* the stored string already obeys the precision */
+			conv[n] = '\0';
+			if (spec.prec_arg || spec.prec >= 0)
+				*strchr(conv, '.') = '\0';
+			strcat(conv, ".*s");
+			break;
+		}
+
+#define CONVF(...) do { \
+	if (spec.width_arg && spec.prec_arg && spec.type != LOG_BIN_STR) \
+		buf_addf(b, conv, w, prec, __VA_ARGS__); \
+	else if (spec.width_arg) \
+		buf_addf(b, conv, w, __VA_ARGS__); \
+	else if (spec.prec_arg && spec.type != LOG_BIN_STR) \
+		buf_addf(b, conv, prec, __VA_ARGS__); \
+	else \
+		buf_addf(b, conv, __VA_ARGS__); \
+} while (0)
+		switch (spec.type) {
+		case LOG_BIN_INT:
+			CONVF(i);
+			break;
+		case LOG_BIN_LONG:
+			CONVF((long long) ll);
+			break;
+		case LOG_BIN_PTR:
+			CONVF((void *) (intptr_t) ll);
+			break;
+		case LOG_BIN_DOUBLE:
+			CONVF(d);
+			break;
+		case LOG_BIN_STR:
+			CONVF((int) len, p);
+			p += len;
+			break;
+		}
+#undef CONVF
+	}
+#undef TAKE
+	return 0;
+}
+
+/**
+ * render_kv() - format an lkv() message from its stored fields
+ * @b:		buffer to append to
+ * @msg:	message of the site
+ * @p:		the fields
+ * @end:	end of the fields
+ *
+ * Return:	negative if the fields are truncated
+ */
+static int render_kv(struct buf *b, const char *msg, const char *p,
+		const char *end)
+{
+	uint32_t count, len;
+	uint8_t h[2];
+	int64_t ll;
+	double d;
+	char v[48];
+#define TAKE(v) do { \
+	if (end - p < sizeof(v)) \
+		return -1; \
+	memcpy(&v, p, sizeof(v)); \
+	p += sizeof(v); \
+} while (0)
+	buf_add(b, msg, strlen(msg));
+	TAKE(count);
+	for (uint32_t i = 0; i < count; i++) {
+		TAKE(h);
+		if (end - p < h[1])
+			return -1;
+		buf_addf(b, " %.*s="lF_BLUE, (int) h[1], p);
+		p += h[1];
+		switch (h[0]) {
+		case LOG_FIELD_INT:
+		case LOG_FIELD_DUR:
+			TAKE(ll);
+			log_field_print(v, sizeof(v), h[0], ll, 0);
+			buf_add(b, v, strlen(v));
+			break;
+		case LOG_FIELD_FLOAT:
+			TAKE(d);
+			log_field_print(v, sizeof(v), h[0], 0, d);
+			buf_add(b, v, strlen(v));
+			break;
+		case LOG_FIELD_STR:
+			TAKE(len);
+			if (end - p < len)
+				return -1;
+			buf_add(b, p, len);
+			p += len;
+			break;
+		default:
+			return -1;
+		}
+		buf_add(b, _lF, strlen(_lF));
+	}
+	buf_add(b, "\n", 1);
+#undef TAKE
+	return 0;
+}
+
+/**
+ * message() - handle a message record
+ * @site:	site id
+ * @thread:	thread id
+ * @t:		nanoseconds since logstart
+ * @args:	the stored arguments
+ * @length:	length of @args
+ */
+static void message(uint32_t site, uint32_t thread, uint64_t t,
+		const char *args, size_t length)
+{
+	bool kv = site & LOG_BIN_KV;
+	site &= ~LOG_BIN_KV;
+	if (site >= sites_size || !sites_a[site]) {
+		fprintf(stderr, "logdec: undefined site %u.\n", site);
+		return;
+	}
+	if (thread >= threads_size) {
+		uint32_t osize = threads_size;
+		threads_size = thread * 2 + 1;
+		threads_a = realloc(threads_a, threads_size * sizeof(*threads_a));
+		assert(threads_a);
+		memset(threads_a + osize, 0, (threads_size - osize)
+				* sizeof(*threads_a));
+	}
+	struct buf *b = threads_a + thread;
+	size_t ol = b->length;
+	if ((kv ? render_kv(b, sites_a[site], args, args + length)
+			: render(b, sites_a[site], args, args + length)) < 0) {
+		b->length = ol;
+		fprintf(stderr, "logdec: arguments of site %u don't match its "
+				"format.\n", site);
+		return;
+	}
+	/* like log_raw_process(), lines are complete at '\n' */
+	size_t i, start = 0;
+	for (i = 0; i < b->length; i++) {
+		if (b->a[i] != '\n')
+			continue;
+		emit(b->a + start, i + 1 - start, t);
+		start = i + 1;
+	}
+	memmove(b->a, b->a + start, b->length - start);
+	b->length -= start;
+}
+
+int main(int argc, char **argv)
+{
+	FILE *f = stdin;
+	int i;
+	for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1]; i++) {
+		if (!strcmp(argv[i], "-s")) {
+			filter_sgr = true;
+		} else {
+			fprintf(stderr, "usage: %s [-s] [FILE]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (i < argc && !(f = fopen(argv[i], "rb"))) {
+		perror(argv[i]);
+		return EXIT_FAILURE;
+	}
+
+	struct log_bin_hdr hdr;
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1
+			|| memcmp(hdr.magic, LOG_BIN_MAGIC, sizeof(hdr.magic))
+			|| hdr.version < 1 || hdr.version > LOG_BIN_VERSION) {
+		fprintf(stderr, "logdec: not a version 1 to %u binary log.\n",
+				LOG_BIN_VERSION);
+		return EXIT_FAILURE;
+	}
+
+	struct buf rec = { NULL, 0, 0 };
+	uint32_t h[2];
+	while (fread(h, sizeof(h), 1, f) == 1) {
+		rec.length = 0;
+		buf_add(&rec, "", 0);
+		if (h[1] + 1 > rec.size) {
+			rec.size = h[1] + 1;
+			rec.a = realloc(rec.a, rec.size);
+			assert(rec.a);
+		}
+		if (fread(rec.a, 1, h[1], f) != h[1]) {
+			fprintf(stderr, "logdec: truncated record.\n");
+			break;
+		}
+		if (h[0] == LOG_BIN_SITE_DEF) {
+			uint32_t id;
+			if (h[1] < sizeof(id))
+				break;
+			memcpy(&id, rec.a, sizeof(id));
+			if (id >= sites_size) {
+				uint32_t osize = sites_size;
+				sites_size = id * 2 + 1;
+				sites_a = realloc(sites_a, sites_size
+						* sizeof(*sites_a));
+				assert(sites_a);
+				memset(sites_a + osize, 0, (sites_size - osize)
+						* sizeof(*sites_a));
+			}
+			free(sites_a[id]);
+			sites_a[id] = malloc(h[1] - sizeof(id) + 1);
+			assert(sites_a[id]);
+			memcpy(sites_a[id], rec.a + sizeof(id), h[1] - sizeof(id));
+			sites_a[id][h[1] - sizeof(id)] = '\0';
+			continue;
+		}
+		uint32_t thread;
+		uint64_t t;
+		if (h[1] < sizeof(thread) + sizeof(t))
+			break;
+		memcpy(&thread, rec.a, sizeof(thread));
+		memcpy(&t, rec.a + sizeof(thread), sizeof(t));
+		message(h[0], thread, t, rec.a + sizeof(thread) + sizeof(t),
+				h[1] - sizeof(thread) - sizeof(t));
+	}
+
+	/* unfinished lines */
+	for (uint32_t y = 0; y < threads_size; y++) {
+		if (!threads_a[y].length)
+			continue;
+		buf_add(threads_a + y, "\n", 1);
+		emit(threads_a[y].a, threads_a[y].length, 0);
+	}
+	if (f != stdin)
+		fclose(f);
+	return EXIT_SUCCESS;
+}
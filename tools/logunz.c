@@ -0,0 +1,468 @@
+/*
+ * logunz - decompresses a log written with --log-lz
+ *
+ *	logunz [-l] [-v] [-t SEC] [-u SEC] [-L LVL] [-o ORIGIN] [FILE]
+ *
+ * Writes the lines of FILE or stdin to stdout. -t starts from the first line
+ * logged SEC seconds after logstart or later, bisecting the blocks by their
+ * times, which needs FILE to be seekable, and -u stops after the lines of SEC
+ * seconds. -L keeps the lines of level LVL (err, wrn, inf, txt or dbg) and
+ * the more important ones, -o the lines of the source file ORIGIN, or of the
+ * files under it when it ends with '/'. -l lists the blocks instead of their
+ * lines, -v tells how many blocks were read. Torn and corrupt blocks are
+ * skipped with a warning when FILE is seekable.
+ *
+ * When FILE.idx exists, only the blocks the index tells to have matching
+ * lines are read, and the blocks written after the index are scanned.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include "ce-log-lz.h"
+#include "../core/log-lz.c"
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <sys/types.h>
+#include <assert.h>
+
+static struct log_lz_hdr hdr;
+static bool seekable = false;
+
+/* the query */
+static unsigned long long t_from = 0, t_until = ~0ull;
+static int lvl_max = '5';
+static const char *origin_want = NULL;
+static bool list = false;
+
+/**
+ * struct idx_block - a block of the index
+ * @e:		the entry
+ * @ids:	the origins of the block, count of @e.origins
+ */
+struct idx_block {
+	struct log_lz_idx_block e;
+	uint32_t *ids;
+};
+
+/* the index, if any */
+static struct idx_block *idx_a = NULL;
+static unsigned int idx_length = 0;
+static bool *idx_match = NULL; /* by origin id */
+static unsigned int idx_origins = 0;
+
+/**
+ * origin_match() - check an origin against -o
+ * @o:		the source file
+ * @length:	length of @o
+ */
+static bool origin_match(const char *o, int length)
+{
+	if (!origin_want)
+		return true;
+	int w = strlen(origin_want);
+	if (w && origin_want[w - 1] == '/')
+		return length >= w && !memcmp(o, origin_want, w);
+	return length == w && !memcmp(o, origin_want, w);
+}
+
+/**
+ * idx_load() - read the index of a compressed log
+ * @path:	path of the compressed log
+ *
+ * Return:	negative if there is no usable index
+ */
+static int idx_load(const char *path)
+{
+	char p[strlen(path) + 5];
+	snprintf(p, sizeof(p), "%s.idx", path);
+	FILE *f = fopen(p, "rb");
+	if (!f)
+		return -1;
+	struct log_lz_idx_hdr h;
+	if (fread(&h, sizeof(h), 1, f) != 1
+			|| memcmp(h.magic, LOG_LZ_IDX_MAGIC,
+				sizeof(LOG_LZ_IDX_MAGIC))
+			|| h.version != LOG_LZ_IDX_VERSION) {
+		fprintf(stderr, "logunz: %s is not a version %u index.\n", p,
+				LOG_LZ_IDX_VERSION);
+		fclose(f);
+		return -1;
+	}
+	unsigned int size = 0;
+	uint32_t rec[2];
+	while (fread(rec, sizeof(rec), 1, f) == 1) {
+		if (rec[1] > (1 << 24))
+			break;
+		char *data = malloc(rec[1] + 1);
+		assert(data);
+		if (fread(data, 1, rec[1], f) != rec[1]) {
+			free(data); /* torn by a crash */
+			break;
+		}
+		if (rec[0] == LOG_LZ_IDX_ORIGIN && rec[1] >= sizeof(uint32_t)) {
+			uint32_t id;
+			memcpy(&id, data, sizeof(id));
+			if (id >= idx_origins) {
+				idx_match = realloc(idx_match, id + 1);
+				assert(idx_match);
+				memset(idx_match + idx_origins, 0,
+						id + 1 - idx_origins);
+				idx_origins = id + 1;
+			}
+			idx_match[id] = origin_match(data + sizeof(id),
+					rec[1] - sizeof(id));
+		} else if (rec[0] == LOG_LZ_IDX_BLOCK
+				&& rec[1] >= sizeof(struct log_lz_idx_block)) {
+			if (idx_length == size) {
+				size = size ? size * 2 : 256;
+				idx_a = realloc(idx_a, size * sizeof(idx_a[0]));
+				assert(idx_a);
+			}
+			struct idx_block *b = idx_a + idx_length++;
+			memcpy(&b->e, data, sizeof(b->e));
+			if (b->e.origins > (rec[1] - sizeof(b->e))
+					/ sizeof(uint32_t))
+				b->e.origins = 0;
+			b->ids = malloc(b->e.origins * sizeof(uint32_t) + 1);
+			assert(b->ids);
+			memcpy(b->ids, data + sizeof(b->e),
+					b->e.origins * sizeof(uint32_t));
+		}
+		free(data);
+	}
+	fclose(f);
+	return 0;
+}
+
+/**
+ * idx_select() - check whether a block of the index may have lines to write
+ * @b:		the block
+ */
+static bool idx_select(const struct idx_block *b)
+{
+	if (b->e.time_last < t_from || b->e.time > t_until)
+		return false;
+	if (!(b->e.lvl_mask & ((1u << (lvl_max - '0')) - 1)))
+		return false;
+	if (!origin_want)
+		return true;
+	for (unsigned int i = 0; i < b->e.origins; i++) {
+		if (b->ids[i] < idx_origins && idx_match[b->ids[i]])
+			return true;
+	}
+	return false;
+}
+
+/**
+ * block_valid() - check a block header read from the file
+ * @b:		the header
+ */
+static bool block_valid(const struct log_lz_block *b)
+{
+	return b->magic == LOG_LZ_BLOCK_MAGIC
+		&& b->check == log_lz_block_check(b)
+		&& b->raw_length <= hdr.block_size
+		&& b->length <= LOG_LZ_BOUND(hdr.block_size);
+}
+
+/**
+ * next_block() - find the next block header in the file
+ * @f:		the file, seekable
+ * @off:	offset to look from, set to the offset of the header found
+ * @b:		the header found
+ *
+ * Leaves @f positioned after the header.
+ *
+ * Return:	negative if there are no more blocks
+ */
+static int next_block(FILE *f, off_t *off, struct log_lz_block *b)
+{
+	static unsigned char buf[1 << 16];
+	const size_t keep = sizeof(*b) - 1;
+	off_t at = *off;
+	if (fseeko(f, at, SEEK_SET))
+		return -1;
+	size_t length = fread(buf, 1, sizeof(buf), f);
+	for (;;) {
+		size_t i;
+		for (i = 0; i + sizeof(*b) <= length; i++) {
+			memcpy(b, buf + i, sizeof(*b));
+			if (!block_valid(b))
+				continue;
+			*off = at + i;
+			fseeko(f, at + i + sizeof(*b), SEEK_SET);
+			return 0;
+		}
+		if (length < sizeof(buf))
+			return -1;
+		at += i;
+		memmove(buf, buf + i, length - i);
+		length -= i;
+		length += fread(buf + length, 1, sizeof(buf) - length, f);
+		if (length <= keep)
+			return -1;
+	}
+}
+
+/**
+ * read_block() - read the header of the next block
+ * @f:		the file, positioned at a block header
+ * @b:		the header read
+ *
+ * Return:	negative at the end of the file
+ */
+static int read_block(FILE *f, struct log_lz_block *b)
+{
+	if (fread(b, sizeof(*b), 1, f) != 1)
+		return -1;
+	if (block_valid(b))
+		return 0;
+	if (!seekable) {
+		fprintf(stderr, "logunz: corrupt block header.\n");
+		return -1;
+	}
+	off_t off = ftello(f) - sizeof(*b) + 1;
+	if (next_block(f, &off, b) < 0)
+		return -1;
+	fprintf(stderr, "logunz: skipped to the block at %lld.\n",
+			(long long) off);
+	return 0;
+}
+
+/**
+ * read_data() - read or skip the data of a block
+ * @f:		the file, positioned after the header
+ * @b:		the header
+ * @data:	buffer to read to, %NULL to skip the data
+ * @scratch:	buffer to skip through when @f isn't seekable
+ *
+ * Return:	negative if the file ends before the data
+ */
+static int read_data(FILE *f, const struct log_lz_block *b, char *data,
+		char *scratch)
+{
+	if (!data && seekable)
+		return fseeko(f, b->length, SEEK_CUR);
+	if (fread(data ? data : scratch, 1, b->length, f) != b->length) {
+		fprintf(stderr, "logunz: truncated block.\n");
+		return -1;
+	}
+	return 0;
+}
+
+/**
+ * seek_time() - find the block to start from for a time
+ * @f:		the file, seekable
+ * @first:	offset of the first block
+ * @t:		nanoseconds since logstart
+ *
+ * Return:	offset of a block before the first one with lines at @t or
+ *		later
+ */
+static off_t seek_time(FILE *f, off_t first, unsigned long long t)
+{
+	struct log_lz_block b;
+	fseeko(f, 0, SEEK_END);
+	off_t lo = first, hi = ftello(f);
+	while (hi - lo > (off_t) sizeof(b)) {
+		off_t mid = lo + (hi - lo) / 2, at = mid;
+		if (next_block(f, &at, &b) < 0 || at >= hi)
+			hi = mid;
+		else if (b.time_last < t)
+			lo = at;
+		else
+			hi = mid;
+	}
+	return lo;
+}
+
+/**
+ * line_time() - get the time of a text log line
+ * @s:		the line, "[  12.345678] ..."
+ *
+ * Return:	nanoseconds since logstart or %0 if @s has no time
+ */
+static unsigned long long line_time(const char *s)
+{
+	unsigned int sec, usec;
+	if (sscanf(s, "[%u.%6u]", &sec, &usec) != 2)
+		return 0;
+	return sec * 1000000000ull + usec * 1000ull;
+}
+
+/**
+ * write_lines() - write the lines of a decoded block that match the query
+ * @s:		the lines
+ * @end:	end of @s
+ *
+ * The lines that aren't log lines, the rest of a line longer than a block,
+ * go with the line before them.
+ */
+static void write_lines(const char *s, const char *end)
+{
+	static bool keep = true;
+	if (t_from == 0 && t_until == ~0ull && lvl_max == '5' && !origin_want) {
+		fwrite(s, 1, end - s, stdout);
+		return;
+	}
+	const char *nl;
+	for (; s < end; s = nl + 1) {
+		nl = memchr(s, '\n', end - s);
+		if (!nl)
+			nl = end - 1;
+		const char *o;
+		int length;
+		int lvl = log_lz_line_parse(s, nl + 1, &o, &length);
+		if (lvl) {
+			unsigned long long t = line_time(s);
+			keep = t >= t_from && t <= t_until && lvl <= lvl_max
+				&& origin_match(o, length);
+		}
+		if (keep)
+			fwrite(s, 1, nl + 1 - s, stdout);
+	}
+}
+
+/* the buffers of use_block() */
+static char *data, *raw;
+static unsigned int blocks = 0, decoded = 0;
+
+/**
+ * use_block() - list a block or write its lines
+ * @f:		the file, positioned after the header
+ * @b:		the header
+ * @skip:	list the block or skip it without decoding it
+ *
+ * Return:	negative if the file ends before the data
+ */
+static int use_block(FILE *f, const struct log_lz_block *b, bool skip)
+{
+	blocks++;
+	if (read_data(f, b, skip ? NULL : data, data) < 0)
+		return -1;
+	if (list) {
+		long long off = seekable ? (long long) ftello(f)
+			- (long long) (sizeof(*b) + b->length) : -1;
+		printf("%12lld [%5u.%06u - %5u.%06u] %7u lines "
+				"%8u B -> %8u B%s\n", off,
+				(unsigned int) (b->time / 1000000000),
+				(unsigned int) (b->time / 1000 % 1000000),
+				(unsigned int) (b->time_last / 1000000000),
+				(unsigned int) (b->time_last / 1000 % 1000000),
+				b->lines, b->raw_length, b->length,
+				(b->flags & LOG_LZ_STORED) ? " stored" : "");
+		return 0;
+	}
+	if (skip)
+		return 0;
+	decoded++;
+	int length = b->raw_length;
+	if ((b->flags & LOG_LZ_STORED))
+		memcpy(raw, data, b->length);
+	else
+		length = log_lz_decompress(raw, hdr.block_size, data,
+				b->length);
+	if (length != (int) b->raw_length) {
+		fprintf(stderr, "logunz: corrupt block skipped.\n");
+		return 0;
+	}
+	write_lines(raw, raw + length);
+	return 0;
+}
+
+static const char lvl_names[] = "errwrninftxtdbg";
+
+int main(int argc, char **argv)
+{
+	FILE *f = stdin;
+	bool verbose = false;
+	double from = -1, until = -1;
+	int i;
+	for (i = 1; i < argc && argv[i][0] == '-' && argv[i][1]; i++) {
+		const char *l;
+		if (!strcmp(argv[i], "-l")) {
+			list = true;
+		} else if (!strcmp(argv[i], "-v")) {
+			verbose = true;
+		} else if (!strcmp(argv[i], "-t") && i + 1 < argc) {
+			from = atof(argv[++i]);
+		} else if (!strcmp(argv[i], "-u") && i + 1 < argc) {
+			until = atof(argv[++i]);
+		} else if (!strcmp(argv[i], "-L") && i + 1 < argc
+				&& strlen(argv[i + 1]) == 3
+				&& (l = strstr(lvl_names, argv[i + 1]))
+				&& (l - lvl_names) % 3 == 0) {
+			lvl_max = '1' + (l - lvl_names) / 3;
+			i++;
+		} else if (!strcmp(argv[i], "-o") && i + 1 < argc) {
+			origin_want = argv[++i];
+		} else {
+			fprintf(stderr, "usage: %s [-l] [-v] [-t SEC] [-u SEC] "
+					"[-L LVL] [-o ORIGIN] [FILE]\n",
+					argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (i < argc && !(f = fopen(argv[i], "rb"))) {
+		perror(argv[i]);
+		return EXIT_FAILURE;
+	}
+	if (fread(&hdr, sizeof(hdr), 1, f) != 1
+			|| memcmp(hdr.magic, LOG_LZ_MAGIC, sizeof(LOG_LZ_MAGIC))
+			|| hdr.version != LOG_LZ_VERSION
+			|| hdr.block_size > (1 << 20)) {
+		fprintf(stderr, "logunz: not a version %u compressed log.\n",
+				LOG_LZ_VERSION);
+		return EXIT_FAILURE;
+	}
+	off_t first = ftello(f);
+	seekable = first >= 0 && !fseeko(f, first, SEEK_SET);
+	unsigned long long t = from > 0 ? from * 1e9 : 0;
+	if (t && !seekable) {
+		fprintf(stderr, "logunz: -t needs a seekable file.\n");
+		return EXIT_FAILURE;
+	}
+	t_from = t;
+	if (until >= 0)
+		t_until = until * 1e9;
+	raw = malloc(hdr.block_size + 1);
+	data = malloc(LOG_LZ_BOUND(hdr.block_size));
+	assert(data && raw);
+
+	struct log_lz_block b;
+	if (seekable && i < argc && idx_load(argv[i]) >= 0) {
+		for (unsigned int n = 0; n < idx_length; n++) {
+			if (!idx_select(idx_a + n))
+				continue;
+			fseeko(f, idx_a[n].e.offset, SEEK_SET);
+			if (read_block(f, &b) < 0)
+				break;
+			if (ftello(f) - sizeof(b) != idx_a[n].e.offset)
+				fprintf(stderr, "logunz: the index doesn't "
+						"match the file.\n");
+			if (use_block(f, &b, false) < 0)
+				break;
+		}
+		/* go on with the blocks written after the index */
+		if (idx_length) {
+			fseeko(f, idx_a[idx_length - 1].e.offset, SEEK_SET);
+			if (read_block(f, &b) < 0
+					|| read_data(f, &b, NULL, data) < 0)
+				goto out;
+		}
+	} else if (t_from) {
+		fseeko(f, seek_time(f, first, t_from), SEEK_SET);
+	}
+	while (read_block(f, &b) >= 0) {
+		if (b.time > t_until && !list)
+			break;
+		if (use_block(f, &b, b.time_last < t_from) < 0)
+			break;
+	}
+out:
+	if (verbose)
+		fprintf(stderr, "logunz: %u blocks read, %u decoded.\n",
+				blocks, decoded);
+	free(data);
+	free(raw);
+	return EXIT_SUCCESS;
+}
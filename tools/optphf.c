@@ -0,0 +1,214 @@
+/*
+ * optphf - generates the perfect hash of the option names of the sources
+ *
+ *	optphf FILE.c... > opt-phf.h
+ *
+ * Collects the long names of the option tables of the FILEs, the
+ * &struct opt entries "{ ARG_..., 'c', "name", ...", and writes their hash
+ * and displace table, see include/ce-opt-phf.h, for core/opt.c. Run by the
+ * build over the sources linked into the engine.
+ */
+#define _POSIX_C_SOURCE 200809L
+#include "ce-opt-phf.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <assert.h>
+
+#define NAMES_MAX 4096
+#define SEED_MAX UINT16_MAX
+
+static const char *names[NAMES_MAX];
+static int names_len[NAMES_MAX];
+static int names_count = 0;
+
+static void name_add(const char *s, int len)
+{
+	for (int i = 0; i < names_count; i++) {
+		if (names_len[i] == len && !memcmp(names[i], s, len))
+			return;
+	}
+	if (names_count == NAMES_MAX) {
+		fprintf(stderr, "optphf: over %d names.\n", NAMES_MAX);
+		exit(EXIT_FAILURE);
+	}
+	char *n = malloc(len + 1);
+	assert(n);
+	memcpy(n, s, len);
+	n[len] = '\0';
+	names[names_count] = n;
+	names_len[names_count++] = len;
+}
+
+static const char *skip_space(const char *s)
+{
+	for (; isspace((unsigned char) *s); s++);
+	return s;
+}
+
+/**
+ * scan() - collect the long option names of a source
+ * @src:	the source, terminated
+ */
+static void scan(const char *src)
+{
+	static const char *args[] = { "ARG_NONE", "ARG_REQUIRED",
+		"ARG_OPTIONAL" };
+	for (const char *s = src; (s = strstr(s, "ARG_")); s++) {
+		const char *b = s;
+		for (; b > src && isspace((unsigned char) b[-1]); b--);
+		if (b == src || b[-1] != '{')
+			continue;
+		int i;
+		for (i = 0; i < 3 && strncmp(s, args[i], strlen(args[i])); i++);
+		if (i == 3)
+			continue;
+		const char *c = skip_space(s + strlen(args[i]));
+		if (*c++ != ',')
+			continue;
+		c = skip_space(c);
+		if (*c++ != '\'')
+			continue;
+		for (; *c && *c != '\''; c++) {
+			if (*c == '\\' && c[1])
+				c++;
+		}
+		if (!*c)
+			continue;
+		c = skip_space(c + 1);
+		if (*c++ != ',')
+			continue;
+		c = skip_space(c);
+		if (*c++ != '"')
+			continue;
+		const char *e = strchr(c, '"');
+		if (e && e > c && e - c <= UINT8_MAX)
+			name_add(c, e - c);
+	}
+}
+
+static char *read_file(const char *path)
+{
+	FILE *f = fopen(path, "r");
+	if (!f)
+		return NULL;
+	size_t size = 0, length = 0;
+	char *buf = NULL;
+	do {
+		size = size ? size * 2 : 1 << 16;
+		buf = realloc(buf, size + 1);
+		assert(buf);
+		length += fread(buf + length, 1, size - length, f);
+	} while (length == size);
+	fclose(f);
+	buf[length] = '\0';
+	return buf;
+}
+
+/**
+ * build() - find the seeds of the buckets
+ * @buckets:	count of buckets
+ * @slots:	count of slots
+ * @seed:	set to the seeds of the buckets
+ * @slot_a:	set to the name index of each slot, %-1 when empty
+ *
+ * The buckets are placed the fullest first, each with the first seed that
+ * puts its names in empty slots.
+ *
+ * Return:	non-zero if a bucket couldn't be placed
+ */
+static int build(int buckets, int slots, uint16_t *seed, int *slot_a)
+{
+	uint64_t hash[names_count + 1];
+	int bucket_a[names_count + 1], order[buckets], size[buckets];
+	memset(size, 0, sizeof(size));
+	for (int i = 0; i < names_count; i++) {
+		hash[i] = opt_phf_hash(names[i], names_len[i]);
+		bucket_a[i] = opt_phf_bucket(hash[i], buckets);
+		size[bucket_a[i]]++;
+	}
+	for (int b = 0; b < buckets; b++) {
+		int i;
+		for (i = b; i > 0 && size[order[i - 1]] < size[b]; i--)
+			order[i] = order[i - 1];
+		order[i] = b;
+	}
+	for (int i = 0; i < slots; i++)
+		slot_a[i] = -1;
+	for (int o = 0; o < buckets; o++) {
+		int b = order[o];
+		seed[b] = 0;
+		if (!size[b])
+			continue;
+		int in[size[b]], n = 0;
+		for (int i = 0; i < names_count; i++) {
+			if (bucket_a[i] == b)
+				in[n++] = i;
+		}
+		int d, placed[size[b]];
+		for (d = 1; d <= SEED_MAX; d++) {
+			int k;
+			for (k = 0; k < n; k++) {
+				placed[k] = opt_phf_slot(hash[in[k]], d, slots);
+				int y = 0;
+				while (y < k && placed[y] != placed[k])
+					y++;
+				if (slot_a[placed[k]] >= 0 || y < k)
+					break;
+			}
+			if (k == n)
+				break;
+		}
+		if (d > SEED_MAX)
+			return -1;
+		seed[b] = d;
+		for (int k = 0; k < n; k++)
+			slot_a[placed[k]] = in[k];
+	}
+	return 0;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s FILE.c...\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	for (int i = 1; i < argc; i++) {
+		char *src = read_file(argv[i]);
+		if (!src) {
+			perror(argv[i]);
+			return EXIT_FAILURE;
+		}
+		scan(src);
+		free(src);
+	}
+
+	int buckets = names_count / 4 + 1, slots = names_count * 5 / 4 + 1;
+	uint16_t seed[NAMES_MAX / 4 + 1];
+	int slot_a[NAMES_MAX * 2];
+	while (build(buckets, slots, seed, slot_a)) {
+		slots += slots / 8 + 1;
+		assert(slots <= NAMES_MAX * 2);
+	}
+
+	printf("/* generated by optphf of %d option names, don't edit */\n"
+			"#define OPT_PHF_BUCKETS %d\n"
+			"#define OPT_PHF_SLOTS %d\n"
+			"static const uint16_t opt_phf_seed[OPT_PHF_BUCKETS] "
+			"= {",
+			names_count, buckets, slots);
+	for (int b = 0; b < buckets; b++)
+		printf("%s%u,", b % 10 ? " " : "\n\t", seed[b]);
+	printf("\n};\nstatic const uint8_t opt_phf_len[OPT_PHF_SLOTS] = {");
+	for (int i = 0; i < slots; i++)
+		printf("%s%d,", i % 10 ? " " : "\n\t",
+				slot_a[i] < 0 ? 0 : names_len[slot_a[i]]);
+	printf("\n};\nstatic const char *const opt_phf_name[OPT_PHF_SLOTS] "
+			"= {\n");
+	for (int i = 0; i < slots; i++)
+		printf("\t\"%s\",\n", slot_a[i] < 0 ? "" : names[slot_a[i]]);
+	printf("};\n");
+	return EXIT_SUCCESS;
+}